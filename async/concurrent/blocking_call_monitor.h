@@ -0,0 +1,55 @@
+#ifndef ASYNC_CONCURRENT_BLOCKING_CALL_MONITOR_
+#define ASYNC_CONCURRENT_BLOCKING_CALL_MONITOR_
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+namespace sss {
+namespace async {
+
+// Describes a non-blocking worker thread that was stuck in a single task (e.g.
+// a slow file read or a lock wait inside a kernel) for longer than the
+// threshold.
+struct BlockedWorkerReport {
+  int worker = -1;
+  // Trace name of the task, see ScopedTaskTraceName. Empty if the task has no
+  // name.
+  std::string taskName;
+  // How long the task has been running when it was detected (lower bound).
+  std::chrono::nanoseconds duration{0};
+  // True if a compensating worker was started, false if all the compensating
+  // workers are already running.
+  bool compensated = false;
+};
+
+// The non-blocking work queue can watch its workers from a monitor thread, and
+// activate extra compensating workers while some of the workers are blocked,
+// so that a blocking call does not reduce the queue parallelism. Compensating
+// workers retire again as soon as the blocked tasks complete.
+struct BlockingCallOptions {
+  // A worker running one task for longer than this is considered blocked.
+  // Zero disables the monitor.
+  std::chrono::milliseconds threshold{0};
+
+  // Maximum number of compensating workers active at the same time. These
+  // threads are started with the queue, and stay retired until needed.
+  int maxCompensatingWorkers = 0;
+
+  // Called from the monitor thread for every detected blocked worker. Must not
+  // block for long, it delays detection of other blocked workers.
+  void (*report)(const BlockedWorkerReport &report) = nullptr;
+
+  bool enabled() const { return threshold.count() > 0; }
+
+  // Number of threads the queue starts in addition to the requested ones.
+  unsigned NumSpareThreads() const {
+    if (!enabled()) return 0;
+    return static_cast<unsigned>(std::max(0, maxCompensatingWorkers));
+  }
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_BLOCKING_CALL_MONITOR_ */
@@ -3,9 +3,9 @@
 
 #include <limits>
 #include <list>
-#include <queue>
 #include <ratio>
 
+#include "async/concurrent/idle_thread_stack.h"
 #include "async/concurrent/task_queue.h"
 #include "async/concurrent/work_queue_base.h"
 #include "async/support/task_function.h"
@@ -46,11 +46,16 @@ class BlockingWorkQueue
   std::optional<TaskFunction> EnqueueBlockingTask(TaskFunction task);
 
   // Runs `task` in one of the dynamically started threads. Returns task
-  // wrapped in optional if can't assign it to a worker thread.
+  // wrapped in optional if can't assign it to a worker thread. Handing the task
+  // over to an idle thread is lock-free, only starting a new thread takes the
+  // queue mutex.
   std::optional<TaskFunction> RunBlockingTask(TaskFunction task);
 
   void Quiesce();
 
+  // Fills in the blocking part of the work queue `stats`.
+  void GetStats(WorkQueueStats *stats);
+
  private:
   static constexpr char const *kThreadNamePrefix = "async-blocking-queue";
   static constexpr char const *kDynamicThreadNamePrefix = "async-dynamic-queue";
@@ -58,6 +63,8 @@ class BlockingWorkQueue
   template <typename WorkQueue>
   friend class WorkQueueBase;
 
+  using Base::CallerCounters;
+  using Base::DropIfCancelled;
   using Base::GetPerThread;
   using Base::IsNotifyParkedThreadRequired;
   using Base::IsQuiescing;
@@ -77,9 +84,9 @@ class BlockingWorkQueue
   // relationship, and can guarantee that tasks with inter-dependencies
   // will all make progress together.
 
-  // Waits for the next available task. Returns empty optional if the task was
-  // not found.
-  std::optional<TaskFunction> WaitNextTask(std::unique_lock<std::mutex> *lock);
+  // Joins and removes the dynamic threads that left their loop. Requires
+  // `mMutex`, exited threads do not touch the queue after releasing it.
+  void JoinExitedThreads();
 
   // Maximum number of dynamically started threads.
   const uint64_t mMaxNumDynamicThreads;
@@ -88,20 +95,16 @@ class BlockingWorkQueue
   // stopping.
   const std::chrono::nanoseconds mIdleWaitTime;
 
-  // All operations with dynamic threads are done holding this mutex.
+  // Dynamic threads start and exit holding this mutex.
   std::mutex mMutex;
-  std::condition_variable mWakeDoWorkCV;
   std::condition_variable mThreadExitedCV;
 
   // Number of started dynamic threads.
   size_t mNumDynamicThreads = 0;
 
-  // Number of dynamic threads waiting for the next task.
-  size_t mNumIdleDynamicThreads = 0;
-
-  // This queue is a temporary storage to transfer task ownership to one of the
-  // idle threads. It does not keep more tasks than there are idle threads.
-  std::queue<TaskFunction> mIdleTaskQueue;
+  // Idle dynamic threads wait here for the next task. Slots are allocated and
+  // released under `mMutex`.
+  IdleThreadStack mIdleThreads;
 
   // Unique pointer owning a dynamic thread, and an active flag.
   using DynamicThread = std::pair<std::unique_ptr<Thread>, bool>;
@@ -111,8 +114,10 @@ class BlockingWorkQueue
   // `mDynamicThreads` on each call to `RunBlockingTask`.
   std::list<DynamicThread> mDynamicThreads;
 
-  // Idle threads must stop waiting for the next task in the `mIdleTaskQueue`.
+  // Quiesce() waits for the dynamic threads to exit, guarded by `mMutex`.
   bool mStopWaiting = false;
+
+  BlockingCounters mBlockingCounters;
 };
 
 template <typename ThreadingEnvironment>
@@ -160,9 +165,11 @@ BlockingWorkQueue<ThreadingEnvironment>::EnqueueBlockingTask(
     // and even if we are running inside a non-blocking work queue, a single
     // potential context switch won't negatively impact system performance.
     if (isQuiescing) {
+      mBlockingCounters.Add(BlockingCounter::kInlineTasks);
       (*inlineTask)();
       return std::nullopt;
     } else {
+      mBlockingCounters.Add(BlockingCounter::kRejectedTasks);
       return inlineTask;
     }
   }
@@ -175,7 +182,10 @@ BlockingWorkQueue<ThreadingEnvironment>::EnqueueBlockingTask(
   // destruction of this. We expect that such a scenario is prevented by the
   // program, that is, this is kept alive while any threads can potentially be
   // in Schedule.
-  if (IsNotifyParkedThreadRequired()) mEventCount.Notify(false);
+  if (IsNotifyParkedThreadRequired()) {
+    CallerCounters(pt).Add(WorkerCounter::kUnparks);
+    mEventCount.Notify(false);
+  }
 
   return std::nullopt;
 }
@@ -183,29 +193,28 @@ BlockingWorkQueue<ThreadingEnvironment>::EnqueueBlockingTask(
 template <typename ThreadingEnvironment>
 std::optional<TaskFunction>
 BlockingWorkQueue<ThreadingEnvironment>::RunBlockingTask(TaskFunction task) {
-  std::unique_lock<std::mutex> lock(mMutex);
-
   // Attach a PendingTask counter only if we were able to submit the task
   // to one of the worker threads. It's unsafe to return the task with
   // a counter to the caller, because we don't know when/if it will be
   // destructed and the counter decremented.
-  auto wrap = [&](TaskFunction task) -> TaskFunction {
+  auto wrap = [this](TaskFunction task) -> TaskFunction {
     return IsQuiescing() ? WithPendingTaskCounter(std::move(task))
                          : std::move(task);
   };
 
-  // There are idle threads. We enqueue the task to the queue and then notify
-  // one of the idle threads.
-  if (mIdleTaskQueue.size() < mNumIdleDynamicThreads) {
-    mIdleTaskQueue.emplace(wrap(std::move(task)));
-    mWakeDoWorkCV.notify_one();
-
+  // There are idle threads. Pass the task to the most recently parked one.
+  std::optional<TaskFunction> rejected =
+      mIdleThreads.Handoff(std::move(task), wrap);
+  if (!rejected.has_value()) {
+    mBlockingCounters.Add(BlockingCounter::kDynamicTasks);
     return std::nullopt;
   }
+  task = std::move(*rejected);
+
+  std::unique_lock<std::mutex> lock(mMutex);
 
   // Cleanup dynamic threads that are already terminated.
-  mDynamicThreads.remove_if(
-      [](DynamicThread &thread) -> bool { return thread.second == false; });
+  JoinExitedThreads();
 
   // There are no idle threads and we are not at the thread limit. We
   // start a new thread to run the task.
@@ -217,31 +226,33 @@ BlockingWorkQueue<ThreadingEnvironment>::RunBlockingTask(TaskFunction task) {
     mDynamicThreads.emplace_back();
     DynamicThread &dynamicThread = mDynamicThreads.back();
 
-    auto do_work = [this, &dynamicThread,
+    // Without a parking slot the thread exits after its first task.
+    IdleThreadStack::Slot *slot = mIdleThreads.NewSlot();
+
+    auto do_work = [this, &dynamicThread, slot,
                     task = wrap(std::move(task))]() mutable {
-      task();
+      if (!DropIfCancelled(&task)) task();
       // Reset executed task to call destructor without holding the lock,
       // because it might be expensive. Also we want to call it before
       // notifying quiescing thread, because destructor potentially could
       // drop the last references on captured async values.
       task.reset();
 
-      std::unique_lock<std::mutex> lock(mMutex);
-
-      // Try to get the next task. If one is found, run it. If there is no
-      // task to execute, GetNextTask will return None that converts to
-      // false.
-      while (std::optional<TaskFunction> task = WaitNextTask(&lock)) {
-        mMutex.unlock();
-        // Do not hold the lock while executing and destructing the task.
-        (*task)();
-        task.reset();
-        mMutex.lock();
+      // Wait for the next task and run it. Returns empty optional if there was
+      // no task for `mIdleWaitTime`, or on Quiesce().
+      while (slot) {
+        std::optional<TaskFunction> next = mIdleThreads.Wait(
+            slot, std::chrono::steady_clock::now() + mIdleWaitTime);
+        if (!next.has_value()) break;
+        if (!DropIfCancelled(&*next)) (*next)();
+        next.reset();
       }
 
       // No more work to do or shutdown occurred. Exit the thread.
+      std::unique_lock<std::mutex> lock(mMutex);
       dynamicThread.second = false;
       --mNumDynamicThreads;
+      if (slot) mIdleThreads.FreeSlot(slot);
       if (mStopWaiting) mThreadExitedCV.notify_one();
     };
 
@@ -249,6 +260,8 @@ BlockingWorkQueue<ThreadingEnvironment>::RunBlockingTask(TaskFunction task) {
     dynamicThread.second = true;  // is active
     dynamicThread.first = ThreadingEnvironment::StartThread(std::move(do_work));
     ++mNumDynamicThreads;
+    mBlockingCounters.Add(BlockingCounter::kDynamicThreadsStarted);
+    mBlockingCounters.Add(BlockingCounter::kDynamicTasks);
 
     return std::nullopt;
   }
@@ -258,29 +271,6 @@ BlockingWorkQueue<ThreadingEnvironment>::RunBlockingTask(TaskFunction task) {
   return {std::move(task)};
 }
 
-template <typename ThreadingEnvironment>
-std::optional<TaskFunction>
-BlockingWorkQueue<ThreadingEnvironment>::WaitNextTask(
-    std::unique_lock<std::mutex> *lock) {
-  ++mNumIdleDynamicThreads;
-
-  const auto timeout = std::chrono::system_clock::now() + mIdleWaitTime;
-  mWakeDoWorkCV.wait_until(*lock, timeout, [this]() {
-    return !mIdleTaskQueue.empty() || mStopWaiting;
-  });
-  --mNumIdleDynamicThreads;
-
-  // Found something in the queue. Return the task.
-  if (!mIdleTaskQueue.empty()) {
-    TaskFunction task = std::move(mIdleTaskQueue.front());
-    mIdleTaskQueue.pop();
-    return {std::move(task)};
-  }
-
-  // Shutdown occurred. Return empty optional.
-  return std::nullopt;
-}
-
 template <typename ThreadingEnvironment>
 void BlockingWorkQueue<ThreadingEnvironment>::Quiesce() {
   Base::Quiesce();
@@ -296,16 +286,42 @@ void BlockingWorkQueue<ThreadingEnvironment>::Quiesce() {
 
   // Wake up all idle threads.
   mStopWaiting = true;
-  mWakeDoWorkCV.notify_all();
+  mIdleThreads.Stop();
 
   // Wait until all dynamicaly started threads stopped.
   mThreadExitedCV.wait(lock, [this]() { return mNumDynamicThreads == 0; });
-  assert(mIdleTaskQueue.empty());
+  JoinExitedThreads();
 
   // Prepare for the next call to Quiesce.
+  mIdleThreads.Resume();
   mStopWaiting = false;
 }
 
+template <typename ThreadingEnvironment>
+void BlockingWorkQueue<ThreadingEnvironment>::JoinExitedThreads() {
+  mDynamicThreads.remove_if([](DynamicThread &thread) -> bool {
+    if (thread.second) return false;
+    ThreadingEnvironment::Join(thread.first.get());
+    return true;
+  });
+}
+
+template <typename ThreadingEnvironment>
+void BlockingWorkQueue<ThreadingEnvironment>::GetStats(WorkQueueStats *stats) {
+  Base::GetWorkerStats(&stats->blocking);
+  stats->numInlineBlockingTasks =
+      mBlockingCounters.Get(BlockingCounter::kInlineTasks);
+  stats->numRejectedBlockingTasks =
+      mBlockingCounters.Get(BlockingCounter::kRejectedTasks);
+  stats->numDynamicThreadsStarted =
+      mBlockingCounters.Get(BlockingCounter::kDynamicThreadsStarted);
+  stats->numDynamicTasks = mBlockingCounters.Get(BlockingCounter::kDynamicTasks);
+
+  stats->numIdleDynamicThreads = mIdleThreads.NumIdle();
+  std::lock_guard<std::mutex> lock(mMutex);
+  stats->numDynamicThreads = mNumDynamicThreads;
+}
+
 template <typename ThreadingEnvironment>
 std::optional<TaskFunction> BlockingWorkQueue<ThreadingEnvironment>::NextTask(
     Queue *queue) {
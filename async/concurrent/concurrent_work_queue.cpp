@@ -1,7 +1,10 @@
 #include "async/concurrent/concurrent_work_queue.h"
 
+#include <chrono>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace sss {
 namespace async {
@@ -15,6 +18,48 @@ WorkQueueFactoryMap *GetWorkQueueFactories() {
 }  // namespace
 
 ConcurrentWorkQueue::~ConcurrentWorkQueue() = default;
+WorkQueueStats ConcurrentWorkQueue::GetStats() { return WorkQueueStats(); }
+bool ConcurrentWorkQueue::RunPendingTask() { return false; }
+int ConcurrentWorkQueue::SetParallelismLevel(int level) {
+  (void)level;
+  return GetParallelismLevel();
+}
+void ConcurrentWorkQueue::AddTask(TaskFunction work,
+                                  WorkerAffinity affinity) {
+  (void)affinity;
+  AddTask(std::move(work));
+}
+
+void ConcurrentWorkQueue::AddTasks(absl::Span<TaskFunction> work) {
+  for (TaskFunction &task : work) AddTask(std::move(task));
+}
+
+TimerHandle ConcurrentWorkQueue::AddTimer(
+    std::chrono::steady_clock::time_point deadline, TaskFunction work) {
+  std::call_once(mTimersOnce, [this]() {
+    mTimers = std::make_unique<internal::TimerWheel>();
+  });
+  RCReference<internal::TimerEntry> entry =
+      mTimers->Schedule(deadline, std::move(work));
+  TaskFunction wait([this, deadline, entry = entry.CopyRef()]() {
+    std::this_thread::sleep_until(deadline);
+    // The wheel rounds deadlines up to its resolution, and another thread may
+    // hold it for an earlier deadline.
+    std::vector<TaskFunction> expired;
+    while (entry->state() == internal::TimerEntry::State::kPending) {
+      if (mTimers->Advance(std::chrono::steady_clock::now(), &expired) == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      for (TaskFunction &task : expired) AddTask(std::move(task));
+      expired.clear();
+    }
+  });
+  if (AddBlockingTask(std::move(wait), /*allowQueuing=*/true).has_value()) {
+    // Nothing would ever fire the timer.
+    mTimers->Cancel(entry.get());
+  }
+  return TimerHandle(std::move(entry));
+}
 void RegisterWorkQueueFactory(std::string_view name, WorkQueueFactory factory) {
   auto p = GetWorkQueueFactories()->try_emplace(name, std::move(factory));
   (void)p;
@@ -1,11 +1,17 @@
 #ifndef INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONCURRENT_CONCURRENT_WORK_QUEUE_
 #define INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONCURRENT_CONCURRENT_WORK_QUEUE_
 
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string_view>
 
 #include "absl/types/span.h"
+#include "async/concurrent/timer_wheel.h"
+#include "async/concurrent/work_queue_options.h"
+#include "async/concurrent/work_queue_stats.h"
+#include "async/concurrent/worker_affinity.h"
 #include "async/support/ref_count.h"
 #include "async/support/task_function.h"
 
@@ -19,22 +25,68 @@ class ConcurrentWorkQueue {
 
  protected:
   virtual void AddTask(TaskFunction work) = 0;
+  // Adds a task with a preferred worker thread. The hint is ignored by
+  // default.
+  virtual void AddTask(TaskFunction work, WorkerAffinity affinity);
+  // Adds a batch of tasks to the queue. Implementations can override it to
+  // publish all the tasks before waking up worker threads, by default tasks
+  // are added one by one.
+  virtual void AddTasks(absl::Span<TaskFunction> work);
   virtual std::optional<TaskFunction> AddBlockingTask(TaskFunction work,
                                                       bool allowQueuing) = 0;
+  // Adds `work` to the queue at `deadline`. The returned handle can cancel the
+  // timer before it fires. By default every timer parks a blocking task until
+  // its deadline, even if it is cancelled, and the timer is cancelled if the
+  // blocking task is rejected. Queues with timers of their own override it.
+  virtual TimerHandle AddTimer(std::chrono::steady_clock::time_point deadline,
+                               TaskFunction work);
   virtual void Await(absl::Span<const RCReference<AsyncValue>> values) = 0;
   virtual void Quiesce() = 0;
+  // Runs one pending non-blocking task in the caller thread, preferring the
+  // caller own queue if it is a worker thread. Returns false if there was
+  // nothing to run. By default the caller never helps.
+  virtual bool RunPendingTask();
   virtual int GetParallelismLevel() const = 0;
+  // Changes the number of worker threads executing non-blocking tasks, and
+  // returns the new parallelism level. By default the level is fixed.
+  virtual int SetParallelismLevel(int level);
   virtual bool IsInWorkerThread() const = 0;
+  // Returns a snapshot of the work queue counters, by default it is empty.
+  virtual WorkQueueStats GetStats();
   ConcurrentWorkQueue() = default;
 
  private:
   friend class HostContext;
   ConcurrentWorkQueue(const ConcurrentWorkQueue &) = delete;
   ConcurrentWorkQueue &operator=(const ConcurrentWorkQueue &) = delete;
+
+  // Timers of the default AddTimer(), created by the first call.
+  std::once_flag mTimersOnce;
+  std::unique_ptr<internal::TimerWheel> mTimers;
 };
 std::unique_ptr<ConcurrentWorkQueue> CreateSingleThreadedWorkQueue();
+// `options.spin` control how the non-blocking worker threads spin before
+// parking when they run out of work. If `options.maxNumThreads` is larger
+// than `num_threads`, the extra non-blocking workers are started parked, and
+// the pool can be grown up to `options.maxNumThreads` with
+// SetParallelismLevel().
+//
+// If `options.pinWorkers` is true, non-blocking workers are pinned to CPUs
+// read from /sys/devices/system/cpu, and steal tasks from the workers sharing
+// an L2/L3 cache or the NUMA node before going to remote ones. Blocking
+// threads are never pinned.
+//
+// If `options.blockingCalls` are enabled, a monitor thread detects
+// non-blocking workers stuck in one task for longer than the threshold, and
+// activates compensating workers until the task completes. Blocked workers are
+// logged with the task trace name, unless the options have their own
+// `report`.
+//
+// `options.elastic` make the non-blocking workers start on demand and exit
+// when idle, see ElasticPoolOptions.
 std::unique_ptr<ConcurrentWorkQueue> CreateMultiThreadedWorkQueue(
-    int num_threads, int num_blocking_threads);
+    int num_threads, int num_blocking_threads,
+    const WorkQueueOptions &options = WorkQueueOptions());
 using WorkQueueFactory =
     unique_function<std::unique_ptr<ConcurrentWorkQueue>(std::string_view arg)>;
 std::unique_ptr<ConcurrentWorkQueue> CreateWorkQueue(std::string_view config);
@@ -0,0 +1,313 @@
+#include "async/concurrent/cpu_info.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace sss {
+namespace async {
+namespace {
+
+std::optional<std::string> ReadFile(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) return std::nullopt;
+  std::stringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+std::optional<long long> ReadInteger(const std::string &path) {
+  std::optional<std::string> content = ReadFile(path);
+  if (!content) return std::nullopt;
+  std::istringstream in(*content);
+  long long value;
+  if (!(in >> value)) return std::nullopt;
+  return value;
+}
+
+// Calls `f` for the cgroup `path` and all its ancestors, the effective limit
+// is the smallest one in the hierarchy. When the process runs in its own
+// cgroup namespace the path is just "/".
+template <typename F>
+void ForEachAncestor(std::string path, F &&f) {
+  while (!path.empty() && path.back() == '/') path.pop_back();
+  for (;;) {
+    f(path);
+    if (path.empty()) return;
+    path.resize(path.rfind('/'));
+  }
+}
+
+void MinLimit(std::optional<double> *result, std::optional<double> limit) {
+  if (limit && (!*result || *limit < **result)) *result = limit;
+}
+
+std::vector<int> SchedulableCpus() {
+  std::vector<int> cpus;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+// CPUs sharing a resource are identified by the smallest CPU in the list.
+int MinCpu(const std::optional<std::string> &list, int fallback) {
+  if (!list) return fallback;
+  std::vector<int> cpus = internal::ParseCpuList(*list);
+  if (cpus.empty()) return fallback;
+  return *std::min_element(cpus.begin(), cpus.end());
+}
+
+// The NUMA node of a CPU is only exposed as a `nodeN` link in its directory.
+int ReadNumaNode(const std::string &cpuDir) {
+  int node = -1;
+#if defined(__linux__)
+  DIR *dir = opendir(cpuDir.c_str());
+  if (dir == nullptr) return node;
+  while (dirent *entry = readdir(dir)) {
+    std::string_view name(entry->d_name);
+    if (name.size() > 4 && name.substr(0, 4) == "node" &&
+        std::all_of(name.begin() + 4, name.end(),
+                    [](char c) { return c >= '0' && c <= '9'; })) {
+      node = std::atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+#else
+  (void)cpuDir;
+#endif
+  return node;
+}
+
+internal::StealTier Distance(const CpuLocation &a, const CpuLocation &b) {
+  if (a.core == b.core || (a.l2 >= 0 && a.l2 == b.l2)) {
+    return internal::kSameL2;
+  }
+  if (a.l3 >= 0 && a.l3 == b.l3) return internal::kSameL3;
+  const bool sameNode = a.node >= 0 && b.node >= 0 ? a.node == b.node
+                                                   : a.package == b.package;
+  return sameNode ? internal::kSameNode : internal::kRemote;
+}
+
+}  // namespace
+
+int GetSchedulableCpuCount() {
+#if defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    int count = CPU_COUNT(&cpus);
+    if (count > 0) return count;
+  }
+#endif
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+int GetAvailableCpuCount() {
+  int count = GetSchedulableCpuCount();
+  std::optional<std::string> procSelfCgroup = ReadFile("/proc/self/cgroup");
+  if (!procSelfCgroup) return count;
+  std::optional<double> limit =
+      internal::ReadCgroupCpuLimit(*procSelfCgroup, "/sys/fs/cgroup");
+  if (limit) {
+    count = std::min(count, std::max(1, static_cast<int>(std::ceil(*limit))));
+  }
+  return count;
+}
+
+std::vector<CpuLocation> GetCpuTopology() {
+  std::vector<int> cpus = SchedulableCpus();
+  if (cpus.empty()) return {};
+  return internal::ReadCpuTopology("/sys/devices/system/cpu", cpus);
+}
+
+namespace internal {
+
+std::optional<double> ParseCgroupV2CpuMax(std::string_view content) {
+  std::istringstream in{std::string(content)};
+  std::string max;
+  long long period;
+  if (!(in >> max >> period) || max == "max" || period <= 0) {
+    return std::nullopt;
+  }
+  char *end = nullptr;
+  long long quota = std::strtoll(max.c_str(), &end, 10);
+  if (*end != '\0' || quota <= 0) return std::nullopt;
+  return static_cast<double>(quota) / static_cast<double>(period);
+}
+
+std::optional<double> CgroupV1CpuLimit(long long quota, long long period) {
+  if (quota <= 0 || period <= 0) return std::nullopt;
+  return static_cast<double>(quota) / static_cast<double>(period);
+}
+
+std::optional<double> ReadCgroupCpuLimit(std::string_view procSelfCgroup,
+                                         const std::string &cgroupRoot) {
+  std::optional<double> result;
+
+  // Each line is "hierarchy-ID:controller-list:cgroup-path".
+  std::istringstream lines{std::string(procSelfCgroup)};
+  std::string line;
+  while (std::getline(lines, line)) {
+    const size_t first = line.find(':');
+    const size_t second =
+        first == std::string::npos ? first : line.find(':', first + 1);
+    if (second == std::string::npos) continue;
+    const std::string id = line.substr(0, first);
+    const std::string controllers = line.substr(first + 1, second - first - 1);
+    const std::string path = line.substr(second + 1);
+
+    if (id == "0" && controllers.empty()) {
+      // cgroup v2 unified hierarchy.
+      ForEachAncestor(path, [&](const std::string &dir) {
+        if (std::optional<std::string> cpuMax =
+                ReadFile(cgroupRoot + dir + "/cpu.max")) {
+          MinLimit(&result, ParseCgroupV2CpuMax(*cpuMax));
+        }
+      });
+      continue;
+    }
+
+    // cgroup v1, only the hierarchy with the `cpu` controller matters.
+    std::istringstream list(controllers);
+    std::string controller;
+    bool hasCpu = false;
+    while (std::getline(list, controller, ',')) hasCpu |= controller == "cpu";
+    if (!hasCpu) continue;
+
+    for (const char *mount : {"/cpu,cpuacct", "/cpuacct,cpu", "/cpu"}) {
+      ForEachAncestor(path, [&](const std::string &dir) {
+        const std::string prefix = cgroupRoot + mount + dir;
+        std::optional<long long> quota =
+            ReadInteger(prefix + "/cpu.cfs_quota_us");
+        std::optional<long long> period =
+            ReadInteger(prefix + "/cpu.cfs_period_us");
+        if (quota && period) {
+          MinLimit(&result, CgroupV1CpuLimit(*quota, *period));
+        }
+      });
+    }
+  }
+  return result;
+}
+
+std::vector<int> ParseCpuList(std::string_view list) {
+  std::vector<int> cpus;
+  std::istringstream in{std::string(list)};
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    int first, last;
+    char dash;
+    std::istringstream r(range);
+    if (!(r >> first)) continue;
+    if (!(r >> dash >> last) || dash != '-') last = first;
+    for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<CpuLocation> ReadCpuTopology(const std::string &sysfsCpuRoot,
+                                         const std::vector<int> &cpus) {
+  std::vector<CpuLocation> topology;
+  topology.reserve(cpus.size());
+  for (int cpu : cpus) {
+    const std::string dir = sysfsCpuRoot + "/cpu" + std::to_string(cpu);
+    std::optional<long long> package =
+        ReadInteger(dir + "/topology/physical_package_id");
+    // Without the topology directory there is nothing to place workers by.
+    if (!package) return {};
+
+    CpuLocation location;
+    location.cpu = cpu;
+    location.package = static_cast<int>(*package);
+    location.core =
+        MinCpu(ReadFile(dir + "/topology/thread_siblings_list"), cpu);
+    for (int index = 0;; ++index) {
+      const std::string cache = dir + "/cache/index" + std::to_string(index);
+      std::optional<long long> level = ReadInteger(cache + "/level");
+      if (!level) break;
+      std::optional<std::string> type = ReadFile(cache + "/type");
+      if (type && type->rfind("Instruction", 0) == 0) continue;
+      const int id = MinCpu(ReadFile(cache + "/shared_cpu_list"), cpu);
+      if (*level == 2) location.l2 = id;
+      if (*level == 3) location.l3 = id;
+    }
+    location.node = ReadNumaNode(dir);
+    topology.push_back(location);
+  }
+  return topology;
+}
+
+WorkerPlacement PlaceWorkers(const std::vector<CpuLocation> &topology,
+                             unsigned numWorkers) {
+  WorkerPlacement placement;
+  if (topology.size() < 2 || numWorkers == 0) return placement;
+
+  // Rank of the CPU among its SMT siblings, the first thread of every core
+  // comes before all the second threads.
+  std::vector<std::pair<int, CpuLocation>> ranked;
+  for (const CpuLocation &location : topology) {
+    int rank = 0;
+    for (const auto &other : ranked) rank += other.second.core == location.core;
+    ranked.emplace_back(rank, location);
+  }
+  std::sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) {
+    const CpuLocation &x = a.second;
+    const CpuLocation &y = b.second;
+    return std::tie(a.first, x.node, x.package, x.l3, x.l2, x.core, x.cpu) <
+           std::tie(b.first, y.node, y.package, y.l3, y.l2, y.core, y.cpu);
+  });
+
+  // More workers than CPUs wrap around.
+  std::vector<CpuLocation> workers(numWorkers);
+  for (unsigned i = 0; i < numWorkers; ++i) {
+    workers[i] = ranked[i % ranked.size()].second;
+    placement.cpus.push_back(workers[i].cpu);
+  }
+
+  placement.stealOrder.resize(numWorkers);
+  placement.tierEnd.resize(numWorkers);
+  for (unsigned i = 0; i < numWorkers; ++i) {
+    // Start from the worker itself, so that workers of the same tier do not
+    // all visit the queues in the same order.
+    std::vector<unsigned> &order = placement.stealOrder[i];
+    for (unsigned j = 0; j < numWorkers; ++j) {
+      order.push_back((i + j) % numWorkers);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+      return Distance(workers[i], workers[a]) <
+             Distance(workers[i], workers[b]);
+    });
+
+    std::array<unsigned, kNumStealTiers> &tierEnd = placement.tierEnd[i];
+    unsigned end = 0;
+    for (int tier = 0; tier < kNumStealTiers; ++tier) {
+      while (end < numWorkers &&
+             Distance(workers[i], workers[order[end]]) == tier) {
+        ++end;
+      }
+      tierEnd[tier] = end;
+    }
+  }
+  return placement;
+}
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
@@ -0,0 +1,97 @@
+#ifndef ASYNC_CONCURRENT_CPU_INFO_
+#define ASYNC_CONCURRENT_CPU_INFO_
+
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sss {
+namespace async {
+
+// Returns the number of CPUs the calling thread is allowed to run on
+// (sched_getaffinity), falls back to std::thread::hardware_concurrency(). Never
+// returns less than one.
+int GetSchedulableCpuCount();
+
+// Returns the number of CPUs the process can actually use: the schedulable CPU
+// count, further limited by the cgroup (v2 `cpu.max`, or v1
+// `cpu.cfs_quota_us` / `cpu.cfs_period_us`) CPU bandwidth quota, rounded up.
+// Inside a container limited to 2.5 CPUs on a 64 core host it returns 3.
+int GetAvailableCpuCount();
+
+// Position of a logical CPU in the cache and memory hierarchy. Ids are only
+// meaningful for comparison between CPUs, -1 if unknown.
+struct CpuLocation {
+  int cpu = -1;
+  int core = -1;     // physical core, SMT siblings share it
+  int l2 = -1;       // L2 cache
+  int l3 = -1;       // last level cache
+  int package = -1;  // socket
+  int node = -1;     // NUMA node
+};
+
+// Returns the locations of the CPUs the calling thread is allowed to run on,
+// read from /sys/devices/system/cpu. Empty if the topology is not available.
+std::vector<CpuLocation> GetCpuTopology();
+
+namespace internal {
+
+// Parses a sysfs CPU list ("0-3,8,10-11").
+std::vector<int> ParseCpuList(std::string_view list);
+
+// Reads the locations of `cpus` from a sysfs CPU directory `sysfsCpuRoot`
+// (/sys/devices/system/cpu). Parameterized for testing.
+std::vector<CpuLocation> ReadCpuTopology(const std::string &sysfsCpuRoot,
+                                         const std::vector<int> &cpus);
+
+// Steal tiers, from the closest to the most remote worker.
+enum StealTier {
+  kSameL2,    // SMT siblings, or cores sharing an L2 cache
+  kSameL3,    // cores sharing the last level cache
+  kSameNode,  // the same NUMA node (or socket if NUMA is unknown)
+  kRemote,    // other NUMA nodes
+  kNumStealTiers,
+};
+
+// WorkerPlacement assigns worker threads to CPUs, and for every worker lists
+// the other workers from the closest to the most remote one.
+struct WorkerPlacement {
+  // CPU of each worker thread.
+  std::vector<int> cpus;
+  // Worker indices in the steal order, starting with the worker itself.
+  std::vector<std::vector<unsigned>> stealOrder;
+  // stealOrder[i][tierEnd[i][t - 1], tierEnd[i][t]) are the workers of tier
+  // `t` (tierEnd[i][-1] is 0).
+  std::vector<std::array<unsigned, kNumStealTiers>> tierEnd;
+
+  bool empty() const { return cpus.empty(); }
+};
+
+// Places `numWorkers` on the CPUs of the `topology`. Workers fill one thread of
+// every physical core before using SMT siblings, node by node, so that workers
+// with adjacent indices share caches. Returns an empty placement if the
+// topology has less than two CPUs, there is nothing to gain from pinning.
+WorkerPlacement PlaceWorkers(const std::vector<CpuLocation> &topology,
+                             unsigned numWorkers);
+
+// Parses the content of the cgroup v2 `cpu.max` file ("$MAX $PERIOD"). Returns
+// the quota in CPUs, or nullopt if the quota is not set ("max").
+std::optional<double> ParseCgroupV2CpuMax(std::string_view content);
+
+// Returns the cgroup v1 quota in CPUs, or nullopt if the quota is not set
+// (`quota` is -1).
+std::optional<double> CgroupV1CpuLimit(long long quota, long long period);
+
+// Returns the CPU limit of the cgroup the process belongs to. `procSelfCgroup`
+// is the content of /proc/self/cgroup, `cgroupRoot` is the cgroup filesystem
+// mount point (/sys/fs/cgroup). Parameterized for testing.
+std::optional<double> ReadCgroupCpuLimit(std::string_view procSelfCgroup,
+                                         const std::string &cgroupRoot);
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_CPU_INFO_ */
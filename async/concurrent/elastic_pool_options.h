@@ -0,0 +1,31 @@
+#ifndef ASYNC_CONCURRENT_ELASTIC_POOL_OPTIONS_
+#define ASYNC_CONCURRENT_ELASTIC_POOL_OPTIONS_
+
+#include <chrono>
+
+namespace sss {
+namespace async {
+
+// By default a work queue starts all its worker threads in the constructor,
+// and they live until the queue is destroyed. An elastic queue starts workers
+// on demand, when a task is submitted and all the started workers are busy,
+// and releases the workers that stay without work for `idleTimeout`. Released
+// workers are started again when the load comes back.
+//
+// Threads never exceed the configured number of workers, the parallelism
+// level still controls how many of them can run at the same time.
+struct ElasticPoolOptions {
+  // Do not start any worker in the constructor.
+  bool lazyStart = false;
+
+  // Workers without work for this long exit. Zero keeps idle workers parked
+  // forever.
+  std::chrono::milliseconds idleTimeout{0};
+
+  bool enabled() const { return lazyStart || idleTimeout.count() > 0; }
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_ELASTIC_POOL_OPTIONS_ */
@@ -4,6 +4,11 @@
 #include <memory>
 #include <thread>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace sss {
 namespace async {
 namespace internal {
@@ -16,6 +21,18 @@ struct StdThreadingEnvironment {
   }
   static void Join(Thread *thread) { thread->join(); }
   static void Detatch(Thread *thread) { thread->detach(); }
+  // Pins the calling thread to `cpu`, returns false if it is not supported.
+  static bool SetThisThreadAffinity(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+  }
   static uint64_t ThisThreadIdHash() {
     return std::hash<std::thread::id>()(std::this_thread::get_id());
   }
@@ -3,10 +3,13 @@
 
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <vector>
 
+#include "async/support/futex.h"
+
 namespace sss {
 namespace async {
 namespace internal {
@@ -23,8 +26,8 @@ class EventCount {
   void operator=(const EventCount &) = delete;
 
   ~EventCount() {
-    // Ensure there are no waiters.
-    assert(mState.load() == kStackMask);
+    // Ensure there are no waiters, except the abandoned ones.
+    assert(OnlyAbandonedWaiters());
   }
 
   Waiter *waiter(unsigned index) { return &mWaiters[index]; }
@@ -47,7 +50,11 @@ class EventCount {
   // CommitWait commits waiting after Prewait.
   void CommitWait(Waiter *w) {
     assert((w->epoch & ~kEpochMask) == 0);
-    w->state = Waiter::kNotSignaled;
+    if (TakeOver(w)) {
+      if (!CancelTakenOverWait(w)) Park(w);
+      return;
+    }
+    ResetWaiter(w);
     const uint64_t me = (w - &mWaiters[0]) | w->epoch;
     uint64_t state = mState.load(std::memory_order_seq_cst);
     for (;;) {
@@ -74,6 +81,99 @@ class EventCount {
     }
   }
 
+  // CommitWaitUntil is a CommitWait that also returns at `deadline`, or when the
+  // waiter is interrupted. Returns true if the thread was signaled. Otherwise
+  // the thread is still registered in the waiter stack (it can't remove itself
+  // from the middle of the stack), it may do some bounded amount of work that
+  // does not touch this event count as a waiter, and then it must call
+  // ResumeWaitUntil to go back to sleep, until it is finally signaled, or
+  // Abandon to stop waiting.
+  bool CommitWaitUntil(Waiter *w,
+                       std::chrono::steady_clock::time_point deadline) {
+    assert((w->epoch & ~kEpochMask) == 0);
+    if (TakeOver(w)) {
+      if (CancelTakenOverWait(w)) return true;
+      return ParkUntil(w, deadline);
+    }
+    ResetWaiter(w);
+    const uint64_t me = (w - &mWaiters[0]) | w->epoch;
+    uint64_t state = mState.load(std::memory_order_seq_cst);
+    for (;;) {
+      CheckState(state, true);
+      uint64_t newstate;
+      if ((state & kSignalMask) != 0) {
+        newstate = state - kWaiterInc - kSignalInc;
+      } else {
+        newstate = ((state & kWaiterMask) - kWaiterInc) | me;
+        w->next.store(state & (kStackMask | kEpochMask),
+                      std::memory_order_relaxed);
+      }
+      CheckState(newstate);
+      if (mState.compare_exchange_weak(state, newstate,
+                                       std::memory_order_acq_rel)) {
+        if ((state & kSignalMask) != 0) return true;
+        w->epoch += kEpochInc;
+        return ParkUntil(w, deadline);
+      }
+    }
+  }
+
+  // ResumeWaitUntil continues waiting after CommitWaitUntil returned false.
+  bool ResumeWaitUntil(Waiter *w,
+                       std::chrono::steady_clock::time_point deadline) {
+    return ParkUntil(w, deadline);
+  }
+
+  // Abandon ends the wait of a thread after CommitWaitUntil or ResumeWaitUntil
+  // returned false, without waking up anybody. The waiter stays in the stack
+  // until a Notify pops it and passes the notification on to the next waiter,
+  // or until the next CommitWait of the same waiter takes its place over.
+  // Returns true if the waiter was signaled in the meantime, the caller owns
+  // that notification.
+  bool Abandon(Waiter *w) {
+#if defined(ASYNC_FUTEX_PARKING)
+    uint32_t word = w->word.load(std::memory_order_acquire);
+    for (;;) {
+      if ((word & Waiter::kStateMask) == Waiter::kSignaled) break;
+      const uint32_t abandoned =
+          (word & ~Waiter::kStateMask) | Waiter::kAbandoned;
+      if (w->word.compare_exchange_weak(word, abandoned,
+                                        std::memory_order_acq_rel)) {
+        return false;
+      }
+    }
+#else
+    {
+      std::lock_guard<std::mutex> lock(w->mu);
+      if (w->state != Waiter::kSignaled) {
+        w->state = Waiter::kAbandoned;
+        return false;
+      }
+    }
+#endif
+    w->parked = false;
+    return true;
+  }
+
+  // Wakes up a thread blocked in CommitWaitUntil or ResumeWaitUntil without
+  // signaling it, the call returns false. Used to re-arm the waiter with an
+  // earlier deadline.
+  void Interrupt(Waiter *w) {
+#if defined(ASYNC_FUTEX_PARKING)
+    const uint32_t prev =
+        w->word.fetch_or(Waiter::kInterrupted, std::memory_order_acq_rel);
+    if ((prev & Waiter::kStateMask) == Waiter::kWaiting) FutexWake(&w->word, 1);
+#else
+    unsigned state;
+    {
+      std::lock_guard<std::mutex> lock(w->mu);
+      state = w->state;
+      w->interrupted = true;
+    }
+    if (state == Waiter::kWaiting) w->cv.notify_one();
+#endif
+  }
+
   // CancelWait cancels effects of the previous Prewait call.
   void CancelWait() {
     uint64_t state = mState.load(std::memory_order_relaxed);
@@ -127,8 +227,10 @@ class EventCount {
         if ((state & kStackMask) == kStackMask) return;
         Waiter *w = &mWaiters[state & kStackMask];
         if (!notify_all) w->next.store(kStackMask, std::memory_order_relaxed);
-        Unpark(w);
-        return;
+        if (Unpark(w) > 0 || notify_all) return;
+        // The waiter was abandoned, pass the notification on.
+        state = mState.load(std::memory_order_acquire);
+        continue;
       }
     }
   }
@@ -138,15 +240,44 @@ class EventCount {
     // Align to 128 byte boundary to prevent false sharing with other Waiter
     // objects in the same vector.
     alignas(128) std::atomic<uint64_t> next;
+#if defined(ASYNC_FUTEX_PARKING)
+    // The futex word: the state in the low bits, and the kInterrupted flag
+    // set by Interrupt, consumed by the next ParkUntil.
+    std::atomic<uint32_t> word{kNotSignaled};
+#else
     std::mutex mu;
     std::condition_variable cv;
-    uint64_t epoch = 0;
     unsigned state = kNotSignaled;
+    // Set by Interrupt, consumed by the next ParkUntil.
+    bool interrupted = false;
+#endif
+    uint64_t epoch = 0;
+    // True if the last wait blocked the thread and ended with a signal, in
+    // this case `unparkTime` is the time when it was signaled by Unpark. A
+    // wait that timed out or was interrupted leaves no sample.
+    bool parked = false;
+    std::chrono::steady_clock::time_point unparkTime;
+
+    // Returns the wake up latency of the last wait, or a negative value if the
+    // thread was not parked and signaled. A latency is returned only once, a
+    // wait that was cancelled after Prewait returns a negative value. Must be
+    // called by the waiting thread.
+    std::chrono::nanoseconds TakeWakeupLatency() {
+      if (!parked) return std::chrono::nanoseconds(-1);
+      parked = false;
+      return std::chrono::steady_clock::now() - unparkTime;
+    }
     enum {
       kNotSignaled,
       kWaiting,
       kSignaled,
+      // Left in the stack by Abandon.
+      kAbandoned,
     };
+#if defined(ASYNC_FUTEX_PARKING)
+    static constexpr uint32_t kStateMask = 3;
+    static constexpr uint32_t kInterrupted = 4;
+#endif
   };
 
  private:
@@ -181,27 +312,196 @@ class EventCount {
   std::atomic<uint64_t> mState;
   std::vector<Waiter> mWaiters;
 
+  // Prepares the waiter for the next CommitWait, a pending interrupt is kept.
+  static void ResetWaiter(Waiter *w) {
+#if defined(ASYNC_FUTEX_PARKING)
+    w->word.fetch_and(Waiter::kInterrupted, std::memory_order_relaxed);
+#else
+    w->state = Waiter::kNotSignaled;
+#endif
+    w->parked = false;
+  }
+
+#if defined(ASYNC_FUTEX_PARKING)
+  // Moves the waiter to the kWaiting state unless it is already signaled.
+  // Returns the futex word to wait on, or kSignaled.
+  static uint32_t PrepareFutexWait(Waiter *w) {
+    uint32_t word = w->word.load(std::memory_order_acquire);
+    for (;;) {
+      const uint32_t state = word & Waiter::kStateMask;
+      if (state == Waiter::kSignaled || state == Waiter::kWaiting) return word;
+      const uint32_t waiting = (word & ~Waiter::kStateMask) | Waiter::kWaiting;
+      if (w->word.compare_exchange_weak(word, waiting,
+                                        std::memory_order_acq_rel)) {
+        return waiting;
+      }
+    }
+  }
+#endif
+
   void Park(Waiter *w) {
+#if defined(ASYNC_FUTEX_PARKING)
+    for (;;) {
+      const uint32_t word = PrepareFutexWait(w);
+      if ((word & Waiter::kStateMask) == Waiter::kSignaled) return;
+      w->parked = true;
+      FutexWait(&w->word, word);
+    }
+#else
     std::unique_lock<std::mutex> lock(w->mu);
     while (w->state != Waiter::kSignaled) {
       w->state = Waiter::kWaiting;
+      w->parked = true;
       w->cv.wait(lock);
     }
+#endif
+  }
+
+  bool ParkUntil(Waiter *w, std::chrono::steady_clock::time_point deadline) {
+#if defined(ASYNC_FUTEX_PARKING)
+    for (;;) {
+      const uint32_t word = PrepareFutexWait(w);
+      if ((word & Waiter::kStateMask) == Waiter::kSignaled) return true;
+      if (word & Waiter::kInterrupted) {
+        w->word.fetch_and(~Waiter::kInterrupted, std::memory_order_relaxed);
+        w->parked = false;
+        return false;
+      }
+      w->parked = true;
+      if (!FutexWait(&w->word, word, deadline)) {
+        const bool signaled = (w->word.load(std::memory_order_acquire) &
+                               Waiter::kStateMask) == Waiter::kSignaled;
+        w->parked = signaled;
+        return signaled;
+      }
+    }
+#else
+    std::unique_lock<std::mutex> lock(w->mu);
+    while (w->state != Waiter::kSignaled) {
+      if (w->interrupted) {
+        w->interrupted = false;
+        w->parked = false;
+        return false;
+      }
+      w->state = Waiter::kWaiting;
+      w->parked = true;
+      if (deadline == std::chrono::steady_clock::time_point::max()) {
+        w->cv.wait(lock);
+      } else if (w->cv.wait_until(lock, deadline) ==
+                 std::cv_status::timeout) {
+        w->parked = w->state == Waiter::kSignaled;
+        return w->parked;
+      }
+    }
+    return true;
+#endif
   }
 
-  void Unpark(Waiter *w) {
+  // Signals the waiters of the list starting at `w`, returns the number of
+  // waiters that were not abandoned.
+  unsigned Unpark(Waiter *w) {
+    unsigned num_woken = 0;
     for (Waiter *next; w; w = next) {
       uint64_t wnext = w->next.load(std::memory_order_relaxed) & kStackMask;
       next = wnext == kStackMask ? nullptr : &mWaiters[wnext];
+#if defined(ASYNC_FUTEX_PARKING)
+      uint32_t word = w->word.load(std::memory_order_relaxed);
+      for (;;) {
+        // The waiter reads `unparkTime` only after it observes kSignaled.
+        if ((word & Waiter::kStateMask) == Waiter::kWaiting) {
+          w->unparkTime = std::chrono::steady_clock::now();
+        }
+        const uint32_t signaled =
+            (word & ~Waiter::kStateMask) | Waiter::kSignaled;
+        if (w->word.compare_exchange_weak(word, signaled,
+                                          std::memory_order_acq_rel)) {
+          break;
+        }
+      }
+      // Avoid the syscall if it wasn't waiting.
+      if ((word & Waiter::kStateMask) == Waiter::kWaiting) {
+        FutexWake(&w->word, 1);
+      }
+      if ((word & Waiter::kStateMask) != Waiter::kAbandoned) ++num_woken;
+#else
       unsigned state;
       {
         std::lock_guard<std::mutex> lock(w->mu);
         state = w->state;
         w->state = Waiter::kSignaled;
+        if (state == Waiter::kWaiting) {
+          w->unparkTime = std::chrono::steady_clock::now();
+        }
       }
       // Avoid notifying if it wasn't waiting.
       if (state == Waiter::kWaiting) w->cv.notify_one();
+      if (state != Waiter::kAbandoned) ++num_woken;
+#endif
+    }
+    return num_woken;
+  }
+
+  // Makes an abandoned waiter, still in the stack, a live waiter again.
+  // Returns false if it is not abandoned, or was popped from the stack.
+  static bool TakeOver(Waiter *w) {
+    w->parked = false;
+#if defined(ASYNC_FUTEX_PARKING)
+    uint32_t word = w->word.load(std::memory_order_acquire);
+    while ((word & Waiter::kStateMask) == Waiter::kAbandoned) {
+      const uint32_t live = (word & ~Waiter::kStateMask) | Waiter::kNotSignaled;
+      if (w->word.compare_exchange_weak(word, live,
+                                        std::memory_order_acq_rel)) {
+        return true;
+      }
+    }
+    return false;
+#else
+    std::lock_guard<std::mutex> lock(w->mu);
+    if (w->state != Waiter::kAbandoned) return false;
+    w->state = Waiter::kNotSignaled;
+    return true;
+#endif
+  }
+
+  // Undoes the Prewait of a thread that took over its waiter in the stack.
+  // Returns true if the thread consumed a signal meant for a pre-wait thread,
+  // then it must not park, and its waiter is abandoned again.
+  bool CancelTakenOverWait(Waiter *w) {
+    uint64_t state = mState.load(std::memory_order_relaxed);
+    for (;;) {
+      CheckState(state, true);
+      const bool consume = ((state & kWaiterMask) >> kWaiterShift) ==
+                           ((state & kSignalMask) >> kSignalShift);
+      uint64_t newstate = state - kWaiterInc;
+      if (consume) newstate -= kSignalInc;
+      CheckState(newstate);
+      if (mState.compare_exchange_weak(state, newstate,
+                                       std::memory_order_acq_rel)) {
+        if (!consume) return false;
+        // A signal of a Notify that popped the waiter in the meantime is not
+        // needed any more, pass it on.
+        if (Abandon(w)) Notify(/*notify_all=*/false);
+        return true;
+      }
+    }
+  }
+
+  // Returns true if the stack holds only abandoned waiters, and no thread is
+  // in pre-wait.
+  bool OnlyAbandonedWaiters() const {
+    const uint64_t state = mState.load();
+    if ((state & (kWaiterMask | kSignalMask)) != 0) return false;
+    for (uint64_t top = state & kStackMask; top != kStackMask;) {
+      const Waiter &w = mWaiters[top];
+#if defined(ASYNC_FUTEX_PARKING)
+      const uint32_t waiter_state = w.word.load() & Waiter::kStateMask;
+#else
+      const unsigned waiter_state = w.state;
+#endif
+      if (waiter_state != Waiter::kAbandoned) return false;
+      top = w.next.load() & kStackMask;
     }
+    return true;
   }
 
   static void CheckState(uint64_t state, bool waiter = false) {
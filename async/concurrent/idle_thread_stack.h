@@ -0,0 +1,272 @@
+#ifndef ASYNC_CONCURRENT_IDLE_THREAD_STACK_
+#define ASYNC_CONCURRENT_IDLE_THREAD_STACK_
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "async/support/futex.h"
+#include "async/support/task_function.h"
+
+#if !defined(ASYNC_FUTEX_PARKING)
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace sss {
+namespace async {
+namespace internal {
+
+// IdleThreadStack passes tasks from submitters to idle threads without a shared
+// lock. Every thread owns a parking slot. An idle thread pushes its slot onto a
+// lock-free stack and parks on it, a submitter pops a slot, claims it, stores
+// the task into it and wakes up the owner. The most recently parked thread gets
+// the next task, so the threads that stay idle for long can time out.
+//
+// A thread that times out can't remove its slot from the stack. The slot stays
+// there, and the submitter that pops it later fails to claim it and moves on to
+// the next one. Slots are never deallocated before the stack, so a stale entry
+// always points to valid memory, and a slot is never on the stack twice.
+class IdleThreadStack {
+ public:
+  class Slot {
+   public:
+    Slot() = default;
+    Slot(const Slot &) = delete;
+    void operator=(const Slot &) = delete;
+
+   private:
+    friend class IdleThreadStack;
+
+    enum : uint32_t {
+      kBusy,      // owner is running a task
+      kIdle,      // owner is waiting, the slot can be claimed
+      kClaimed,   // a submitter is storing the task
+      kAssigned,  // `task` is ready for the owner
+      kStopped,   // owner must stop waiting
+      kExited,    // owner timed out
+    };
+
+    // Align to 128 byte boundary to prevent false sharing with other slots.
+    alignas(128) std::atomic<uint32_t> state{kBusy};
+    // True from the owner decision to push the slot until a submitter pops it.
+    std::atomic<bool> inStack{false};
+    // Index of the next slot on the stack.
+    std::atomic<uint32_t> next{kEmpty};
+    uint32_t index = 0;
+    TaskFunction task;
+#if !defined(ASYNC_FUTEX_PARKING)
+    std::mutex mu;
+    std::condition_variable cv;
+#endif
+  };
+
+  IdleThreadStack() : mHead(kEmpty), mNumIdle(0), mStopped(false) {
+    for (std::atomic<Slot *> &chunk : mChunks) chunk.store(nullptr);
+  }
+  ~IdleThreadStack() {
+    for (std::atomic<Slot *> &chunk : mChunks) delete[] chunk.load();
+  }
+  IdleThreadStack(const IdleThreadStack &) = delete;
+  void operator=(const IdleThreadStack &) = delete;
+
+  // NewSlot() returns a slot for a new thread, or nullptr if all the slots are
+  // taken. FreeSlot() returns the slot of an exited thread. Calls to NewSlot()
+  // and FreeSlot() must be serialized by the caller.
+  Slot *NewSlot() {
+    if (!mFreeSlots.empty()) {
+      Slot *slot = mFreeSlots.back();
+      mFreeSlots.pop_back();
+      return slot;
+    }
+    if (mNumSlots == kMaxSlots) return nullptr;
+    const uint32_t index = mNumSlots++;
+    const unsigned chunk = ChunkIndex(index);
+    if (mChunks[chunk].load(std::memory_order_relaxed) == nullptr) {
+      mChunks[chunk].store(new Slot[kFirstChunkSize << chunk],
+                           std::memory_order_release);
+    }
+    Slot *slot = SlotAt(index);
+    slot->index = index;
+    return slot;
+  }
+  void FreeSlot(Slot *slot) { mFreeSlots.push_back(slot); }
+
+  // Wait() publishes `slot` as idle and parks the calling thread until it gets
+  // a task, until `deadline`, or until Stop(). Returns empty optional in the
+  // two last cases. Must be called only by the slot owner.
+  std::optional<TaskFunction> Wait(
+      Slot *slot, std::chrono::steady_clock::time_point deadline) {
+    slot->state.store(Slot::kIdle);
+    // The slot might still be on the stack from an earlier Wait(), if the
+    // submitter that popped it has not cleared `inStack` yet, it will see the
+    // kIdle state and claim it.
+    if (!slot->inStack.exchange(true)) Push(slot);
+    mNumIdle.fetch_add(1, std::memory_order_relaxed);
+
+    // Stop() drains the stack after setting `mStopped`. If the flag is not
+    // set yet, the slot will be drained.
+    if (mStopped.load()) Leave(slot, Slot::kStopped);
+
+    std::optional<TaskFunction> task;
+    for (;;) {
+      uint32_t state = slot->state.load(std::memory_order_acquire);
+      if (state == Slot::kAssigned) {
+        task = std::move(slot->task);
+        slot->state.store(Slot::kBusy, std::memory_order_relaxed);
+        break;
+      }
+      if (state == Slot::kStopped || state == Slot::kExited) break;
+      if (state == Slot::kIdle &&
+          std::chrono::steady_clock::now() >= deadline) {
+        Leave(slot, Slot::kExited);
+        continue;
+      }
+      // A claimed slot gets its task right away.
+      Park(slot, state,
+           state == Slot::kIdle ? deadline
+                                : std::chrono::steady_clock::time_point::max());
+    }
+    mNumIdle.fetch_sub(1, std::memory_order_relaxed);
+    return task;
+  }
+
+  // Hands `task` over to an idle thread. Returns the task back if there is no
+  // idle thread. `wrap` is applied to the task only if it is accepted.
+  template <typename Wrap>
+  std::optional<TaskFunction> Handoff(TaskFunction task, Wrap wrap) {
+    while (Slot *slot = Pop()) {
+      uint32_t idle = Slot::kIdle;
+      if (!slot->state.compare_exchange_strong(idle, Slot::kClaimed)) {
+        continue;  // stale entry, the owner is busy or exited
+      }
+      slot->task = wrap(std::move(task));
+      Signal(slot, Slot::kAssigned);
+      return std::nullopt;
+    }
+    return std::optional<TaskFunction>(std::move(task));
+  }
+
+  // Stop() wakes up all the idle threads, and makes the following Wait() calls
+  // return immediately, until Resume().
+  void Stop() {
+    mStopped.store(true);
+    while (Slot *slot = Pop()) {
+      uint32_t idle = Slot::kIdle;
+      if (slot->state.compare_exchange_strong(idle, Slot::kStopped)) {
+        Signal(slot, Slot::kStopped);
+      }
+    }
+  }
+  void Resume() { mStopped.store(false); }
+
+  // Returns the number of threads in Wait().
+  size_t NumIdle() const { return mNumIdle.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr uint32_t kEmpty = ~uint32_t{0};
+  static constexpr uint64_t kIndexMask = kEmpty;
+  static constexpr uint64_t kTagInc = uint64_t{1} << 32;
+
+  // Slots are allocated in chunks of doubling size, the chunk `i` holds
+  // `kFirstChunkSize << i` slots, and slots never move.
+  static constexpr unsigned kFirstChunkLog2 = 4;
+  static constexpr uint32_t kFirstChunkSize = 1u << kFirstChunkLog2;
+  static constexpr unsigned kNumChunks = 27;
+  static constexpr uint32_t kMaxSlots =
+      kFirstChunkSize * ((1u << kNumChunks) - 1);
+
+  static unsigned ChunkIndex(uint32_t index) {
+    const uint64_t i = uint64_t{index} + kFirstChunkSize;
+    return 63 - __builtin_clzll(i) - kFirstChunkLog2;
+  }
+
+  Slot *SlotAt(uint32_t index) const {
+    const unsigned chunk = ChunkIndex(index);
+    Slot *slots = mChunks[chunk].load(std::memory_order_acquire);
+    return &slots[index + kFirstChunkSize - (kFirstChunkSize << chunk)];
+  }
+
+  // The stack head keeps the top slot index in the low 32 bits, and an ABA tag
+  // incremented by every push and pop in the high bits.
+  void Push(Slot *slot) {
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    for (;;) {
+      slot->next.store(static_cast<uint32_t>(head & kIndexMask),
+                       std::memory_order_relaxed);
+      const uint64_t next = ((head & ~kIndexMask) + kTagInc) | slot->index;
+      if (mHead.compare_exchange_weak(head, next)) return;
+    }
+  }
+
+  // Pops a slot and clears its `inStack` flag. The caller must claim the slot
+  // state after that.
+  Slot *Pop() {
+    uint64_t head = mHead.load(std::memory_order_acquire);
+    for (;;) {
+      const uint32_t index = static_cast<uint32_t>(head & kIndexMask);
+      if (index == kEmpty) return nullptr;
+      Slot *slot = SlotAt(index);
+      const uint64_t next = ((head & ~kIndexMask) + kTagInc) |
+                            slot->next.load(std::memory_order_relaxed);
+      if (mHead.compare_exchange_weak(head, next)) {
+        slot->inStack.store(false);
+        return slot;
+      }
+    }
+  }
+
+  // Moves an idle slot to `state` on behalf of its owner. Fails if the slot was
+  // claimed, the owner then waits for the task.
+  static void Leave(Slot *slot, uint32_t state) {
+    uint32_t idle = Slot::kIdle;
+    slot->state.compare_exchange_strong(idle, state);
+  }
+
+  static void Park(Slot *slot, uint32_t state,
+                   std::chrono::steady_clock::time_point deadline) {
+#if defined(ASYNC_FUTEX_PARKING)
+    FutexWait(&slot->state, state, deadline);
+#else
+    std::unique_lock<std::mutex> lock(slot->mu);
+    if (slot->state.load(std::memory_order_relaxed) != state) return;
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      slot->cv.wait(lock);
+    } else {
+      slot->cv.wait_until(lock, deadline);
+    }
+#endif
+  }
+
+  static void Signal(Slot *slot, uint32_t state) {
+#if defined(ASYNC_FUTEX_PARKING)
+    slot->state.store(state, std::memory_order_release);
+    FutexWake(&slot->state, 1);
+#else
+    {
+      std::lock_guard<std::mutex> lock(slot->mu);
+      slot->state.store(state, std::memory_order_release);
+    }
+    slot->cv.notify_one();
+#endif
+  }
+
+  std::atomic<uint64_t> mHead;
+  std::atomic<size_t> mNumIdle;
+  std::atomic<bool> mStopped;
+  std::array<std::atomic<Slot *>, kNumChunks> mChunks;
+
+  // Guarded by the caller of NewSlot() and FreeSlot().
+  uint32_t mNumSlots = 0;
+  std::vector<Slot *> mFreeSlots;
+};
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_IDLE_THREAD_STACK_ */
@@ -1,8 +1,12 @@
 #ifndef INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONCURRENT_NON_BLOCKING_WORK_QUEUE_
 #define INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONCURRENT_NON_BLOCKING_WORK_QUEUE_
 
+#include <algorithm>
+
+#include "absl/types/span.h"
 #include "async/concurrent/task_deque.h"
 #include "async/concurrent/work_queue_base.h"
+#include "async/concurrent/worker_affinity.h"
 #include "async/support/task_function.h"
 
 namespace sss {
@@ -30,27 +34,60 @@ class NonBlockingWorkQueue
   using ThreadData = typename Base::ThreadData;
 
  public:
-  explicit NonBlockingWorkQueue(QuiescingState *quiescingState, int numThreads);
+  // See WorkQueueBase for the `options`.
+  explicit NonBlockingWorkQueue(
+      QuiescingState *quiescingState, int numThreads,
+      const WorkQueueOptions &options = WorkQueueOptions());
   ~NonBlockingWorkQueue() = default;
 
   void AddTask(TaskFunction task);
 
+  // Adds `task` to the queue of the worker preferred by `affinity`. The task
+  // still can be stolen by other workers if they run out of work.
+  void AddTask(TaskFunction task, WorkerAffinity affinity);
+
+  // Adds all `tasks` to the queue. Tasks are split into contiguous chunks, and
+  // each chunk is pushed into a worker queue holding its lock only once. Parked
+  // threads are notified once per chunk after all the tasks are published,
+  // instead of once per task.
+  void AddTasks(absl::Span<TaskFunction> tasks);
+
+  // Returns the total number of tasks that did not fit into the per-thread
+  // queues and were spilled into the overflow queue.
+  uint64_t NumOverflowTasks() const;
+
+  // Fills in the non-blocking part of the work queue `stats`.
+  void GetStats(WorkQueueStats *stats) const;
+
+  using Base::NumActiveWorkers;
+  using Base::NumRequestedWorkers;
+  using Base::NumBlockedTasks;
+  using Base::NumStartedWorkers;
+  using Base::SetNumActiveWorkers;
   using Base::Steal;
 
  private:
   static constexpr char const *kThreadNamePrefix = "async-non-blocking-queue";
 
+  // Batches smaller than this are not split between multiple worker queues,
+  // waking up a thread for a couple of tiny tasks costs more than it saves.
+  static constexpr size_t kMinTasksPerChunk = 4;
+
   template <typename WorkQueue>
   friend class WorkQueueBase;
 
+  using Base::CallerCounters;
   using Base::GetPerThread;
   using Base::IsNotifyParkedThreadRequired;
   using Base::IsQuiescing;
+  using Base::Notify;
+  using Base::ProducerRing;
   using Base::WithPendingTaskCounter;
 
   using Base::mCoprimes;
   using Base::mEventCount;
   using Base::mNumThreads;
+  using Base::mOverflowQueue;
   using Base::mThreadData;
 
   std::optional<TaskFunction> NextTask(Queue *queue);
@@ -60,17 +97,18 @@ class NonBlockingWorkQueue
 
 template <typename ThreadingEnvironment>
 NonBlockingWorkQueue<ThreadingEnvironment>::NonBlockingWorkQueue(
-    QuiescingState *quiescingState, int numThreads)
+    QuiescingState *quiescingState, int numThreads,
+    const WorkQueueOptions &options)
     : WorkQueueBase<NonBlockingWorkQueue>(quiescingState, kThreadNamePrefix,
-                                          numThreads) {}
+                                          numThreads, options) {}
 
 template <typename ThreadingEnvironment>
 void NonBlockingWorkQueue<ThreadingEnvironment>::AddTask(TaskFunction task) {
   // Keep track of the number of pending tasks.
   if (IsQuiescing()) task = WithPendingTaskCounter(std::move(task));
 
-  // If the worker queue is full, we will execute `task` in the current thread.
-  std::optional<TaskFunction> inlineTask;
+  // If the worker queue is full, `task` is spilled into the overflow queue.
+  std::optional<TaskFunction> overflowTask;
 
   // If a caller thread is managed by `this` we push the new task into the front
   // of thread own queue (LIFO execution order). PushFront is completely lock
@@ -78,8 +116,10 @@ void NonBlockingWorkQueue<ThreadingEnvironment>::AddTask(TaskFunction task) {
   // practice tasks submitted together share some data).
   //
   // If a caller is a free-standing thread (or worker of another pool), we push
-  // the new task into a random queue (FIFO execution order). Tasks still could
-  // be executed in LIFO order, if they would be stolen by other workers.
+  // the new task into the caller own submission ring (FIFO execution order),
+  // it never takes a lock or contends with other producers. Workers pick the
+  // task up from the ring while stealing. If the ring is full, or the queue ran
+  // out of rings, the task goes to a random worker queue.
 
   // We opportunistically skip notifying parked thread if we push a task to the
   // front of an empty queue. It is very common pattern when a task running in a
@@ -94,13 +134,30 @@ void NonBlockingWorkQueue<ThreadingEnvironment>::AddTask(TaskFunction task) {
     // Worker thread of this pool, push onto the thread's queue.
     Queue &q = mThreadData[pt->thread_id].queue;
     skipNotify = q.Empty();
-    inlineTask = q.PushFront(std::move(task));
+    overflowTask = q.PushFront(std::move(task));
   } else {
     // A free-standing thread (or worker of another pool).
-    unsigned rnd = FastReduce(pt->rng(), mNumThreads);
-    Queue &q = mThreadData[rnd].queue;
-    inlineTask = q.PushBack(std::move(task));
+    SubmissionRing *ring = ProducerRing(pt);
+    std::optional<TaskFunction> rejected =
+        ring != nullptr ? ring->Push(std::move(task))
+                        : std::optional<TaskFunction>(std::move(task));
+    if (rejected.has_value()) {
+      unsigned rnd = FastReduce(pt->rng(), NumActiveWorkers());
+      Queue &q = mThreadData[rnd].queue;
+      overflowTask = q.PushBack(std::move(*rejected));
+    }
   }
+
+  // Push failed, the worker queue is full. We do not execute the task in the
+  // caller thread, because under bursty fan-out it turns producers into
+  // consumers, and might lead to a deep recursion. Instead the task goes to
+  // the unbounded overflow queue, and will be picked up by the first worker
+  // that runs out of work in its own queue.
+  if (overflowTask.has_value()) {
+    mOverflowQueue.Push(std::move(*overflowTask));
+    skipNotify = false;
+  }
+
   // Note: below we touch `*this` after making `task` available to worker
   // threads. Strictly speaking, this can lead to a racy-use-after-free.
   // Consider that Schedule is called from a thread that is neither main thread
@@ -109,12 +166,118 @@ void NonBlockingWorkQueue<ThreadingEnvironment>::AddTask(TaskFunction task) {
   // destruction of this. We expect that such a scenario is prevented by the
   // program, that is, this is kept alive while any threads can potentially be
   // in Schedule.
-  if (!inlineTask.has_value()) {
-    if (!skipNotify && IsNotifyParkedThreadRequired())
-      mEventCount.Notify(/*notify_all=*/false);
+  if (!skipNotify && IsNotifyParkedThreadRequired()) {
+    CallerCounters(pt).Add(WorkerCounter::kUnparks);
+    Notify();
+  }
+}
+
+template <typename ThreadingEnvironment>
+void NonBlockingWorkQueue<ThreadingEnvironment>::AddTask(
+    TaskFunction task, WorkerAffinity affinity) {
+  if (IsQuiescing()) task = WithPendingTaskCounter(std::move(task));
+
+  // Compensating workers come and go, they don't change the mapping.
+  const unsigned worker = affinity.WorkerIndex(NumRequestedWorkers());
+  Queue &q = mThreadData[worker].queue;
+
+  std::optional<TaskFunction> overflowTask;
+  bool skipNotify = false;
+
+  PerThread *pt = GetPerThread();
+  if (pt->parent == this && static_cast<unsigned>(pt->thread_id) == worker) {
+    // The caller is the preferred worker itself, same as in `AddTask`.
+    skipNotify = q.Empty();
+    overflowTask = q.PushFront(std::move(task));
   } else {
-    (*inlineTask)();  // Push failed, execute directly.
+    // Only the owner can push to the front of the queue, the task runs on the
+    // preferred worker after the tasks already queued there.
+    overflowTask = q.PushBack(std::move(task));
+  }
+
+  if (overflowTask.has_value()) {
+    mOverflowQueue.Push(std::move(*overflowTask));
+    skipNotify = false;
   }
+
+  // The preferred worker might be parked, and there is no way to wake up a
+  // particular thread, so a parked worker is notified as usual. It steals the
+  // task only if the preferred worker does not pick it up first.
+  if (!skipNotify && IsNotifyParkedThreadRequired()) {
+    CallerCounters(pt).Add(WorkerCounter::kUnparks);
+    Notify();
+  }
+}
+
+template <typename ThreadingEnvironment>
+void NonBlockingWorkQueue<ThreadingEnvironment>::AddTasks(
+    absl::Span<TaskFunction> tasks) {
+  if (tasks.empty()) return;
+  if (tasks.size() == 1) {
+    AddTask(std::move(tasks[0]));
+    return;
+  }
+
+  if (IsQuiescing()) {
+    for (TaskFunction &task : tasks) {
+      task = WithPendingTaskCounter(std::move(task));
+    }
+  }
+
+  const unsigned numActive = NumActiveWorkers();
+  const size_t numChunks = std::min<size_t>(
+      numActive,
+      (tasks.size() + kMinTasksPerChunk - 1) / kMinTasksPerChunk);
+  const size_t chunkSize = (tasks.size() + numChunks - 1) / numChunks;
+
+  // Tasks are distributed starting from the caller own queue if it is a worker
+  // thread of this pool, otherwise from a random queue. Queues are visited in
+  // the same order as in `Steal`, so the chunks land in distinct queues.
+  PerThread *pt = GetPerThread();
+  const unsigned r = pt->rng();
+  unsigned victim = pt->parent == this ? pt->thread_id
+                                       : FastReduce(r, numActive);
+  const unsigned inc = mCoprimes[FastReduce(r, mCoprimes.size())];
+
+  size_t numNotify = 0;
+  for (size_t begin = 0; begin < tasks.size(); begin += chunkSize) {
+    absl::Span<TaskFunction> chunk = tasks.subspan(begin, chunkSize);
+    Queue &q = mThreadData[victim].queue;
+    // Tasks that did not fit into the worker queue are spilled into the
+    // overflow queue, exactly like in `AddTask`.
+    for (size_t i = q.PushBack(chunk); i < chunk.size(); ++i) {
+      mOverflowQueue.Push(std::move(chunk[i]));
+    }
+    ++numNotify;
+    // Skip retired workers, the coprime stride visits every queue once.
+    do {
+      victim += inc;
+      if (victim >= mNumThreads) victim -= mNumThreads;
+    } while (victim >= numActive);
+  }
+
+  // The caller keeps running its own chunk (if it is a worker thread), all
+  // other chunks need a thread to pick them up. Spinning threads are accounted
+  // in `IsNotifyParkedThreadRequired` the same way as for individual tasks.
+  if (pt->parent == this) --numNotify;
+  for (size_t i = 0; i < std::max<size_t>(numNotify, 1); ++i) {
+    if (IsNotifyParkedThreadRequired()) {
+      CallerCounters(pt).Add(WorkerCounter::kUnparks);
+      Notify();
+    }
+  }
+}
+
+template <typename ThreadingEnvironment>
+uint64_t NonBlockingWorkQueue<ThreadingEnvironment>::NumOverflowTasks() const {
+  return mOverflowQueue.NumPushed();
+}
+
+template <typename ThreadingEnvironment>
+void NonBlockingWorkQueue<ThreadingEnvironment>::GetStats(
+    WorkQueueStats *stats) const {
+  Base::GetWorkerStats(&stats->nonBlocking);
+  stats->numOverflowTasks = NumOverflowTasks();
 }
 
 template <typename ThreadingEnvironment>
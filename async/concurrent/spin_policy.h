@@ -0,0 +1,127 @@
+#ifndef ASYNC_CONCURRENT_SPIN_POLICY_
+#define ASYNC_CONCURRENT_SPIN_POLICY_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace sss {
+namespace async {
+
+// SpinPolicy defines what a worker thread does when it runs out of work, before
+// parking on the event count.
+enum class SpinPolicy {
+  // Spin in the steal loop for a fixed number of iterations (`fixedSpinCount`
+  // divided by the number of threads). The default.
+  kFixed,
+  // Spin for a duration tuned per worker thread from the recently observed
+  // gaps between running out of work and getting the next task, and the
+  // latency of waking up a parked thread. Workers of a sparsely loaded queue
+  // park almost immediately, workers of a busy queue spin long enough to pick
+  // up the next task without paying for a wake up.
+  kAdaptive,
+  // Never spin, park as soon as there is no work. Saves CPU at the cost of a
+  // wake up latency for every task submitted to an idle queue.
+  kPowerSaving,
+};
+
+struct SpinOptions {
+  SpinPolicy policy = SpinPolicy::kFixed;
+
+  // The number of steal loop spin iterations before parking for the
+  // `kFixed` policy (this number is divided by the number of threads, to get
+  // spin count for each thread).
+  int fixedSpinCount = 5000;
+
+  // Upper bound on the spin duration for the `kAdaptive` policy.
+  std::chrono::nanoseconds maxSpinTime = std::chrono::microseconds(200);
+
+  // Maximum number of threads spinning in the steal loop at the same time.
+  int maxSpinningThreads = 1;
+
+  // If there are enough active threads with an empty pending task queues, there
+  // is no need for spinning before parking a thread that is out of work to do,
+  // because these active threads will go into a steal loop after finishing with
+  // their current tasks.
+  //
+  // In the worst case when all active threads are executing long/expensive
+  // tasks, the next AddTask() will have to wait until one of the parked threads
+  // will be unparked, however this should be very rare in practice.
+  int minActiveThreadsToStartSpinning = 4;
+};
+
+namespace internal {
+
+// AdaptiveSpinner computes the spin duration of a single worker thread for the
+// `SpinPolicy::kAdaptive`. It keeps exponentially weighted moving averages of:
+//
+//   - idle time: time between running out of work and getting the next task,
+//   - wake up latency: time between signaling a parked thread and the moment
+//     it actually resumes execution.
+//
+// Spinning pays off only if the next task usually arrives before parking and
+// waking up again would complete, so the worker spins for about twice the
+// average idle time if it is comparable to the wake up latency, and does not
+// spin at all otherwise.
+//
+// Not thread safe, owned by the worker thread.
+class AdaptiveSpinner {
+ public:
+  explicit AdaptiveSpinner(std::chrono::nanoseconds maxSpinTime)
+      : mMaxSpinNs(maxSpinTime.count()),
+        mIdleNs(kInitialIdleNs),
+        mWakeupNs(kInitialWakeupNs) {
+    Recompute();
+  }
+
+  // Returns how long the worker should spin before parking.
+  std::chrono::nanoseconds SpinTime() const {
+    return std::chrono::nanoseconds(mSpinNs);
+  }
+
+  // The worker got a new task after being idle for `idle`.
+  void OnIdle(std::chrono::nanoseconds idle) {
+    Update(&mIdleNs, std::min<int64_t>(idle.count(), kMaxIdleSampleNs));
+  }
+
+  // The worker was parked, and it took `latency` to wake it up.
+  void OnWakeup(std::chrono::nanoseconds latency) {
+    Update(&mWakeupNs, std::min<int64_t>(latency.count(), kMaxIdleSampleNs));
+  }
+
+ private:
+  // Moving averages are updated as `avg += (sample - avg) / 2^kEwmaShift`.
+  static constexpr int kEwmaShift = 3;
+  // Do not spin if the average idle time is larger than this many wake up
+  // latencies, parking is cheaper.
+  static constexpr int64_t kMaxIdleToWakeupRatio = 4;
+  static constexpr int64_t kInitialIdleNs = 10 * 1000;
+  static constexpr int64_t kInitialWakeupNs = 50 * 1000;
+  // Long idle periods are clamped, so that a single one does not turn off
+  // spinning for a long time.
+  static constexpr int64_t kMaxIdleSampleNs = 10 * 1000 * 1000;
+
+  void Update(int64_t *avg, int64_t sample) {
+    *avg += (sample - *avg) / (1 << kEwmaShift);
+    Recompute();
+  }
+
+  void Recompute() {
+    if (mIdleNs > kMaxIdleToWakeupRatio * mWakeupNs) {
+      mSpinNs = 0;
+    } else {
+      mSpinNs = std::min(2 * mIdleNs, mMaxSpinNs);
+    }
+  }
+
+  const int64_t mMaxSpinNs;
+  int64_t mIdleNs;
+  int64_t mWakeupNs;
+  int64_t mSpinNs;
+};
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_SPIN_POLICY_ */
@@ -0,0 +1,109 @@
+#ifndef ASYNC_CONCURRENT_SUBMISSION_RING_
+#define ASYNC_CONCURRENT_SUBMISSION_RING_
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <optional>
+
+#include "async/support/task_function.h"
+
+namespace sss {
+namespace async {
+namespace internal {
+
+// SubmissionRing is a fixed size lock-free FIFO queue owned by a single thread
+// that submits tasks to a work queue without being one of its workers (e.g.
+// an I/O completion thread). Only the owner pushes, so producers never contend
+// with each other, and the worker threads pop the tasks while stealing.
+//
+// It is a bounded MPMC queue with a sequence number per cell (Vyukov's bounded
+// queue) used with a single producer: Push() is wait-free, Pop() is lock-free
+// and only contends with other consumers.
+class SubmissionRing {
+ public:
+  static constexpr unsigned kCapacity = 256;
+
+  SubmissionRing() : mHead(0), mTail(0) {
+    for (unsigned i = 0; i < kCapacity; ++i) {
+      mCells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  SubmissionRing(const SubmissionRing &) = delete;
+  void operator=(const SubmissionRing &) = delete;
+
+  // Push() appends `task` to the ring. Must be called only by the owner
+  // thread. Returns the task back if the ring is full.
+  std::optional<TaskFunction> Push(TaskFunction task) {
+    const unsigned pos = mTail.load(std::memory_order_relaxed);
+    Cell &cell = mCells[pos & kMask];
+    // The cell is free if the consumer that took the task one lap ago is done
+    // with it.
+    if (cell.seq.load(std::memory_order_acquire) != pos) {
+      return std::optional<TaskFunction>(std::move(task));
+    }
+    cell.task = std::move(task);
+    cell.seq.store(pos + 1, std::memory_order_release);
+    mTail.store(pos + 1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+
+  // Pop() removes and returns the oldest task. Can be called by any thread.
+  // Returns empty optional if the ring is empty.
+  std::optional<TaskFunction> Pop() {
+    unsigned pos = mHead.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = mCells[pos & kMask];
+      const unsigned seq = cell.seq.load(std::memory_order_acquire);
+      const int diff = static_cast<int>(seq - (pos + 1));
+      if (diff < 0) return std::nullopt;
+      if (diff > 0) {
+        // Another consumer took this cell.
+        pos = mHead.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (mHead.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        TaskFunction task = std::move(cell.task);
+        cell.seq.store(pos + kCapacity, std::memory_order_release);
+        return std::optional<TaskFunction>(std::move(task));
+      }
+    }
+  }
+
+  // Empty() tests whether the ring is empty. Can be called by any thread at
+  // any time. A task whose Push() has completed is never missed, which is
+  // required for a correct worker threads blocking.
+  bool Empty() const {
+    const unsigned pos = mHead.load(std::memory_order_acquire);
+    return mCells[pos & kMask].seq.load(std::memory_order_acquire) != pos + 1;
+  }
+
+  // Delete all the tasks from the ring.
+  void Flush() {
+    while (Pop().has_value()) {
+    }
+  }
+
+ private:
+  static constexpr unsigned kMask = kCapacity - 1;
+  static_assert((kCapacity & kMask) == 0, "capacity must be a power of two");
+
+  struct Cell {
+    std::atomic<unsigned> seq;
+    TaskFunction task;
+  };
+
+  // Consumer side.
+  alignas(128) std::atomic<unsigned> mHead;
+  // Producer side.
+  alignas(128) std::atomic<unsigned> mTail;
+  std::array<Cell, kCapacity> mCells;
+};
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_SUBMISSION_RING_ */
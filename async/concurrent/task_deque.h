@@ -9,6 +9,7 @@
 #include <optional>
 #include <vector>
 
+#include "absl/types/span.h"
 #include "async/support/task_function.h"
 
 namespace sss {
@@ -89,6 +90,30 @@ class TaskDeque {
     return std::nullopt;
   }
 
+  // PushBack() inserts all `tasks` at the end of the queue holding the lock
+  // only once, the first task in the span ends up closest to the front.
+  //
+  // Returns the number of tasks moved into the queue, if the queue becomes
+  // full, the remaining tasks are left untouched in the `tasks` span.
+  unsigned PushBack(absl::Span<TaskFunction> tasks) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    unsigned back = mBack.load(std::memory_order_relaxed);
+    unsigned n = 0;
+    for (; n < tasks.size(); ++n) {
+      Elem *e = &mArray[(back - 1) & kMask];
+      uint8_t s = e->state.load(std::memory_order_relaxed);
+      if (s != kEmpty || !e->state.compare_exchange_strong(
+                             s, kBusy, std::memory_order_acquire)) {
+        break;
+      }
+      back = ((back - 1) & kMask2) | (back & ~kMask2);
+      mBack.store(back, std::memory_order_relaxed);
+      e->task = std::move(tasks[n]);
+      e->state.store(kReady, std::memory_order_release);
+    }
+    return n;
+  }
+
   // PopBack() removes and returns the last elements in the queue.
   //
   // If the queue is empty returns empty optional.
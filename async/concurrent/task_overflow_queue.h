@@ -0,0 +1,119 @@
+#ifndef ASYNC_CONCURRENT_TASK_OVERFLOW_QUEUE_
+#define ASYNC_CONCURRENT_TASK_OVERFLOW_QUEUE_
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "async/support/task_function.h"
+
+namespace sss {
+namespace async {
+namespace internal {
+
+// TaskOverflowQueue is an unbounded FIFO queue that keeps tasks that did not
+// fit into the fixed size per-worker queues. It is a linked list of nodes with
+// a stub node (Vyukov's intrusive MPSC queue): Push() is wait-free and can be
+// called concurrently from any number of threads, Pop() is serialized with a
+// try-lock, so a worker that fails to acquire it simply moves on to stealing
+// from other queues instead of blocking.
+//
+// This queue is expected to be empty most of the time, it only absorbs bursts
+// of tasks submitted faster than workers can drain their own queues.
+class TaskOverflowQueue {
+ public:
+  TaskOverflowQueue() : mHead(&mStub), mTail(&mStub), mSize(0), mNumPushed(0) {}
+  TaskOverflowQueue(const TaskOverflowQueue &) = delete;
+  void operator=(const TaskOverflowQueue &) = delete;
+
+  ~TaskOverflowQueue() {
+    assert(Empty());
+    // The last popped node becomes a new stub, and it is owned by the queue.
+    Node *head = mHead.load(std::memory_order_relaxed);
+    if (head != &mStub) delete head;
+  }
+
+  // Push() appends `task` to the end of the queue. Never fails.
+  void Push(TaskFunction task) {
+    Node *node = new Node(std::move(task));
+    mSize.fetch_add(1, std::memory_order_relaxed);
+    mNumPushed.fetch_add(1, std::memory_order_relaxed);
+    Node *prev = mTail.exchange(node, std::memory_order_acq_rel);
+    // Between the exchange above and the store below the queue looks non-empty
+    // to Empty(), but Pop() can't reach the new node yet.
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Pop() removes and returns the first task in the queue. Returns empty
+  // optional if the queue is empty, if another thread is popping from the
+  // queue, or if the next task is not yet completely pushed.
+  std::optional<TaskFunction> Pop() {
+    if (Empty()) return std::nullopt;
+
+    std::unique_lock<std::mutex> lock(mPopMutex, std::try_to_lock);
+    if (!lock.owns_lock()) return std::nullopt;
+
+    Node *head = mHead.load(std::memory_order_relaxed);
+    Node *next = head->next.load(std::memory_order_acquire);
+    if (next == nullptr) return std::nullopt;
+
+    // `next` becomes a new stub node, the task is moved out of it.
+    TaskFunction task = std::move(next->task);
+    mHead.store(next, std::memory_order_release);
+    mSize.fetch_sub(1, std::memory_order_relaxed);
+    if (head != &mStub) delete head;
+    return std::optional<TaskFunction>(std::move(task));
+  }
+
+  // Empty() tests whether the queue is empty. Can be called by any thread at
+  // any time. It never claims a non-empty queue as empty, which is required for
+  // a correct worker threads blocking.
+  bool Empty() const {
+    return mHead.load(std::memory_order_acquire) ==
+           mTail.load(std::memory_order_acquire);
+  }
+
+  // Size() returns an estimate of the number of tasks in the queue.
+  unsigned Size() const { return mSize.load(std::memory_order_relaxed); }
+
+  // Returns the total number of tasks ever pushed into the queue.
+  uint64_t NumPushed() const {
+    return mNumPushed.load(std::memory_order_relaxed);
+  }
+
+  // Delete all the elements from the queue.
+  void Flush() {
+    while (!Empty()) {
+      std::optional<TaskFunction> task = Pop();
+      (void)task;
+    }
+  }
+
+ private:
+  struct Node {
+    Node() : next(nullptr) {}
+    explicit Node(TaskFunction t) : next(nullptr), task(std::move(t)) {}
+    std::atomic<Node *> next;
+    TaskFunction task;
+  };
+
+  Node mStub;
+
+  // Consumer side, guarded by `mPopMutex`.
+  std::mutex mPopMutex;
+  alignas(128) std::atomic<Node *> mHead;
+
+  // Producer side, updated with an atomic exchange.
+  alignas(128) std::atomic<Node *> mTail;
+
+  std::atomic<unsigned> mSize;
+  std::atomic<uint64_t> mNumPushed;
+};
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_TASK_OVERFLOW_QUEUE_ */
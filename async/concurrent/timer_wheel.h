@@ -0,0 +1,356 @@
+#ifndef ASYNC_CONCURRENT_TIMER_WHEEL_
+#define ASYNC_CONCURRENT_TIMER_WHEEL_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "async/support/ref_count.h"
+#include "async/support/task_function.h"
+
+namespace sss {
+namespace async {
+namespace internal {
+
+class TimerWheel;
+
+// TimerEntry is a single task scheduled in the TimerWheel. It is shared between
+// the wheel (while the timer is pending) and the TimerHandle returned to the
+// caller, so that the handle can be safely cancelled after the timer fired.
+class TimerEntry : public ReferenceCounted<TimerEntry> {
+ public:
+  enum class State : uint8_t { kPending, kFired, kCancelled };
+
+  State state() const { return mState.load(std::memory_order_acquire); }
+  TimerWheel *wheel() const { return mWheel; }
+
+ private:
+  friend class TimerWheel;
+
+  TimerEntry(TimerWheel *wheel, uint64_t when, TaskFunction task)
+      : mWheel(wheel),
+        mWhen(when),
+        mState(State::kPending),
+        mTask(std::move(task)) {}
+
+  TimerWheel *const mWheel;
+
+  // Intrusive list of the entries in the same wheel slot.
+  TimerEntry *mPrev = nullptr;
+  TimerEntry *mNext = nullptr;
+  uint8_t mLevel = 0;
+  uint8_t mSlot = 0;
+
+  // Expiration time in wheel ticks.
+  const uint64_t mWhen;
+
+  // Updated only under the wheel mutex.
+  std::atomic<State> mState;
+  TaskFunction mTask;
+};
+
+// TimerWheel is a hierarchical timing wheel (Varghese & Lauck) with
+// `kNumLevels` levels of `kNumSlots` slots each. A slot at level `L` covers
+// `kNumSlots^L` ticks, so the whole wheel covers `kNumSlots^kNumLevels` ticks
+// (with the default 1ms resolution that is more than two years). Each level
+// keeps a bitmap of non-empty slots, which lets the wheel jump directly to the
+// next expiration instead of visiting every tick.
+//
+// Schedule() and Cancel() are O(1). Advance() moves expired tasks out of the
+// wheel and cascades timers from the higher levels into the lower ones, every
+// timer is cascaded at most `kNumLevels` times.
+//
+// All operations are serialized with a mutex. Advance() uses a try-lock, so
+// worker threads that poll the wheel never block on each other.
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr int kNumLevels = 6;
+  static constexpr int kSlotBits = 6;
+  static constexpr unsigned kNumSlots = 1u << kSlotBits;
+  static constexpr uint64_t kSlotMask = kNumSlots - 1;
+
+  // Timers further in the future are clamped to this many ticks, it is half of
+  // the wheel range, which guarantees that top level slots never alias.
+  static constexpr uint64_t kMaxDelayTicks = 1ull
+                                             << (kSlotBits * kNumLevels - 1);
+
+  explicit TimerWheel(Clock::duration resolution = std::chrono::milliseconds(1),
+                      Clock::time_point start = Clock::now())
+      : mResolution(resolution),
+        mStart(start),
+        mElapsed(0),
+        mSize(0),
+        mNextDeadline(kNoDeadline) {
+    assert(resolution.count() > 0);
+    for (auto &level : mSlots) level.fill(nullptr);
+    mOccupied.fill(0);
+  }
+
+  TimerWheel(const TimerWheel &) = delete;
+  void operator=(const TimerWheel &) = delete;
+
+  // Pending tasks are destroyed without execution.
+  ~TimerWheel() {
+    for (int level = 0; level < kNumLevels; ++level) {
+      for (TimerEntry *&head : mSlots[level]) {
+        while (TimerEntry *e = head) {
+          head = e->mNext;
+          e->mState.store(TimerEntry::State::kCancelled,
+                          std::memory_order_release);
+          e->mTask.reset();
+          e->DropRef();
+        }
+      }
+    }
+  }
+
+  // Schedules `task` to be returned from Advance() at or after `deadline`.
+  // Sets `*earliest` to true if the new timer became the first one to expire,
+  // callers use it to re-arm a thread that sleeps until the next deadline.
+  RCReference<TimerEntry> Schedule(Clock::time_point deadline,
+                                   TaskFunction task,
+                                   bool *earliest = nullptr) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint64_t when = std::min(DeadlineToTick(deadline),
+                             mElapsed + kMaxDelayTicks);
+    TimerEntry *entry = new TimerEntry(this, when, std::move(task));
+    entry->AddRef();  // reference owned by the wheel
+    Insert(entry);
+    mSize.fetch_add(1, std::memory_order_relaxed);
+
+    const uint64_t prevDeadline = mNextDeadline.load(std::memory_order_relaxed);
+    UpdateNextDeadline();
+    if (earliest != nullptr) {
+      *earliest = mNextDeadline.load(std::memory_order_relaxed) < prevDeadline;
+    }
+    return TakeRef(entry);
+  }
+
+  // Cancels a pending timer. Returns false if the timer already fired or was
+  // cancelled before.
+  bool Cancel(TimerEntry *entry) {
+    assert(entry->mWheel == this);
+    TaskFunction task;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (entry->state() != TimerEntry::State::kPending) return false;
+      Unlink(entry);
+      entry->mState.store(TimerEntry::State::kCancelled,
+                          std::memory_order_release);
+      task = std::move(entry->mTask);
+      mSize.fetch_sub(1, std::memory_order_relaxed);
+      UpdateNextDeadline();
+    }
+    // Caller holds a reference to the entry, this never destroys it.
+    entry->DropRef();
+    return true;
+  }
+
+  // Moves tasks of all the timers expired at `now` to `expired`. Returns the
+  // number of expired tasks. If another thread is advancing the wheel
+  // concurrently returns zero immediately.
+  size_t Advance(Clock::time_point now, std::vector<TaskFunction> *expired) {
+    std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+    if (!lock.owns_lock()) return 0;
+
+    const uint64_t nowTick = NowToTick(now);
+    size_t numExpired = 0;
+
+    Expiration exp{};
+    while (NextExpiration(&exp) && exp.deadline <= nowTick) {
+      mElapsed = exp.deadline;
+      TimerEntry *list = mSlots[exp.level][exp.slot];
+      mSlots[exp.level][exp.slot] = nullptr;
+      mOccupied[exp.level] &= ~(1ull << exp.slot);
+
+      while (TimerEntry *e = list) {
+        list = e->mNext;
+        e->mPrev = e->mNext = nullptr;
+        if (e->mWhen <= mElapsed) {
+          e->mState.store(TimerEntry::State::kFired, std::memory_order_release);
+          expired->push_back(std::move(e->mTask));
+          mSize.fetch_sub(1, std::memory_order_relaxed);
+          ++numExpired;
+          e->DropRef();
+        } else {
+          // Cascade into a lower level slot.
+          Insert(e);
+        }
+      }
+    }
+    if (nowTick > mElapsed) mElapsed = nowTick;
+
+    UpdateNextDeadline();
+    return numExpired;
+  }
+
+  // Returns true if there are no pending timers. Can be called by any thread
+  // without taking a lock.
+  bool Empty() const { return mSize.load(std::memory_order_acquire) == 0; }
+
+  size_t Size() const { return mSize.load(std::memory_order_relaxed); }
+
+  // Returns the time when the first pending timer expires (it might be slightly
+  // earlier than the actual deadline), or `Clock::time_point::max()` if there
+  // are no pending timers. Lock-free.
+  Clock::time_point NextDeadline() const {
+    uint64_t tick = mNextDeadline.load(std::memory_order_acquire);
+    if (tick == kNoDeadline) return Clock::time_point::max();
+    return mStart + tick * mResolution;
+  }
+
+  // Returns true if some timers might be expired at `now`. Lock-free.
+  bool HasExpired(Clock::time_point now) const {
+    uint64_t tick = mNextDeadline.load(std::memory_order_acquire);
+    return tick != kNoDeadline && tick <= NowToTick(now);
+  }
+
+ private:
+  static constexpr uint64_t kNoDeadline = std::numeric_limits<uint64_t>::max();
+
+  struct Expiration {
+    int level;
+    unsigned slot;
+    uint64_t deadline;
+  };
+
+  // Deadlines are rounded up, so that the timers never fire early.
+  uint64_t DeadlineToTick(Clock::time_point deadline) const {
+    if (deadline <= mStart) return 0;
+    Clock::duration d = deadline - mStart;
+    uint64_t ticks = d / mResolution;
+    if (d % mResolution != Clock::duration::zero()) ++ticks;
+    return ticks;
+  }
+
+  uint64_t NowToTick(Clock::time_point now) const {
+    if (now <= mStart) return 0;
+    return (now - mStart) / mResolution;
+  }
+
+  // The level is defined by the most significant bit in which the expiration
+  // time differs from the current time.
+  static int LevelFor(uint64_t elapsed, uint64_t when) {
+    uint64_t masked = (elapsed ^ when) | kSlotMask;
+    int significant = 63 - __builtin_clzll(masked);
+    return std::min(significant / kSlotBits, kNumLevels - 1);
+  }
+
+  void Insert(TimerEntry *e) {
+    const uint64_t when = std::max(e->mWhen, mElapsed);
+    const int level = LevelFor(mElapsed, when);
+    const unsigned slot = (when >> (level * kSlotBits)) & kSlotMask;
+
+    e->mLevel = static_cast<uint8_t>(level);
+    e->mSlot = static_cast<uint8_t>(slot);
+    e->mPrev = nullptr;
+    e->mNext = mSlots[level][slot];
+    if (e->mNext) e->mNext->mPrev = e;
+    mSlots[level][slot] = e;
+    mOccupied[level] |= 1ull << slot;
+  }
+
+  void Unlink(TimerEntry *e) {
+    if (e->mPrev) {
+      e->mPrev->mNext = e->mNext;
+    } else {
+      mSlots[e->mLevel][e->mSlot] = e->mNext;
+    }
+    if (e->mNext) e->mNext->mPrev = e->mPrev;
+    if (mSlots[e->mLevel][e->mSlot] == nullptr) {
+      mOccupied[e->mLevel] &= ~(1ull << e->mSlot);
+    }
+    e->mPrev = e->mNext = nullptr;
+  }
+
+  // Finds the earliest non-empty slot over all levels.
+  bool NextExpiration(Expiration *exp) const {
+    bool found = false;
+    for (int level = 0; level < kNumLevels; ++level) {
+      const uint64_t occupied = mOccupied[level];
+      if (occupied == 0) continue;
+
+      const unsigned shift = level * kSlotBits;
+      const uint64_t slotRange = 1ull << shift;
+      const uint64_t levelRange = slotRange << kSlotBits;
+      const unsigned now = (mElapsed >> shift) & kSlotMask;
+
+      // Rotate the bitmap, so that the current slot is the lowest bit.
+      const uint64_t rotated =
+          now == 0 ? occupied : (occupied >> now) | (occupied << (64 - now));
+      const unsigned slot = (now + __builtin_ctzll(rotated)) & kSlotMask;
+
+      uint64_t deadline = (mElapsed & ~(levelRange - 1)) + slot * slotRange;
+      // Only the top level slots can wrap around, see `kMaxDelayTicks`.
+      if (slot < now) deadline += levelRange;
+
+      if (!found || deadline < exp->deadline) {
+        *exp = {level, slot, deadline};
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  void UpdateNextDeadline() {
+    Expiration exp{};
+    mNextDeadline.store(NextExpiration(&exp) ? exp.deadline : kNoDeadline,
+                        std::memory_order_seq_cst);
+  }
+
+  const Clock::duration mResolution;
+  const Clock::time_point mStart;
+
+  std::mutex mMutex;
+  uint64_t mElapsed;  // current time in ticks, guarded by `mMutex`
+  std::array<std::array<TimerEntry *, kNumSlots>, kNumLevels> mSlots;
+  std::array<uint64_t, kNumLevels> mOccupied;
+
+  std::atomic<size_t> mSize;
+  std::atomic<uint64_t> mNextDeadline;
+};
+
+}  // namespace internal
+
+// TimerHandle refers to a task scheduled with HostContext::EnqueueWorkAfter or
+// HostContext::EnqueueWorkAt. Destroying the handle does not cancel the timer.
+// The HostContext must outlive calls to Cancel().
+class TimerHandle {
+ public:
+  TimerHandle() = default;
+  explicit TimerHandle(RCReference<internal::TimerEntry> entry)
+      : mEntry(std::move(entry)) {}
+  TimerHandle(TimerHandle &&) = default;
+  TimerHandle &operator=(TimerHandle &&) = default;
+
+  // Cancels the timer. Returns true if the task was cancelled before it was
+  // submitted for execution, false if it already fired or was cancelled.
+  bool Cancel() {
+    if (!mEntry) return false;
+    return mEntry->wheel()->Cancel(mEntry.get());
+  }
+
+  // Returns true if the timer neither fired nor was cancelled yet.
+  bool IsPending() const {
+    return mEntry &&
+           mEntry->state() == internal::TimerEntry::State::kPending;
+  }
+
+  explicit operator bool() const { return static_cast<bool>(mEntry); }
+
+ private:
+  RCReference<internal::TimerEntry> mEntry;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_TIMER_WHEEL_ */
@@ -1,15 +1,27 @@
 #ifndef ASYNC_CONCURRENT_WORK_QUEUE_BASE_
 #define ASYNC_CONCURRENT_WORK_QUEUE_BASE_
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <vector>
 
+#include "async/concurrent/cpu_info.h"
 #include "async/concurrent/event_count.h"
+#include "async/concurrent/submission_ring.h"
+#include "async/concurrent/task_overflow_queue.h"
+#include "async/concurrent/timer_wheel.h"
+#include "async/concurrent/work_queue_options.h"
+#include "async/concurrent/work_queue_stats.h"
 #include "async/support/task_function.h"
+#include "async/support/task_trace_name.h"
 
 namespace sss {
 namespace async {
@@ -29,6 +41,12 @@ struct FastRng {
 inline uint32_t FastReduce(uint32_t x, uint32_t size) {
   return (static_cast<uint64_t>(x) * static_cast<uint64_t>(size)) >> 32u;
 }
+// Returns a process unique non-zero work queue id. Unlike the queue address it
+// is never reused, so it is safe to cache in thread local storage.
+inline uint64_t NextWorkQueueId() {
+  static std::atomic<uint64_t> id{0};
+  return id.fetch_add(1, std::memory_order_relaxed) + 1;
+}
 template <typename Derived>
 struct WorkQueueTraits;
 struct QuiescingState {
@@ -110,6 +128,10 @@ class WorkQueueBase {
     return mQuiescingState->mNumQuiescing.load(std::memory_order_relaxed) > 0;
   }
   void Quiesce();
+  // Runs one task in the caller thread: from the front of its own queue if it
+  // is a worker thread, otherwise a stolen one. Returns false if there was no
+  // task to run.
+  bool RunPendingTask();
   std::optional<TaskFunction> Steal();
   bool AllBlocked() const { return NumBlockedThreads() == mNumThreads; }
   void CheckCallerThread(const char *function_name) const;
@@ -119,6 +141,58 @@ class WorkQueueBase {
   }
   void Cancel();
 
+  // Reads worker threads counters and queue depths into `stats`.
+  void GetWorkerStats(WorkQueueStats::Queue *stats) const;
+
+  // Returns the number of tasks dropped without execution because their
+  // cancellation token was cancelled before they were dequeued.
+  uint64_t NumCancelledTasks() const {
+    return mNumCancelledTasks.load(std::memory_order_relaxed);
+  }
+
+  // Schedules `task` to be added to the queue at `deadline`. Expired timers are
+  // picked up by the worker threads when they run out of work, and every
+  // `kTimerPollInterval` executed tasks. One of the parked workers sleeps until
+  // the next deadline, so there is no dedicated timer thread. Timers pending at
+  // destruction are dropped without execution, Quiesce() does not wait for
+  // them.
+  TimerHandle AddTimer(std::chrono::steady_clock::time_point deadline,
+                       TaskFunction task);
+
+  // Returns the number of timers that neither fired nor were cancelled.
+  size_t NumPendingTimers() const { return mTimers.Size(); }
+
+  // Changes the number of worker threads executing tasks, `num_workers` is
+  // clamped to [1, number of threads the queue was created with]. Surplus
+  // workers finish the tasks in their own queues and park until the active set
+  // grows again. Threads are never destroyed or created, unless the queue is
+  // elastic, then surplus workers exit instead of parking. Returns the new
+  // number of requested workers.
+  unsigned SetNumActiveWorkers(unsigned num_workers);
+
+  // Workers [0, NumActiveWorkers()) execute tasks, the rest are retired. It
+  // includes the compensating workers activated by the blocking call monitor.
+  unsigned NumActiveWorkers() const {
+    return mNumActiveWorkers.load(std::memory_order_relaxed);
+  }
+
+  // Workers requested with SetNumActiveWorkers(), without the compensating
+  // ones. Worker affinities are mapped over this number.
+  unsigned NumRequestedWorkers() const {
+    return mNumRequestedWorkers.load(std::memory_order_relaxed);
+  }
+
+  // Returns the number of tasks detected by the blocking call monitor.
+  uint64_t NumBlockedTasks() const {
+    return mNumBlockedTasks.load(std::memory_order_relaxed);
+  }
+
+  // Returns the number of running worker threads. Without the elastic pool
+  // options all the threads are started in the constructor.
+  unsigned NumStartedWorkers() const {
+    return mNumStarted.load(std::memory_order_relaxed);
+  }
+
  private:
   template <typename ThreadingEnvironment>
   friend class BlockingWorkQueue;
@@ -127,46 +201,84 @@ class WorkQueueBase {
   friend class NonBlockingWorkQueue;
 
   struct PerThread {
-    constexpr PerThread() : parent(nullptr), rng(0), thread_id(-1) {}
+    constexpr PerThread()
+        : parent(nullptr), rng(0), thread_id(-1), ring_queue_id(0),
+          ring(nullptr) {}
     Derived *parent;
     FastRng rng;    // Random number generator
     int thread_id;  // Worker thread index in the workers queue
+    // Submission ring of a free-standing thread in the queue with the id
+    // `ring_queue_id` (the last queue it submitted tasks to).
+    uint64_t ring_queue_id;
+    SubmissionRing *ring;
   };
 
   struct ThreadData {
     ThreadData() : thread(), queue() {}
     std::unique_ptr<Thread> thread;
     Queue queue;
+    WorkerCounters counters;
+    // Scratch buffer for the expired timers, reused between polls.
+    std::vector<TaskFunction> expiredTimers;
+    // Incremented by the worker before and after every task if the blocking
+    // call monitor is enabled, odd while a task is running.
+    std::atomic<uint64_t> taskSeq{0};
+    // Trace name slot of the thread in this slot, read by the blocking call
+    // monitor. Owned by the queue, elastic workers may exit at any time.
+    TaskTraceName traceName;
+    // True while the thread runs the worker loop, guarded by `mStartMu`.
+    bool started = false;
+    // The worker exits if it stays parked until this deadline, set and read
+    // only by the worker thread.
+    std::chrono::steady_clock::time_point idleDeadline =
+        std::chrono::steady_clock::time_point::max();
+    bool idleExpired = false;
   };
 
   // Returns a TaskFunction with an attached pending tasks counter, if the
   // quiescing mode is on.
   TaskFunction WithPendingTaskCounter(TaskFunction task) {
+    RCReference<CancellationToken> token = task.ReleaseCancellationToken();
     return TaskFunction(
         [task = std::move(task), p = PendingTask(mQuiescingState)]() mutable {
           task();
-        });
+        },
+        std::move(token));
+  }
+
+  // Destroys `task` without executing it if it was cancelled, and returns true.
+  // Otherwise returns false, and the caller must execute the task.
+  bool DropIfCancelled(TaskFunction *task) {
+    if (!task->IsCancelled()) return false;
+    task->reset();
+    mNumCancelledTasks.fetch_add(1, std::memory_order_relaxed);
+    return true;
   }
 
-  // TODO(jhsun)改为运行时参数tune是否是更有效的？
-  static constexpr int kMaxSpinningThreads = 1;
+  // With the adaptive spin policy the clock is checked once per this many steal
+  // attempts in the spin loop.
+  static constexpr int kSpinClockCheckInterval = 16;
 
-  // The number of steal loop spin iterations before parking (this number is
-  // divided by the number of threads, to get spin count for each thread).
-  static constexpr int kSpinCount = 5000;
+  // A busy worker checks for expired timers once per this many tasks.
+  static constexpr int kTimerPollInterval = 32;
 
-  // If there are enough active threads with an empty pending task queues, there
-  // is no need for spinning before parking a thread that is out of work to do,
-  // because these active threads will go into a steal loop after finishing with
-  // their current tasks.
+  // If `options.pinWorkers` is true, worker threads are pinned to CPUs and
+  // steal from the workers sharing caches and the NUMA node first, see
+  // PlaceWorkers(). Without the CPU topology (or with a single CPU) it is a
+  // no-op.
   //
-  // In the worst case when all active threads are executing long/expensive
-  // tasks, the next AddTask() will have to wait until one of the parked threads
-  // will be unparked, however this should be very rare in practice.
-  static constexpr int kMinActiveThreadsToStartSpinning = 4;
-
+  // If `options.blockingCalls` are enabled, the queue starts the spare
+  // compensating workers retired, and a monitor thread that activates them
+  // while workers are stuck in blocking calls.
+  //
+  // With the `options.elastic` options, worker threads are started on demand,
+  // and exit when they stay idle or retire. Not started threads count as
+  // blocked for Quiesce() and the termination check.
+  //
+  // `options.maxNumThreads` is ignored, `num_threads` workers are started.
   explicit WorkQueueBase(QuiescingState *quiescing_state,
-                         std::string_view name_prefix, int num_threads);
+                         std::string_view name_prefix, int num_threads,
+                         const WorkQueueOptions &options = WorkQueueOptions());
   ~WorkQueueBase();
 
   // Main worker thread loop.
@@ -178,12 +290,75 @@ class WorkQueueBase {
   bool WaitForWork(EventCount::Waiter *waiter,
                    std::optional<TaskFunction> *task);
 
+  // CommitWait() parks the worker thread after a successful Prewait. If there
+  // are pending timers, and no other worker sleeps until the next deadline,
+  // the thread takes this role and wakes up to fire the timers while it is
+  // still parked.
+  void CommitWait(EventCount::Waiter *waiter, int thread_id);
+
+  // StealNearest() visits the worker queues in the steal order of the
+  // `thread_id` worker, tier by tier, starting from a random queue in each
+  // tier.
+  std::optional<TaskFunction> StealNearest(int thread_id, unsigned r,
+                                           WorkerCounters *counters);
+
+  // Retire() parks a surplus worker until it becomes active again (returns
+  // true), or until it is time to exit (returns false).
+  bool Retire(int thread_id);
+
+  // MaybeStartWorker() starts a worker thread if there is an active worker
+  // slot without a thread, and none of the started workers is idle. Must be
+  // called after making a task visible and notifying the event count (which
+  // issues a full fence), so that an idle worker that is about to exit either
+  // sees the task, or is not counted as idle anymore here.
+  void MaybeStartWorker();
+
+  // Starts a thread for the first of the [0, `num_active`) worker slots that
+  // has none. Requires `mStartMu`.
+  void StartWorkerLocked(unsigned num_active);
+
+  // ExitWorker() releases the thread of an idle worker (`retiring` is false)
+  // or of a surplus one, in elastic pools. Returns false if the worker must
+  // stay, e.g. there is work it would leave behind, or the queue is shutting
+  // down. If it returns true, the thread must leave the worker loop without
+  // touching the queue.
+  bool ExitWorker(int thread_id, bool retiring);
+
+  // Returns true if any queue or submission ring has a task.
+  bool HasVisibleWork() {
+    return NonEmptyQueueIndex() != -1 || !mOverflowQueue.Empty() ||
+           !SubmittedEmpty();
+  }
+
+  // Recomputes the number of active workers from the requested and
+  // compensating ones, and wakes up or retires workers. Requires `mRetiredMu`
+  // to be held by `lock`, releases it.
+  void UpdateActiveWorkers(std::unique_lock<std::mutex> lock);
+
+  // Blocking call monitor thread loop. Every half of the threshold it samples
+  // the workers task sequence numbers, a worker that did not move past the
+  // same task for two samples is blocked.
+  void MonitorLoop();
+
+  // PollTimers() moves expired timer tasks into the `thread_id` worker queue
+  // and notifies parked threads. If `parked` is false the caller thread will
+  // run one of the tasks itself.
+  void PollTimers(int thread_id, bool parked);
+
   // StartSpinning() checks if the number of threads in the spin loop is less
   // than the allowed maximum, if so increments the number of spinning threads
   // by one and returns true (caller must enter the spin loop). Otherwise
   // returns false, and the caller must not enter the spin loop.
   bool StartSpinning();
 
+  // Spin() tries to steal a task in a loop, until it succeeds or runs out of
+  // the spin budget defined by the spin policy. `idle_start` is the time when
+  // the worker ran out of work (only used by the adaptive policy).
+  std::optional<TaskFunction> Spin(
+      int spin_count, const AdaptiveSpinner &spinner,
+      std::chrono::steady_clock::time_point idle_start,
+      WorkerCounters *counters);
+
   // StopSpinning() decrements the number of spinning threads by one. It also
   // checks if there were any tasks submitted into the pool without notifying
   // parked threads, and decrements the count by one. Returns true if the number
@@ -197,7 +372,12 @@ class WorkQueueBase {
   // be picked up by one of the spinning threads.
   bool IsNotifyParkedThreadRequired();
 
-  void Notify() { mEventCount.Notify(false); }
+  // Wakes up a parked worker after a new task was added, in elastic pools
+  // starts a new one if all the workers are busy.
+  void Notify() {
+    mEventCount.Notify(false);
+    MaybeStartWorker();
+  }
 
   // Returns current thread id if the caller thread is managed by `this`,
   // returns `-1` otherwise.
@@ -207,21 +387,48 @@ class WorkQueueBase {
   // if all queues are empty.
   int NonEmptyQueueIndex();
 
+  // ProducerRing() returns the submission ring of the calling free-standing
+  // thread, and creates one on the first call. Returns nullptr if the queue
+  // ran out of rings, the caller must fall back to the worker queues.
+  SubmissionRing *ProducerRing(PerThread *pt);
+
+  // PopSubmitted() pops a task from one of the submission rings, starting from
+  // a random one.
+  std::optional<TaskFunction> PopSubmitted(unsigned r);
+
+  // SubmittedEmpty() returns true if all the submission rings are empty.
+  bool SubmittedEmpty() const;
+
   static PerThread *GetPerThread() {
     static thread_local PerThread perThread;
     PerThread *pt = &perThread;
     return pt;
   }
 
+  // Returns counters of the caller thread if it is managed by `this`,
+  // otherwise returns counters shared by all external threads.
+  WorkerCounters &CallerCounters(const PerThread *pt) {
+    return pt->parent == &mDerived ? mThreadData[pt->thread_id].counters
+                                   : mExternalCounters;
+  }
+
   unsigned NumBlockedThreads() const { return mBlocked.load(); }
   unsigned NumActiveThreads() const { return mNumThreads - mBlocked.load(); }
 
   const uint32_t mNumThreads;
+  const SpinOptions mSpinOptions;
+  const BlockingCallOptions mBlockingCalls;
+  // Upper bound of the requested active workers, the rest of the threads are
+  // spare compensating workers.
+  const uint32_t mMaxActiveWorkers;
+  // Empty if the worker threads are not pinned.
+  const WorkerPlacement mPlacement;
 
   std::vector<ThreadData> mThreadData;
   std::vector<unsigned> mCoprimes;
 
   std::atomic<unsigned> mBlocked;
+  std::atomic<unsigned> mNumActiveWorkers;
   std::atomic<bool> mDone;
   std::atomic<bool> mCancelled;
 
@@ -231,6 +438,57 @@ class WorkQueueBase {
   std::mutex mAllBlockedMu;
   std::condition_variable mAllBlockedCV;
 
+  // Retired workers park on this conditional variable, they are not
+  // registered in the event count.
+  std::mutex mRetiredMu;
+  std::condition_variable mRetiredCV;
+  // Active workers set by SetNumActiveWorkers(), and compensating workers
+  // activated by the monitor, written under `mRetiredMu`. The requested count
+  // is also read without the lock by the submitters.
+  std::atomic<unsigned> mNumRequestedWorkers;
+  unsigned mNumCompensatingWorkers;
+
+  // Blocking call monitor thread, null if the monitor is disabled.
+  std::unique_ptr<Thread> mMonitor;
+  std::mutex mMonitorMu;
+  std::condition_variable mMonitorCV;
+  bool mStopMonitor;
+  std::atomic<uint64_t> mNumBlockedTasks;
+
+  // Elastic pool state. Thread starts and exits are serialized by `mStartMu`,
+  // the counters are read without the lock by the task submitters. A worker
+  // is idle from the moment it runs out of work until it gets a task, a new
+  // thread is idle until it finds its first task.
+  const ElasticPoolOptions mElastic;
+  std::mutex mStartMu;
+  std::atomic<unsigned> mNumStarted;
+  std::atomic<unsigned> mNumIdle;
+
+  // Tasks that did not fit into the per-thread queues. Workers drain it when
+  // their own queue is empty, before parking.
+  TaskOverflowQueue mOverflowQueue;
+
+  // Free-standing threads submit tasks into their own rings, which workers
+  // poll while stealing. Rings are created on the first submission, published
+  // by incrementing `mNumRings`, and live as long as the queue. Threads that
+  // come after the last ring is taken use the worker queues.
+  static constexpr unsigned kMaxSubmissionRings = 64;
+  const uint64_t mQueueId;
+  std::array<std::unique_ptr<SubmissionRing>, kMaxSubmissionRings> mRings;
+  std::atomic<unsigned> mNumRings;
+  std::mutex mRingsMu;
+  // Identifies the thread that owns the ring, guarded by `mRingsMu`.
+  std::array<const void *, kMaxSubmissionRings> mRingOwners;
+
+  // Counters updated by the threads not managed by the queue.
+  WorkerCounters mExternalCounters;
+
+  std::atomic<uint64_t> mNumCancelledTasks;
+
+  TimerWheel mTimers;
+  // Id of the worker thread parked until the next timer deadline, or -1.
+  std::atomic<int> mTimerWaiter;
+
   // All work queues composed together in a single logical work queue, must
   // share a quiescing state to guarantee correct emptyness check.
   QuiescingState *mQuiescingState;
@@ -297,28 +555,84 @@ inline std::vector<unsigned> ComputeCoprimes(int n) {
 template <typename Derived>
 WorkQueueBase<Derived>::WorkQueueBase(QuiescingState *quiescing_state,
                                       std::string_view name_prefix,
-                                      int num_threads)
-    : mNumThreads(num_threads),
-      mThreadData(num_threads),
-      mCoprimes(ComputeCoprimes(num_threads)),
+                                      int num_threads,
+                                      const WorkQueueOptions &options)
+    : mNumThreads(num_threads + options.blockingCalls.NumSpareThreads()),
+      mSpinOptions(options.spin),
+      mBlockingCalls(options.blockingCalls),
+      mMaxActiveWorkers(num_threads),
+      mPlacement(options.pinWorkers
+                     ? PlaceWorkers(GetCpuTopology(), mNumThreads)
+                     : WorkerPlacement()),
+      mThreadData(mNumThreads),
+      mCoprimes(ComputeCoprimes(mNumThreads)),
       mBlocked(0),
+      mNumActiveWorkers(num_threads),
       mDone(false),
       mCancelled(false),
+      mNumRequestedWorkers(num_threads),
+      mNumCompensatingWorkers(0),
+      mStopMonitor(false),
+      mNumBlockedTasks(0),
+      mElastic(options.elastic),
+      mNumStarted(0),
+      mNumIdle(0),
+      mQueueId(NextWorkQueueId()),
+      mNumRings(0),
+      mNumCancelledTasks(0),
+      mTimerWaiter(-1),
       mQuiescingState(quiescing_state),
       mSpinningState(0),
-      mEventCount(num_threads),
+      mEventCount(mNumThreads),
       mDerived(static_cast<Derived &>(*this)) {
   assert(num_threads >= 1);
   (void)name_prefix;
-  for (int i = 0; i < num_threads; i++) {
-    mThreadData[i].thread =
-        ThreadingEnvironment::StartThread([this, i]() { WorkerLoop(i); });
+  if (mElastic.enabled()) {
+    // Only the active workers are ever started, the rest of the slots count as
+    // blocked until they get a thread.
+    mBlocked.store(mNumThreads);
+    if (!mElastic.lazyStart) {
+      std::lock_guard<std::mutex> lock(mStartMu);
+      for (unsigned i = 0; i < mMaxActiveWorkers; i++) {
+        StartWorkerLocked(mMaxActiveWorkers);
+      }
+    }
+  } else {
+    mNumStarted.store(mNumThreads);
+    for (unsigned i = 0; i < mNumThreads; i++) {
+      mThreadData[i].started = true;
+      mThreadData[i].thread =
+          ThreadingEnvironment::StartThread([this, i]() { WorkerLoop(i); });
+    }
+  }
+  if (mBlockingCalls.enabled()) {
+    mMonitor = ThreadingEnvironment::StartThread([this]() { MonitorLoop(); });
   }
 }
 
 template <typename Derived>
 WorkQueueBase<Derived>::~WorkQueueBase() {
-  mDone = true;
+  if (mMonitor) {
+    {
+      std::lock_guard<std::mutex> lock(mMonitorMu);
+      mStopMonitor = true;
+    }
+    mMonitorCV.notify_all();
+    ThreadingEnvironment::Join(mMonitor.get());
+    mMonitor.reset();
+  }
+
+  {
+    // No worker starts or exits on its own after this point.
+    std::lock_guard<std::mutex> lock(mStartMu);
+    mDone = true;
+  }
+
+  // Retired workers exit immediately, they have nothing in their queues.
+  {
+    std::lock_guard<std::mutex> lock(mRetiredMu);
+  }
+  mRetiredCV.notify_all();
 
   // Now if all threads block without work, they will start exiting.
   // But note that threads can continue to work arbitrary long,
@@ -331,9 +645,13 @@ WorkQueueBase<Derived>::~WorkQueueBase() {
     for (ThreadData &thread_data : mThreadData) {
       thread_data.queue.Flush();
     }
+    mOverflowQueue.Flush();
+    for (unsigned i = 0; i < mNumRings.load(); ++i) mRings[i]->Flush();
   }
-  // All worker threads joined in destructors.
+  // All worker threads joined in destructors. Slots of elastic pools might
+  // have never been started.
   for (ThreadData &thread_data : mThreadData) {
+    if (!thread_data.thread) continue;
     ThreadingEnvironment::Join(thread_data.thread.get());
     thread_data.thread.reset();
   }
@@ -360,7 +678,7 @@ void WorkQueueBase<Derived>::Quiesce() {
 
   while (task.has_value()) {
     // Execute stolen task in the caller thread.
-    (*task)();
+    if (!DropIfCancelled(&*task)) (*task)();
 
     // Try to steal the next task.
     task = Steal();
@@ -375,23 +693,85 @@ void WorkQueueBase<Derived>::Quiesce() {
   }
 }
 
+template <typename Derived>
+bool WorkQueueBase<Derived>::RunPendingTask() {
+  PerThread *pt = GetPerThread();
+  std::optional<TaskFunction> task;
+  if (pt->parent == &mDerived) {
+    task = mDerived.NextTask(&(mThreadData[pt->thread_id].queue));
+  }
+  if (!task.has_value()) task = Steal();
+  if (!task.has_value()) return false;
+
+  if (!DropIfCancelled(&*task)) {
+    (*task)();
+    CallerCounters(pt).Add(WorkerCounter::kTasks);
+  }
+  return true;
+}
+
 template <typename Derived>
 std::optional<TaskFunction> WorkQueueBase<Derived>::Steal() {
   PerThread *pt = GetPerThread();
   unsigned r = pt->rng();
-  unsigned victim = FastReduce(r, mNumThreads);
-  unsigned inc = mCoprimes[FastReduce(r, mCoprimes.size())];
 
-  for (unsigned i = 0; i < mNumThreads; i++) {
-    std::optional<TaskFunction> t =
-        mDerived.Steal(&(mThreadData[victim].queue));
-    if (t.has_value()) return t;
+  WorkerCounters &counters = CallerCounters(pt);
+  counters.Add(WorkerCounter::kStealAttempts);
 
-    victim += inc;
-    if (victim >= mNumThreads) {
-      victim -= mNumThreads;
+  // Pinned workers know where the other workers run, and steal from the
+  // closest ones first. Free-standing threads pick a random victim.
+  if (pt->parent == &mDerived && !mPlacement.empty()) {
+    std::optional<TaskFunction> t = StealNearest(pt->thread_id, r, &counters);
+    if (t.has_value()) {
+      counters.Add(WorkerCounter::kSteals);
+      return t;
+    }
+  } else {
+    unsigned victim = FastReduce(r, mNumThreads);
+    unsigned inc = mCoprimes[FastReduce(r, mCoprimes.size())];
+
+    for (unsigned i = 0; i < mNumThreads; i++) {
+      std::optional<TaskFunction> t =
+          mDerived.Steal(&(mThreadData[victim].queue));
+      if (t.has_value()) {
+        counters.Add(WorkerCounter::kSteals);
+        return t;
+      }
+
+      victim += inc;
+      if (victim >= mNumThreads) {
+        victim -= mNumThreads;
+      }
     }
   }
+  std::optional<TaskFunction> t = PopSubmitted(r);
+  if (!t.has_value()) t = mOverflowQueue.Pop();
+  if (t.has_value()) counters.Add(WorkerCounter::kSteals);
+  return t;
+}
+
+template <typename Derived>
+std::optional<TaskFunction> WorkQueueBase<Derived>::StealNearest(
+    int thread_id, unsigned r, WorkerCounters *counters) {
+  const std::vector<unsigned> &order = mPlacement.stealOrder[thread_id];
+  const std::array<unsigned, kNumStealTiers> &tier_end =
+      mPlacement.tierEnd[thread_id];
+
+  unsigned begin = 0;
+  for (int tier = 0; tier < kNumStealTiers; ++tier) {
+    const unsigned size = tier_end[tier] - begin;
+    unsigned k = FastReduce(r, size);
+    for (unsigned i = 0; i < size; ++i) {
+      std::optional<TaskFunction> t =
+          mDerived.Steal(&(mThreadData[order[begin + k]].queue));
+      if (t.has_value()) {
+        if (tier == kRemote) counters->Add(WorkerCounter::kRemoteSteals);
+        return t;
+      }
+      if (++k == size) k = 0;
+    }
+    begin = tier_end[tier];
+  }
   return std::nullopt;
 }
 
@@ -401,23 +781,86 @@ void WorkQueueBase<Derived>::WorkerLoop(int thread_id) {
   pt->parent = &mDerived;
   pt->rng = FastRng(ThreadingEnvironment::ThisThreadIdHash());
   pt->thread_id = thread_id;
+  TaskTraceName::SetThisThread(&mThreadData[thread_id].traceName);
+  struct RestoreTraceName {
+    ~RestoreTraceName() { TaskTraceName::SetThisThread(nullptr); }
+  } restore_trace_name;
+  if (!mPlacement.empty()) {
+    ThreadingEnvironment::SetThisThreadAffinity(mPlacement.cpus[thread_id]);
+  }
 
   Queue *q = &(mThreadData[thread_id].queue);
+  WorkerCounters &counters = mThreadData[thread_id].counters;
   EventCount::Waiter *waiter = mEventCount.waiter(thread_id);
-
-  const int spin_count = mNumThreads > 0 ? kSpinCount / mNumThreads : 0;
+  ThreadData &td = mThreadData[thread_id];
+  std::atomic<uint64_t> &task_seq = td.taskSeq;
+  const bool monitored = mBlockingCalls.enabled();
+  uint64_t seq = task_seq.load(std::memory_order_relaxed);
+
+  // In elastic pools the worker maintains `mNumIdle`, a new thread starts
+  // counted as idle.
+  const bool elastic = mElastic.enabled();
+  const bool idle_exit = mElastic.idleTimeout.count() > 0;
+  bool counted_idle = elastic;
+  std::chrono::steady_clock::time_point idle_since;
+  if (idle_exit) idle_since = std::chrono::steady_clock::now();
+
+  // The spare slots of compensating workers don't dilute the spin budget.
+  const int spin_count =
+      mMaxActiveWorkers > 0
+          ? mSpinOptions.fixedSpinCount / static_cast<int>(mMaxActiveWorkers)
+          : 0;
+
+  // The adaptive spin policy measures how long the worker stays without work,
+  // other policies never read the clock.
+  const bool adaptive = mSpinOptions.policy == SpinPolicy::kAdaptive;
+  AdaptiveSpinner spinner(mSpinOptions.maxSpinTime);
+  bool idle = false;
+  std::chrono::steady_clock::time_point idle_start;
+  int tasks_since_timer_poll = 0;
 
   while (!mCancelled) {
+    // Surplus workers retire once they are done with their own queue, in
+    // elastic pools their threads exit.
+    if (static_cast<unsigned>(thread_id) >= NumActiveWorkers() &&
+        mDerived.Empty(q)) {
+      if (counted_idle) {
+        mNumIdle.fetch_sub(1);
+        counted_idle = false;
+      }
+      if (elastic && ExitWorker(thread_id, /*retiring=*/true)) return;
+      if (!Retire(thread_id)) return;
+      continue;
+    }
+
     std::optional<TaskFunction> t = mDerived.NextTask(q);
+    if (!t.has_value() && !mTimers.Empty() &&
+        mTimers.HasExpired(std::chrono::steady_clock::now())) {
+      PollTimers(thread_id, /*parked=*/false);
+      t = mDerived.NextTask(q);
+    }
+    if (!t.has_value()) {
+      t = mOverflowQueue.Pop();
+    }
     if (!t.has_value()) {
       t = Steal();
       if (!t.has_value()) {
+        if (adaptive && !idle) {
+          idle = true;
+          idle_start = std::chrono::steady_clock::now();
+        }
+        if (elastic && !counted_idle) {
+          mNumIdle.fetch_add(1);
+          counted_idle = true;
+          if (idle_exit) idle_since = std::chrono::steady_clock::now();
+        }
+
         // Maybe leave thread spinning. This reduces latency.
-        const bool start_spinning = StartSpinning();
+        const bool start_spinning =
+            mSpinOptions.policy != SpinPolicy::kPowerSaving &&
+            (!adaptive || spinner.SpinTime().count() > 0) && StartSpinning();
         if (start_spinning) {
-          for (int i = 0; i < spin_count && !t.has_value(); ++i) {
-            t = Steal();
-          }
+          t = Spin(spin_count, spinner, idle_start, &counters);
 
           const bool stopped_spinning = StopSpinning();
           // If a task was submitted to the queue without a call to
@@ -431,18 +874,332 @@ void WorkQueueBase<Derived>::WorkerLoop(int thread_id) {
         }
 
         if (!t.has_value()) {
+          if (idle_exit) td.idleDeadline = idle_since + mElastic.idleTimeout;
           if (!WaitForWork(waiter, &t)) {
             return;
           }
+          if (td.idleExpired) {
+            td.idleExpired = false;
+            if (!t.has_value() && ExitWorker(thread_id, /*retiring=*/false)) {
+              return;
+            }
+            idle_since = std::chrono::steady_clock::now();
+          }
+          if (adaptive) {
+            std::chrono::nanoseconds latency = waiter->TakeWakeupLatency();
+            if (latency.count() >= 0) spinner.OnWakeup(latency);
+          }
         }
       }
     }
     if (t.has_value()) {
-      (*t)();  // Execute a task.
+      if (idle) {
+        spinner.OnIdle(std::chrono::steady_clock::now() - idle_start);
+        idle = false;
+      }
+      if (counted_idle) {
+        counted_idle = false;
+        // The last idle worker got busy, if there is more work to do another
+        // thread should start looking for it, so that a burst of tasks ramps
+        // up all the workers and not just one.
+        if (mNumIdle.fetch_sub(1) == 1 && HasVisibleWork()) MaybeStartWorker();
+      }
+      if (!DropIfCancelled(&*t)) {
+        if (monitored) task_seq.store(++seq, std::memory_order_release);
+        (*t)();  // Execute a task.
+        if (monitored) task_seq.store(++seq, std::memory_order_relaxed);
+        counters.Add(WorkerCounter::kTasks);
+      }
+      if (++tasks_since_timer_poll == kTimerPollInterval) {
+        tasks_since_timer_poll = 0;
+        if (!mTimers.Empty() &&
+            mTimers.HasExpired(std::chrono::steady_clock::now())) {
+          PollTimers(thread_id, /*parked=*/false);
+        }
+      }
+    }
+  }
+}
+
+template <typename Derived>
+TimerHandle WorkQueueBase<Derived>::AddTimer(
+    std::chrono::steady_clock::time_point deadline, TaskFunction task) {
+  bool earliest = false;
+  TimerHandle handle(mTimers.Schedule(deadline, std::move(task), &earliest));
+  if (earliest) {
+    // Re-arm the worker sleeping until the previous deadline. If there is no
+    // such worker, wake up any parked one to take this role. A worker that is
+    // about to park publishes itself in `mTimerWaiter` before reading the next
+    // deadline, so one of the two sides always sees the other.
+    const int timer_waiter = mTimerWaiter.load(std::memory_order_seq_cst);
+    if (timer_waiter >= 0) {
+      mEventCount.Interrupt(mEventCount.waiter(timer_waiter));
+    } else {
+      Notify();
+    }
+  }
+  return handle;
+}
+
+template <typename Derived>
+unsigned WorkQueueBase<Derived>::SetNumActiveWorkers(unsigned num_workers) {
+  num_workers = std::clamp(num_workers, 1u, mMaxActiveWorkers);
+  std::unique_lock<std::mutex> lock(mRetiredMu);
+  mNumRequestedWorkers.store(num_workers, std::memory_order_relaxed);
+  UpdateActiveWorkers(std::move(lock));
+  return num_workers;
+}
+
+template <typename Derived>
+void WorkQueueBase<Derived>::MaybeStartWorker() {
+  if (!mElastic.enabled()) return;
+  if (mNumStarted.load() >= NumActiveWorkers() || mNumIdle.load() > 0) return;
+  std::lock_guard<std::mutex> lock(mStartMu);
+  if (mDone || mNumIdle.load() > 0) return;
+  StartWorkerLocked(NumActiveWorkers());
+}
+
+template <typename Derived>
+void WorkQueueBase<Derived>::StartWorkerLocked(unsigned num_active) {
+  for (unsigned i = 0; i < num_active; ++i) {
+    ThreadData &td = mThreadData[i];
+    if (td.started) continue;
+    // The previous thread of the slot left the worker loop under `mStartMu`,
+    // the join only waits for it to return.
+    if (td.thread) {
+      ThreadingEnvironment::Join(td.thread.get());
+      td.thread.reset();
+    }
+    td.started = true;
+    mNumIdle.fetch_add(1);
+    mNumStarted.fetch_add(1);
+    mBlocked.fetch_sub(1);
+    td.thread =
+        ThreadingEnvironment::StartThread([this, i]() { WorkerLoop(i); });
+    return;
+  }
+}
+
+template <typename Derived>
+bool WorkQueueBase<Derived>::ExitWorker(int thread_id, bool retiring) {
+  std::lock_guard<std::mutex> lock(mStartMu);
+  if (mDone || mCancelled) return false;
+
+  const unsigned num_active = NumActiveWorkers();
+  if (retiring) {
+    if (static_cast<unsigned>(thread_id) < num_active) return false;
+    mNumStarted.fetch_sub(1);
+  } else {
+    // Someone must sleep until the next timer deadline.
+    if (!mTimers.Empty() && mTimerWaiter.load() < 0) return false;
+    mNumIdle.fetch_sub(1);
+    mNumStarted.fetch_sub(1);
+    // A task submitted before the counters were decremented is either visible
+    // here, or its submitter saw this worker as idle and notified it.
+    if (HasVisibleWork()) {
+      mNumIdle.fetch_add(1);
+      mNumStarted.fetch_add(1);
+      return false;
+    }
+  }
+
+  mThreadData[thread_id].started = false;
+  if (mBlocked.fetch_add(1) + 1 == mNumThreads) {
+    std::lock_guard<std::mutex> all_blocked_lock(mAllBlockedMu);
+    mAllBlockedCV.notify_all();
+  }
+
+  // A retiring worker might have been woken up to run a task, pass it on.
+  if (retiring && HasVisibleWork()) {
+    mEventCount.Notify(/*notify_all=*/false);
+    if (mNumIdle.load() == 0) StartWorkerLocked(num_active);
+  }
+  return true;
+}
+
+template <typename Derived>
+void WorkQueueBase<Derived>::UpdateActiveWorkers(
+    std::unique_lock<std::mutex> lock) {
+  const unsigned num_requested =
+      mNumRequestedWorkers.load(std::memory_order_relaxed);
+  const unsigned num_workers =
+      std::min(mNumThreads, num_requested + mNumCompensatingWorkers);
+  const unsigned prev = mNumActiveWorkers.exchange(num_workers);
+  lock.unlock();
+  if (num_workers > prev) {
+    mRetiredCV.notify_all();
+    MaybeStartWorker();
+  } else if (num_workers < prev) {
+    // Parked surplus workers must wake up to move to the retired state.
+    mEventCount.Notify(/*notify_all=*/true);
+  }
+}
+
+template <typename Derived>
+void WorkQueueBase<Derived>::MonitorLoop() {
+  constexpr int kBlockedSamples = 2;
+  const auto period = std::max<std::chrono::steady_clock::duration>(
+      mBlockingCalls.threshold / kBlockedSamples, std::chrono::milliseconds(1));
+  const unsigned max_compensating = mBlockingCalls.NumSpareThreads();
+
+  // Monitor thread state, per worker.
+  std::vector<uint64_t> last_seq(mNumThreads, 0);
+  std::vector<int> same_task_samples(mNumThreads, 0);
+  std::vector<bool> compensated(mNumThreads, false);
+  unsigned num_compensating = 0;
+
+  std::unique_lock<std::mutex> lock(mMonitorMu);
+  auto stopped = [this]() { return mStopMonitor; };
+  while (!mMonitorCV.wait_for(lock, period, stopped)) {
+    const unsigned prev_compensating = num_compensating;
+    for (unsigned i = 0; i < mNumThreads; ++i) {
+      const uint64_t seq =
+          mThreadData[i].taskSeq.load(std::memory_order_acquire);
+      const bool running = (seq & 1) != 0;
+      if (!running || seq != last_seq[i]) {
+        same_task_samples[i] = 0;
+        if (compensated[i]) {
+          compensated[i] = false;
+          --num_compensating;
+        }
+      } else if (++same_task_samples[i] == kBlockedSamples) {
+        mNumBlockedTasks.fetch_add(1, std::memory_order_relaxed);
+        const bool compensate = num_compensating < max_compensating;
+        if (compensate) {
+          compensated[i] = true;
+          ++num_compensating;
+        }
+        if (mBlockingCalls.report != nullptr) {
+          BlockedWorkerReport report;
+          report.worker = static_cast<int>(i);
+          report.taskName = mThreadData[i].traceName.Get();
+          report.duration = period * kBlockedSamples;
+          report.compensated = compensate;
+          mBlockingCalls.report(report);
+        }
+      }
+      last_seq[i] = seq;
+    }
+
+    if (num_compensating != prev_compensating) {
+      std::unique_lock<std::mutex> retired_lock(mRetiredMu);
+      mNumCompensatingWorkers = num_compensating;
+      UpdateActiveWorkers(std::move(retired_lock));
+    }
+  }
+}
+
+template <typename Derived>
+bool WorkQueueBase<Derived>::Retire(int thread_id) {
+  // Retired workers count as blocked, so that Quiesce() and the termination
+  // check in WaitForWork() do not wait for them.
+  if (mBlocked.fetch_add(1) + 1 == mNumThreads) {
+    {
+      std::lock_guard<std::mutex> lock(mAllBlockedMu);
+      mAllBlockedCV.notify_all();
+    }
+    // Parked workers might be waiting for this thread to block, to exit.
+    if (mDone) mEventCount.Notify(/*notify_all=*/true);
+  }
+
+  // This thread might have been woken up to run a task, and retired instead.
+  // Pass the notification on to one of the active workers.
+  if (HasVisibleWork()) mEventCount.Notify(/*notify_all=*/false);
+
+  std::unique_lock<std::mutex> lock(mRetiredMu);
+  mRetiredCV.wait(lock, [&]() {
+    return static_cast<unsigned>(thread_id) < NumActiveWorkers() || mDone ||
+           mCancelled;
+  });
+  if (mDone || mCancelled) return false;
+  mBlocked.fetch_sub(1);
+  return true;
+}
+
+template <typename Derived>
+void WorkQueueBase<Derived>::PollTimers(int thread_id, bool parked) {
+  ThreadData &td = mThreadData[thread_id];
+  std::vector<TaskFunction> &expired = td.expiredTimers;
+  if (mTimers.Advance(std::chrono::steady_clock::now(), &expired) == 0) return;
+
+  const bool quiescing = IsQuiescing();
+  for (TaskFunction &task : expired) {
+    if (quiescing) task = WithPendingTaskCounter(std::move(task));
+    std::optional<TaskFunction> overflow = td.queue.PushFront(std::move(task));
+    if (overflow.has_value()) mOverflowQueue.Push(std::move(*overflow));
+  }
+
+  size_t num_notify = std::min<size_t>(expired.size(), mNumThreads);
+  if (!parked) --num_notify;
+  expired.clear();
+
+  for (size_t i = 0; i < num_notify; ++i) {
+    if (IsNotifyParkedThreadRequired()) {
+      td.counters.Add(WorkerCounter::kUnparks);
+      Notify();
     }
   }
 }
 
+template <typename Derived>
+void WorkQueueBase<Derived>::CommitWait(EventCount::Waiter *waiter,
+                                        int thread_id) {
+  int no_waiter = -1;
+  if (mTimers.Empty() || !mTimerWaiter.compare_exchange_strong(
+                             no_waiter, thread_id, std::memory_order_seq_cst)) {
+    ThreadData &td = mThreadData[thread_id];
+    if (td.idleDeadline == std::chrono::steady_clock::time_point::max()) {
+      mEventCount.CommitWait(waiter);
+      return;
+    }
+    bool signaled = mEventCount.CommitWaitUntil(waiter, td.idleDeadline);
+    while (!signaled && std::chrono::steady_clock::now() < td.idleDeadline) {
+      signaled = mEventCount.ResumeWaitUntil(waiter, td.idleDeadline);
+    }
+    if (!signaled) {
+      // Leaves the waiter in the stack without waking up anybody, a signaled
+      // waiter may find work, ExitWorker checks for it.
+      mEventCount.Abandon(waiter);
+      td.idleExpired = true;
+    }
+    return;
+  }
+
+  bool signaled = mEventCount.CommitWaitUntil(waiter, mTimers.NextDeadline());
+  while (!signaled) {
+    // From the event count point of view the thread is still parked, it only
+    // fires the timers, and notifies other threads (possibly itself).
+    PollTimers(thread_id, /*parked=*/true);
+    signaled = mEventCount.ResumeWaitUntil(waiter, mTimers.NextDeadline());
+  }
+  mTimerWaiter.store(-1, std::memory_order_seq_cst);
+}
+
+template <typename Derived>
+std::optional<TaskFunction> WorkQueueBase<Derived>::Spin(
+    int spin_count, const AdaptiveSpinner &spinner,
+    std::chrono::steady_clock::time_point idle_start,
+    WorkerCounters *counters) {
+  std::optional<TaskFunction> t;
+  int i = 0;
+  if (mSpinOptions.policy == SpinPolicy::kAdaptive) {
+    const auto deadline = idle_start + spinner.SpinTime();
+    for (; !t.has_value(); ++i) {
+      if (i % kSpinClockCheckInterval == 0 &&
+          std::chrono::steady_clock::now() >= deadline) {
+        break;
+      }
+      t = Steal();
+    }
+  } else {
+    for (; i < spin_count && !t.has_value(); ++i) {
+      t = Steal();
+    }
+  }
+  counters->Add(WorkerCounter::kSpinIterations, i);
+  return t;
+}
+
 template <typename Derived>
 bool WorkQueueBase<Derived>::WaitForWork(EventCount::Waiter *waiter,
                                          std::optional<TaskFunction> *task) {
@@ -461,6 +1218,21 @@ bool WorkQueueBase<Derived>::WaitForWork(EventCount::Waiter *waiter,
       return true;
     }
   }
+  // Cancel the wait only after a task is taken. Another thread can pop the
+  // task first, then the queues are re-checked while still registered as a
+  // waiter, so that a task submitted in the meantime is not missed.
+  while (!mOverflowQueue.Empty() || !SubmittedEmpty()) {
+    if (mCancelled) {
+      mEventCount.CancelWait();
+      return false;
+    }
+    *task = PopSubmitted(GetPerThread()->rng());
+    if (!task->has_value()) *task = mOverflowQueue.Pop();
+    if (task->has_value()) {
+      mEventCount.CancelWait();
+      return true;
+    }
+  }
   // Number of blocked threads is used as termination condition.
   // If we are shutting down and all worker threads blocked without work,
   // that's we are done.
@@ -480,7 +1252,7 @@ bool WorkQueueBase<Derived>::WaitForWork(EventCount::Waiter *waiter,
     // right after incrementing mBlocked above. Now a free-standing thread
     // submits work and calls destructor (which sets mDone). If we don't
     // re-check queues, we will exit leaving the work unexecuted.
-    if (NonEmptyQueueIndex() != -1) {
+    if (HasVisibleWork()) {
       // Note: we must not pop from queues before we decrement mBlocked,
       // otherwise the following scenario is possible. Consider that instead
       // of checking for emptiness we popped the only element from queues.
@@ -495,20 +1267,26 @@ bool WorkQueueBase<Derived>::WaitForWork(EventCount::Waiter *waiter,
     return false;
   }
 
-  mEventCount.CommitWait(waiter);
+  PerThread *pt = GetPerThread();
+  CallerCounters(pt).Add(WorkerCounter::kParks);
+  CommitWait(waiter, pt->thread_id);
   mBlocked.fetch_sub(1);
   return true;
 }
 
 template <typename Derived>
 bool WorkQueueBase<Derived>::StartSpinning() {
-  if (NumActiveThreads() > kMinActiveThreadsToStartSpinning) return false;
+  if (NumActiveThreads() >
+      static_cast<unsigned>(mSpinOptions.minActiveThreadsToStartSpinning)) {
+    return false;
+  }
 
   uint64_t spinning = mSpinningState.load(std::memory_order_relaxed);
   for (;;) {
     SpinningState state = SpinningState::Decode(spinning);
 
-    if ((state.mNumSpinning - state.mNumNoNotification) >= kMaxSpinningThreads)
+    if ((state.mNumSpinning - state.mNumNoNotification) >=
+        static_cast<uint64_t>(mSpinOptions.maxSpinningThreads))
       return false;
 
     // Increment the number of spinning threads.
@@ -580,6 +1358,56 @@ int WorkQueueBase<Derived>::NonEmptyQueueIndex() {
   return -1;
 }
 
+template <typename Derived>
+SubmissionRing *WorkQueueBase<Derived>::ProducerRing(PerThread *pt) {
+  if (pt->ring_queue_id == mQueueId) return pt->ring;
+
+  // The address of a thread local variable identifies the calling thread. It
+  // can be reused only by a thread started after this one exited, and that
+  // thread can safely take over the ring.
+  static thread_local char thread_tag;
+
+  SubmissionRing *ring = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mRingsMu);
+    const unsigned n = mNumRings.load(std::memory_order_relaxed);
+    for (unsigned i = 0; i < n && ring == nullptr; ++i) {
+      if (mRingOwners[i] == &thread_tag) ring = mRings[i].get();
+    }
+    if (ring == nullptr && n < kMaxSubmissionRings) {
+      mRings[n] = std::make_unique<SubmissionRing>();
+      mRingOwners[n] = &thread_tag;
+      ring = mRings[n].get();
+      mNumRings.store(n + 1, std::memory_order_release);
+    }
+  }
+  pt->ring_queue_id = mQueueId;
+  pt->ring = ring;
+  return ring;
+}
+
+template <typename Derived>
+std::optional<TaskFunction> WorkQueueBase<Derived>::PopSubmitted(unsigned r) {
+  const unsigned n = mNumRings.load(std::memory_order_acquire);
+  if (n == 0) return std::nullopt;
+  unsigned i = FastReduce(r, n);
+  for (unsigned k = 0; k < n; ++k) {
+    std::optional<TaskFunction> t = mRings[i]->Pop();
+    if (t.has_value()) return t;
+    if (++i == n) i = 0;
+  }
+  return std::nullopt;
+}
+
+template <typename Derived>
+bool WorkQueueBase<Derived>::SubmittedEmpty() const {
+  const unsigned n = mNumRings.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < n; ++i) {
+    if (!mRings[i]->Empty()) return false;
+  }
+  return true;
+}
+
 template <typename Derived>
 int WorkQueueBase<Derived>::CurrentThreadId() const {
   const PerThread *pt = GetPerThread();
@@ -590,13 +1418,34 @@ int WorkQueueBase<Derived>::CurrentThreadId() const {
   }
 }
 
+template <typename Derived>
+void WorkQueueBase<Derived>::GetWorkerStats(
+    WorkQueueStats::Queue *stats) const {
+  stats->workers.resize(mNumThreads);
+  for (unsigned i = 0; i < mNumThreads; ++i) {
+    ReadWorkerCounters(mThreadData[i].counters, &stats->workers[i]);
+    stats->workers[i].queueDepth = mThreadData[i].queue.Size();
+  }
+  ReadWorkerCounters(mExternalCounters, &stats->external);
+  stats->numCancelledTasks = NumCancelledTasks();
+  stats->numBlockedTasks = NumBlockedTasks();
+  stats->numStartedWorkers = NumStartedWorkers();
+}
+
 template <typename Derived>
 void WorkQueueBase<Derived>::Cancel() {
-  mCancelled = true;
-  mDone = true;
+  {
+    std::lock_guard<std::mutex> lock(mStartMu);
+    mCancelled = true;
+    mDone = true;
+  }
 
   // Wake up the threads without work to let them exit on their own.
   mEventCount.Notify(true);
+  {
+    std::lock_guard<std::mutex> lock(mRetiredMu);
+  }
+  mRetiredCV.notify_all();
 }
 
 }  // namespace internal
@@ -0,0 +1,38 @@
+#ifndef ASYNC_CONCURRENT_WORK_QUEUE_OPTIONS_
+#define ASYNC_CONCURRENT_WORK_QUEUE_OPTIONS_
+
+#include "async/concurrent/blocking_call_monitor.h"
+#include "async/concurrent/elastic_pool_options.h"
+#include "async/concurrent/spin_policy.h"
+
+namespace sss {
+namespace async {
+
+// Tuning of the non-blocking worker pool, passed to
+// CreateMultiThreadedWorkQueue() and to the work queue constructors. The
+// defaults give a fixed pool of unpinned workers that never compensate for
+// blocking calls.
+struct WorkQueueOptions {
+  // How the workers spin before parking when they run out of work.
+  SpinOptions spin;
+
+  // If larger than the requested number of threads, the extra workers are
+  // started parked, and the pool can be grown up to this number with
+  // SetParallelismLevel(). Only used by CreateMultiThreadedWorkQueue().
+  int maxNumThreads = 0;
+
+  // Pin the workers to CPUs, and steal from the workers sharing caches and the
+  // NUMA node first.
+  bool pinWorkers = false;
+
+  // Compensating workers for the tasks stuck in blocking calls.
+  BlockingCallOptions blockingCalls;
+
+  // Start the workers on demand, and release them when idle.
+  ElasticPoolOptions elastic;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_WORK_QUEUE_OPTIONS_ */
@@ -0,0 +1,152 @@
+#ifndef ASYNC_CONCURRENT_WORK_QUEUE_STATS_
+#define ASYNC_CONCURRENT_WORK_QUEUE_STATS_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sss {
+namespace async {
+
+// Work queue counters are collected only if the library is built with
+// `ASYNC_WORK_QUEUE_STATS` defined (`--define work_queue_stats=on` in bazel,
+// `-DUSE_WORK_QUEUE_STATS=ON` in cmake). Otherwise all the counters compile to
+// nothing, and a snapshot has only queue depths filled in.
+#if defined(ASYNC_WORK_QUEUE_STATS)
+inline constexpr bool kWorkQueueStatsEnabled = true;
+#else
+inline constexpr bool kWorkQueueStatsEnabled = false;
+#endif
+
+// A snapshot of the work queue counters, returned by
+// HostContext::GetWorkQueueStats(). Counters are updated with relaxed atomics
+// by the worker threads, so a snapshot is not a consistent cut of the queue
+// state, it is only good enough for tuning thread counts and spinning.
+struct WorkQueueStats {
+  struct Worker {
+    uint64_t numTasks = 0;           // executed tasks
+    uint64_t numStealAttempts = 0;   // calls to steal from other queues
+    uint64_t numSteals = 0;          // successful steal attempts
+    uint64_t numRemoteSteals = 0;    // steals from another NUMA node
+    uint64_t numSpinIterations = 0;  // steal attempts in the spin loop
+    uint64_t numParks = 0;           // times the thread parked without work
+    uint64_t numUnparks = 0;         // parked threads notified by this thread
+    size_t queueDepth = 0;           // tasks in the worker queue (estimate)
+  };
+
+  struct Queue {
+    // Worker threads statistics, in the thread id order.
+    std::vector<Worker> workers;
+    // Activity of the threads not managed by the queue: task submission from
+    // free-standing threads, and stealing in Quiesce().
+    Worker external;
+    // Tasks dropped without execution, because their cancellation token was
+    // cancelled or their deadline passed. Always collected.
+    uint64_t numCancelledTasks = 0;
+    // Tasks that kept a worker busy for longer than the blocking call
+    // threshold, see BlockingCallOptions. Always collected.
+    uint64_t numBlockedTasks = 0;
+    // Running worker threads, less than the number of workers if the queue is
+    // elastic. Always collected.
+    size_t numStartedWorkers = 0;
+  };
+
+  // True if the counters are collected, see `kWorkQueueStatsEnabled`.
+  bool enabled = kWorkQueueStatsEnabled;
+
+  Queue nonBlocking;
+  Queue blocking;
+
+  // Non-blocking tasks spilled into the overflow queue because the worker
+  // queue was full. Always collected.
+  uint64_t numOverflowTasks = 0;
+
+  // Blocking tasks executed in the caller thread (quiescing mode), or returned
+  // to the caller, because all the blocking worker queues were full.
+  uint64_t numInlineBlockingTasks = 0;
+  uint64_t numRejectedBlockingTasks = 0;
+
+  // Dynamic threads of the blocking work queue.
+  uint64_t numDynamicThreadsStarted = 0;
+  uint64_t numDynamicTasks = 0;
+  size_t numDynamicThreads = 0;
+  size_t numIdleDynamicThreads = 0;
+};
+
+namespace internal {
+
+enum class WorkerCounter {
+  kTasks,
+  kStealAttempts,
+  kSteals,
+  kRemoteSteals,
+  kSpinIterations,
+  kParks,
+  kUnparks,
+  kNumCounters,
+};
+
+enum class BlockingCounter {
+  kInlineTasks,
+  kRejectedTasks,
+  kDynamicThreadsStarted,
+  kDynamicTasks,
+  kNumCounters,
+};
+
+// StatsCounters is a set of counters indexed by the `CounterEnum` values.
+// Each set is padded to its own cache line, so that worker threads never share
+// a cache line when updating their own counters. Empty if the stats are
+// disabled.
+template <typename CounterEnum>
+class alignas(kWorkQueueStatsEnabled ? 128 : 1) StatsCounters {
+ public:
+  void Add(CounterEnum counter, uint64_t n = 1) {
+#if defined(ASYNC_WORK_QUEUE_STATS)
+    mCounters[static_cast<size_t>(counter)].fetch_add(
+        n, std::memory_order_relaxed);
+#else
+    (void)counter;
+    (void)n;
+#endif
+  }
+
+  uint64_t Get(CounterEnum counter) const {
+#if defined(ASYNC_WORK_QUEUE_STATS)
+    return mCounters[static_cast<size_t>(counter)].load(
+        std::memory_order_relaxed);
+#else
+    (void)counter;
+    return 0;
+#endif
+  }
+
+ private:
+#if defined(ASYNC_WORK_QUEUE_STATS)
+  static constexpr size_t kNumCounters =
+      static_cast<size_t>(CounterEnum::kNumCounters);
+  std::array<std::atomic<uint64_t>, kNumCounters> mCounters{};
+#endif
+};
+
+using WorkerCounters = StatsCounters<WorkerCounter>;
+using BlockingCounters = StatsCounters<BlockingCounter>;
+
+inline void ReadWorkerCounters(const WorkerCounters &counters,
+                               WorkQueueStats::Worker *stats) {
+  stats->numTasks = counters.Get(WorkerCounter::kTasks);
+  stats->numStealAttempts = counters.Get(WorkerCounter::kStealAttempts);
+  stats->numSteals = counters.Get(WorkerCounter::kSteals);
+  stats->numRemoteSteals = counters.Get(WorkerCounter::kRemoteSteals);
+  stats->numSpinIterations = counters.Get(WorkerCounter::kSpinIterations);
+  stats->numParks = counters.Get(WorkerCounter::kParks);
+  stats->numUnparks = counters.Get(WorkerCounter::kUnparks);
+}
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_WORK_QUEUE_STATS_ */
@@ -0,0 +1,63 @@
+#ifndef ASYNC_CONCURRENT_WORKER_AFFINITY_
+#define ASYNC_CONCURRENT_WORKER_AFFINITY_
+
+#include <cassert>
+#include <cstdint>
+
+namespace sss {
+namespace async {
+
+// WorkerAffinity is a hint about which non-blocking worker thread should run a
+// task. The task is pushed into the chosen worker queue instead of the
+// submitter (or a random) queue, so that tasks touching the same per-worker or
+// sharded state run on the same core and find it in its caches. It is only a
+// hint: idle workers are still allowed to steal the task.
+//
+// Example:
+//   // All updates of the shard run on the same worker.
+//   host->EnqueueWork(WorkerAffinity::Key(shard_id), [] { ... });
+class WorkerAffinity {
+ public:
+  // Prefer the worker with the given index (taken modulo the number of
+  // workers, see HostContext::GetNumWorkerThreads()).
+  static WorkerAffinity Worker(unsigned index) {
+    return WorkerAffinity(index, /*is_key=*/false);
+  }
+
+  // Prefer the worker the `key` hashes to. The same key always maps to the
+  // same worker of a queue with the same number of threads.
+  static WorkerAffinity Key(uint64_t key) {
+    return WorkerAffinity(key, /*is_key=*/true);
+  }
+
+  // Returns the preferred worker index in [0, num_workers).
+  unsigned WorkerIndex(unsigned num_workers) const {
+    assert(num_workers > 0);
+    if (!mIsKey) return static_cast<unsigned>(mValue % num_workers);
+    // Keys are often small sequential integers, mix all the bits before the
+    // range reduction.
+    return static_cast<unsigned>(
+        (static_cast<uint64_t>(Mix(mValue) >> 32) * num_workers) >> 32);
+  }
+
+ private:
+  WorkerAffinity(uint64_t value, bool is_key) : mValue(value), mIsKey(is_key) {}
+
+  // SplitMix64 finalizer.
+  static uint64_t Mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+  uint64_t mValue;
+  bool mIsKey;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONCURRENT_WORKER_AFFINITY_ */
@@ -1,8 +1,15 @@
 #include "async/context/async_value.h"
 
+#include <algorithm>
 #include <functional>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
 
+#include "async/context/execution_arena.h"
 #include "async/context/host_context.h"
+#include "async/support/block_cache.h"
 #include "async/support/task_function.h"
 
 namespace sss {
@@ -12,11 +19,45 @@ class NotifierListNode {
   explicit NotifierListNode(unique_function<void()> notification)
       : mNext(nullptr), mNotification(std::move(notification)) {}
 
+  // Nodes are created and destroyed for every waiter, their memory is
+  // recycled through a small per-thread cache instead of the allocator.
+  static NotifierListNode *New(unique_function<void()> &&notification);
+  static void Delete(NotifierListNode *node);
+
+  // Runs and deletes all the nodes of `list`.
+  static void RunAll(NotifierListNode *list);
+
+  // If `list` has more than `threshold` nodes, cuts all but the first
+  // `threshold` nodes off the list and enqueues them to `host`, as tasks of
+  // up to `threshold` nodes each. Returns the remaining list.
+  static NotifierListNode *FanOut(NotifierListNode *list, size_t threshold,
+                                  HostContext *host);
+
  private:
   friend class AsyncValue;
   NotifierListNode *mNext;
   unique_function<void()> mNotification;
 };
+
+namespace {
+
+// Almost every value has a single waiter, which is enqueued by one worker and
+// run by the worker that makes the value available. The node memory then
+// moves between the block caches of the workers.
+using NodeCache = BlockCache<sizeof(NotifierListNode)>;
+
+}  // namespace
+
+NotifierListNode *NotifierListNode::New(
+    unique_function<void()> &&notification) {
+  return new (NodeCache::Allocate()) NotifierListNode(std::move(notification));
+}
+
+void NotifierListNode::Delete(NotifierListNode *node) {
+  node->~NotifierListNode();
+  NodeCache::Deallocate(node);
+}
+
 uint16_t AsyncValue::CreateTypeInfoAndReturnTypeIdImpl(Destructor destructor) {
   TypeInfo typeInfo{destructor};
   size_t typeId = GetTypeInfoTableSingleton()->emplace_back(typeInfo) + 1;
@@ -30,6 +71,26 @@ AsyncValue::TypeInfoTable *AsyncValue::GetTypeInfoTableSingleton() {
   static auto *typeInfoTable = new TypeInfoTable(kInitialCapacity);
   return typeInfoTable;
 }
+
+void AsyncValue::VerifyLayout() {
+  static_assert(sizeof(void *) != 8 || sizeof(AsyncValue) == 16,
+                "The AsyncValue header must be 16 bytes");
+  static_assert(offsetof(AsyncValue, mRefCount) == 0 &&
+                    offsetof(AsyncValue, mHostContext) == 4 &&
+                    offsetof(AsyncValue, mTypeId) == 6,
+                "Unexpected layout of the AsyncValue header");
+  static_assert(sizeof(void *) != 8 ||
+                    offsetof(AsyncValue, mWaitersAndState) == 8,
+                "Unexpected layout of the AsyncValue header");
+  // Values of scalar types, and errors, take 24 bytes.
+  static_assert(sizeof(void *) != 8 ||
+                    (sizeof(internal::ConcreteAsyncValue<int32_t>) == 24 &&
+                     sizeof(internal::ConcreteAsyncValue<int64_t>) == 24 &&
+                     sizeof(internal::ConcreteAsyncValue<double>) == 24 &&
+                     sizeof(internal::ConcreteAsyncValue<void *>) == 24),
+                "Unexpected size of scalar async values");
+}
+
 std::atomic<ssize_t> AsyncValue::total_allocated_async_values_;
 const AsyncValue::TypeInfo &AsyncValue::GetTypeInfo() const {
   TypeInfoTable *typeInfoTable = AsyncValue::GetTypeInfoTableSingleton();
@@ -40,17 +101,231 @@ const AsyncValue::TypeInfo &AsyncValue::GetTypeInfo() const {
   return (*typeInfoTable)[mTypeId - 1];
 }
 void AsyncValue::Destroy() {
+  // Members must not be read after the destructor runs.
+  const bool inArena = mInArena;
+  const bool pooled = mPooled;
+  const uint16_t typeId = mTypeId;
+  void *memory = this;
+  size_t size = 0;
+  if (mBiased) {
+    memory = &GetBiasedRefCount();
+    size = sizeof(internal::BiasedRefCount);
+  }
   if (kind() == Kind::kIndirect) {
     // Depending on what the benchmarks say, it might make sense to remove this
     // explicit check and instead make ~IndirectAsyncValue go through the
     // GetTypeInfo().destructor case below.
     static_cast<IndirectAsyncValue *>(this)->~IndirectAsyncValue();
-    GetHostContext()->DeallocateBytes(this, sizeof(IndirectAsyncValue));
+    size += sizeof(IndirectAsyncValue);
+  } else {
+    size += GetTypeInfo().destructor(this, /*destroys_object=*/true);
+  }
+
+  if (inArena) {
+    ExecutionArena::Free(memory);
+  } else if (pooled) {
+    GetHostContext()->mAsyncValuePool.Deallocate(memory, typeId);
+  } else {
+    GetHostContext()->DeallocateBytes(memory, size);
+  }
+}
+
+namespace {
+
+// The values queued to an owner thread for a merge. `pending` is the
+// biased_merge_pending flag of the owner thread.
+struct OwnerQueue {
+  std::mutex mutex;
+  std::vector<AsyncValue *> values;
+  std::atomic<bool> *pending = nullptr;
+};
+
+// The owner queues of the live threads, by owner tag. Never destroyed, threads
+// may exit after the static destructors ran.
+struct OwnerRegistry {
+  std::mutex mutex;
+  std::unordered_map<uint32_t, OwnerQueue *> queues;
+};
+
+OwnerRegistry &GetOwnerRegistry() {
+  static OwnerRegistry *registry = new OwnerRegistry;
+  return *registry;
+}
+
+// Owner tags are never reused, a stale tag in a merged value or in a value of
+// an exited thread must not match a new thread.
+std::atomic<uint32_t> nextOwnerTag{1};
+
+thread_local bool ownerExited = false;
+
+}  // namespace
+
+// The owner state of a thread that creates biased values.
+class BiasedOwner {
+ public:
+  BiasedOwner() : mTag(nextOwnerTag.fetch_add(1, std::memory_order_relaxed)) {
+    assert(mTag != internal::kNoThreadTag && "Too many owner threads");
+    mQueue.pending = &internal::biased_merge_pending;
+    OwnerRegistry &registry = GetOwnerRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.queues.emplace(mTag, &mQueue);
+    internal::biased_thread_tag = mTag;
+  }
+
+  // The references this thread still owns are merged by the threads that drop
+  // them, after finding no queue for the tag. The registry mutex orders their
+  // reads of the owner counts after the last writes of this thread.
+  ~BiasedOwner() {
+    internal::biased_thread_tag = internal::kNoThreadTag;
+    ownerExited = true;
+    {
+      OwnerRegistry &registry = GetOwnerRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.queues.erase(mTag);
+    }
+    Drain();
+  }
+
+  // Returns nullptr once the thread is exiting.
+  static BiasedOwner *Local() {
+    if (ownerExited) return nullptr;
+    static thread_local BiasedOwner owner;
+    return &owner;
+  }
+
+  uint32_t tag() const { return mTag; }
+
+  void DrainIfPending() {
+    if (mQueue.pending->load(std::memory_order_relaxed)) Drain();
+  }
+
+  // Removes the values of `host` from the queues of all the threads.
+  static std::vector<AsyncValue *> TakeValues(const HostContext *host) {
+    std::vector<AsyncValue *> taken;
+    OwnerRegistry &registry = GetOwnerRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (auto &entry : registry.queues) {
+      OwnerQueue *queue = entry.second;
+      std::lock_guard<std::mutex> queue_lock(queue->mutex);
+      auto kept = std::stable_partition(
+          queue->values.begin(), queue->values.end(),
+          [host](AsyncValue *value) {
+            return value->GetHostContext() != host;
+          });
+      taken.insert(taken.end(), kept, queue->values.end());
+      queue->values.erase(kept, queue->values.end());
+    }
+    return taken;
+  }
+
+  // Queues `value` to the thread with `tag`, returns false if it exited.
+  static bool Queue(uint32_t tag, AsyncValue *value) {
+    OwnerRegistry &registry = GetOwnerRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = registry.queues.find(tag);
+    if (it == registry.queues.end()) return false;
+    OwnerQueue *queue = it->second;
+    std::lock_guard<std::mutex> queue_lock(queue->mutex);
+    queue->values.push_back(value);
+    queue->pending->store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+ private:
+  void Drain() {
+    std::vector<AsyncValue *> values;
+    {
+      std::lock_guard<std::mutex> lock(mQueue.mutex);
+      values.swap(mQueue.values);
+      mQueue.pending->store(false, std::memory_order_relaxed);
+    }
+    for (AsyncValue *value : values) {
+      value->MergeBiasedRefCount(/*drop=*/0, /*queued=*/true);
+    }
+  }
+
+  const uint32_t mTag;
+  OwnerQueue mQueue;
+};
+
+void AsyncValue::MergeQueuedBiasedValues(const HostContext *host) {
+  // Merged outside of the registry lock, destroying a value may queue others.
+  for (AsyncValue *value : BiasedOwner::TakeValues(host)) {
+    value->MergeBiasedRefCount(/*drop=*/0, /*queued=*/true);
+  }
+}
+
+void AsyncValue::MergeQueuedBiasedValues() {
+  if (BiasedOwner *owner = BiasedOwner::Local()) owner->DrainIfPending();
+}
+
+void AsyncValue::InitBiasedRefCount() {
+  using Counts = internal::BiasedRefCount;
+  Counts *counts = new (&GetBiasedRefCount()) Counts;
+  mBiased = true;
+  if (BiasedOwner *owner = BiasedOwner::Local()) {
+    owner->DrainIfPending();
+    counts->owner.store(owner->tag(), std::memory_order_relaxed);
+    counts->biased = 1;
+    mRefCount.store(Counts::kZero, std::memory_order_relaxed);
+  } else {
+    // Created by an exiting thread, the counts start merged.
+    counts->owner.store(Counts::kNoOwner, std::memory_order_relaxed);
+    counts->biased = 0;
+    mRefCount.store(Counts::kMerged | (Counts::kZero + 1),
+                    std::memory_order_relaxed);
+  }
+}
+
+unsigned AsyncValue::NumBiasedCount() const {
+  using Counts = internal::BiasedRefCount;
+  const uint32_t shared = mRefCount.load(std::memory_order_acquire);
+  const int32_t count = Counts::Count(shared);
+  if (IsBiasedOwner()) return GetBiasedRefCount().biased + count;
+  if (shared & Counts::kMerged) return count;
+  return std::max(count, 0) + 2;
+}
+
+void AsyncValue::DropSharedRef(uint32_t count) {
+  using Counts = internal::BiasedRefCount;
+  uint32_t shared =
+      mRefCount.fetch_sub(count, std::memory_order_acq_rel) - count;
+  if (shared & Counts::kMerged) {
+    if (shared == (Counts::kMerged | Counts::kZero)) Destroy();
     return;
   }
+  // The owner holds the references this thread dropped, and can't merge
+  // before the value is queued: it keeps a positive count until then.
+  while (!(shared & Counts::kQueued) && Counts::Count(shared) < 0) {
+    if (mRefCount.compare_exchange_weak(shared, shared | Counts::kQueued,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed)) {
+      const uint32_t owner =
+          GetBiasedRefCount().owner.load(std::memory_order_relaxed);
+      if (!BiasedOwner::Queue(owner, this)) {
+        MergeBiasedRefCount(/*drop=*/0, /*queued=*/true);
+      }
+      return;
+    }
+    assert(!(shared & Counts::kMerged));
+  }
+}
 
-  auto size = GetTypeInfo().destructor(this, /*destroys_object=*/true);
-  GetHostContext()->DeallocateBytes(this, size);
+void AsyncValue::MergeBiasedRefCount(uint32_t drop, bool queued) {
+  using Counts = internal::BiasedRefCount;
+  Counts &counts = GetBiasedRefCount();
+  const uint32_t biased = counts.biased;
+  counts.biased = 0;
+  counts.owner.store(Counts::kNoOwner, std::memory_order_relaxed);
+  uint32_t shared = mRefCount.load(std::memory_order_relaxed);
+  uint32_t merged;
+  do {
+    merged = (shared + biased - drop) | Counts::kMerged;
+    if (queued) merged &= ~Counts::kQueued;
+  } while (!mRefCount.compare_exchange_weak(shared, merged,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_relaxed));
+  if (merged == (Counts::kMerged | Counts::kZero)) Destroy();
 }
 // This is called when the value is set into the ConcreteAsyncValue buffer, or
 // when the IndirectAsyncValue is forwarded to an available AsyncValue, and we
@@ -72,14 +347,47 @@ void AsyncValue::NotifyAvailable(State availableState) {
   RunWaiters(oldValue.getPointer());
 }
 
-void AsyncValue::RunWaiters(NotifierListNode *list) {
-  HostContext *host = GetHostContext();
+void NotifierListNode::RunAll(NotifierListNode *list) {
   while (list) {
     auto *node = list;
     node->mNotification();
     list = node->mNext;
-    host->Destruct(node);
+    Delete(node);
+  }
+}
+
+NotifierListNode *NotifierListNode::FanOut(NotifierListNode *list,
+                                           size_t threshold,
+                                           HostContext *host) {
+  NotifierListNode *last = list;
+  for (size_t i = 1; i < threshold && last->mNext; ++i) last = last->mNext;
+  if (last->mNext == nullptr) return list;
+
+  NotifierListNode *rest = last->mNext;
+  last->mNext = nullptr;
+  std::vector<unique_function<void()>> tasks;
+  while (rest) {
+    NotifierListNode *segment = rest;
+    NotifierListNode *tail = rest;
+    for (size_t i = 1; i < threshold && tail->mNext; ++i) tail = tail->mNext;
+    rest = tail->mNext;
+    tail->mNext = nullptr;
+    tasks.emplace_back([segment]() { RunAll(segment); });
+  }
+  host->EnqueueWorkBatch(absl::MakeSpan(tasks));
+  return list;
+}
+
+void AsyncValue::RunWaiters(NotifierListNode *list) {
+  if (list == nullptr) return;
+  // Above the threshold of the context, the workers take over the waiters
+  // the calling thread doesn't run itself. They are enqueued before the
+  // calling thread starts running its share.
+  const size_t threshold = GetHostContext()->GetWaiterFanOutThreshold();
+  if (threshold != 0) {
+    list = NotifierListNode::FanOut(list, threshold, GetHostContext());
   }
+  NotifierListNode::RunAll(list);
 }
 
 // If the value is available or becomes available, this calls the closure
@@ -88,7 +396,7 @@ void AsyncValue::RunWaiters(NotifierListNode *list) {
 void AsyncValue::EnqueueWaiter(unique_function<void()> &&waiter,
                                WaitersAndState oldValue) {
   // Create the node for our waiter.
-  auto *node = GetHostContext()->Construct<NotifierListNode>(std::move(waiter));
+  auto *node = NotifierListNode::New(std::move(waiter));
   auto old_state = oldValue.getInt();
 
   // Swap the next link in. oldValue.getInt() must be unavailable when
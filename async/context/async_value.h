@@ -1,6 +1,7 @@
 #ifndef ASYNC_CONTEXT_ASYNC_VALUE_
 #define ASYNC_CONTEXT_ASYNC_VALUE_
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstddef>
@@ -25,6 +26,7 @@ namespace internal {
 template <typename T>
 class ConcreteAsyncValue;
 }
+class BiasedOwner;
 class HostContext;
 class NotifierListNode;
 
@@ -33,6 +35,48 @@ namespace internal {
 template <typename T>
 constexpr bool kMaybeBase = std::is_class<T>::value && !std::is_final<T>::value;
 
+// The reference count of the thread that owns an async value with biased
+// reference counting (see HostContext::EnableBiasedRefCount), stored right
+// before the AsyncValue header. The owner thread, the one that created the
+// value, counts its references in `biased` with plain arithmetic. The other
+// threads count theirs in AsyncValue::mRefCount, which then holds:
+//
+//   bit 31      kMerged: the owner merged `biased` into the count, every
+//               thread uses the shared count from then on.
+//   bit 30      kQueued: the value is queued for a merge by its owner.
+//   bits 0-29   the count of the other threads plus kZero. It is negative
+//               when they dropped references the owner added.
+//
+// The owner merges when its count drops to zero. A thread that makes the
+// shared count negative queues the value to the owner, which merges the
+// values of its queue when it next drops a reference to one of its values,
+// creates a biased value, or exits. A value is destroyed by the thread that
+// makes it merged, unqueued and unreferenced.
+struct BiasedRefCount {
+  static constexpr uint32_t kMerged = uint32_t{1} << 31;
+  static constexpr uint32_t kQueued = uint32_t{1} << 30;
+  static constexpr uint32_t kZero = uint32_t{1} << 29;
+  static constexpr uint32_t kCountMask = kQueued - 1;
+
+  // The owner of merged values, no thread has this tag.
+  static constexpr uint32_t kNoOwner = 0;
+
+  static int32_t Count(uint32_t shared) {
+    return static_cast<int32_t>(shared & kCountMask) -
+           static_cast<int32_t>(kZero);
+  }
+
+  std::atomic<uint32_t> owner;
+  uint32_t biased;
+};
+
+// The owner tag of the calling thread, assigned when the thread creates its
+// first biased value. kNoThreadTag never matches an owner.
+constexpr uint32_t kNoThreadTag = ~uint32_t{0};
+inline thread_local uint32_t biased_thread_tag = kNoThreadTag;
+// Set by the threads that queue values to the calling owner thread.
+inline thread_local std::atomic<bool> biased_merge_pending{false};
+
 }  // namespace internal
 
 // This is a future of the specified value type. Arbitrary C++ types may be used
@@ -45,11 +89,28 @@ constexpr bool kMaybeBase = std::is_class<T>::value && !std::is_final<T>::value;
 // The actual payload data is stored in the templated subclass
 // ConcreteAsyncValue. This achieves good cache efficiency by storing the meta
 // data and the payload data in consecutive memory locations.
+//
+// On 64-bit targets the header is 16 bytes:
+//
+//   [0, 4)   mRefCount
+//   [4, 5)   mHostContext (an index into the host context table)
+//   [5, 6)   mKind, mHasVtable, mInArena, mPooled, mBiased
+//   [6, 8)   mTypeId
+//   [8, 16)  mWaitersAndState (the waiter list and the state in one word)
+//
+// and the payload follows at kDataOrErrorOffset. An error is a pointer to an
+// out of line DecodedDiagnostic sharing the storage of the payload, so a value
+// of a scalar type is 24 bytes and payloads up to 48 bytes share the 64-byte
+// cache line of the header when the value starts on one.
 class AsyncValue {
  public:
   ~AsyncValue();
 
-  unsigned NumCount() const { return mRefCount.load(); }
+  // With biased reference counting the count is exact only in the owner
+  // thread, or once merged. Other threads see at least 2.
+  unsigned NumCount() const {
+    return mBiased ? NumBiasedCount() : mRefCount.load();
+  }
 
   // Return true if state is kUnconstructed.
   bool IsUnconstructed() const;
@@ -72,7 +133,7 @@ class AsyncValue {
   bool IsUnresolvedIndirect() const;
 
   // Return true if reference count is 1.
-  bool IsUnique() const { return mRefCount.load() == 1; }
+  bool IsUnique() const { return NumCount() == 1; }
 
   // Add a new reference to this object.
   //
@@ -223,8 +284,11 @@ class AsyncValue {
   // -----------------------------------------------------------
   // Implementation details follow.  Clients should ignore them.
 
+  friend class BiasedOwner;
   friend class HostContext;
   friend class IndirectAsyncValue;
+  template <typename T>
+  friend class AsyncValueRef;
   // Destructor returns the size of the derived AsyncValue to be deallocated.
   // The second bool argument indicates whether to destruct the AsyncValue
   // object or simply destroy the payloads.
@@ -235,6 +299,9 @@ class AsyncValue {
       : mHostContext(host),
         mKind(kind),
         mHasVtable(std::is_polymorphic<T>()),
+        mInArena(false),
+        mPooled(false),
+        mBiased(false),
         mTypeId(GetTypeId<T>()),
         mWaitersAndState(WaitersAndState(nullptr, state)) {
     if (AsyncValueAllocationTrackingEnabled())
@@ -245,6 +312,9 @@ class AsyncValue {
       : mHostContext(host),
         mKind(kind),
         mHasVtable(false),
+        mInArena(false),
+        mPooled(false),
+        mBiased(false),
         mTypeId(0),
         mWaitersAndState(WaitersAndState(nullptr, state)) {
     if (AsyncValueAllocationTrackingEnabled())
@@ -312,9 +382,17 @@ class AsyncValue {
   // use the unused bits here for other purpose in the future, we can move
   // mHasVtable to a global vector<bool> indexed by mTypeId.
   const bool mHasVtable : 1;
+  // Set by HostContext if the value is allocated in an ExecutionArena.
+  bool mInArena : 1;
+  // Set by HostContext if the value memory is recycled by its AsyncValuePool.
+  bool mPooled : 1;
 
-  // Unused padding bits.
-  unsigned unused_ : 5;
+  // Set by HostContext if the value is preceded by an internal::BiasedRefCount.
+  bool mBiased : 1;
+
+  // Unused padding bits. All the bit fields are declared with one-byte types,
+  // MSVC only packs adjacent bit fields of types of the same size.
+  uint8_t unused_ : 2;
 
   // This is a 16-bit value that identifies the type.
   uint16_t mTypeId = 0;
@@ -348,11 +426,7 @@ class AsyncValue {
   /// We assume (and static_assert) that this is the offset of
   /// ConcreteAsyncValue::mData, which is the same as the offset of
   /// ConcreteAsyncValue::mError.
-#ifdef _WIN32
-  static constexpr int kDataOrErrorOffset = 24;
-#else
   static constexpr int kDataOrErrorOffset = 16;
-#endif
 
  private:
   template <typename T>
@@ -380,6 +454,9 @@ class AsyncValue {
                 "We force sizeof(TypeInfo) to be 8 bytes so that x86 complex"
                 "addressing modes can address into TypeInfoTable");
 
+  // Checks the header layout described above, defined in async_value.cpp.
+  static void VerifyLayout();
+
   // Get the TypeInfo instance for this AsyncValue.
   const TypeInfo &GetTypeInfo() const;
 
@@ -391,6 +468,29 @@ class AsyncValue {
   void EnqueueWaiter(unique_function<void()> &&waiter,
                      WaitersAndState oldValue);
 
+  // Biased reference counting, only for values with mBiased set.
+  internal::BiasedRefCount &GetBiasedRefCount() const {
+    return *reinterpret_cast<internal::BiasedRefCount *>(
+        reinterpret_cast<char *>(const_cast<AsyncValue *>(this)) -
+        sizeof(internal::BiasedRefCount));
+  }
+  bool IsBiasedOwner() const {
+    return GetBiasedRefCount().owner.load(std::memory_order_relaxed) ==
+           internal::biased_thread_tag;
+  }
+  // Called by HostContext on a new value preceded by its BiasedRefCount.
+  void InitBiasedRefCount();
+  unsigned NumBiasedCount() const;
+  void DropSharedRef(uint32_t count);
+  // Adds the owner count minus `drop` references to the shared count.
+  // `queued` is set when merging a value of the owner queue.
+  void MergeBiasedRefCount(uint32_t drop, bool queued);
+  // Merges the values of `host` in the queues of all the owner threads, called
+  // when the context is destroyed, after the last references to its values.
+  static void MergeQueuedBiasedValues(const HostContext *host);
+  // Merges the values queued to the calling owner thread.
+  static void MergeQueuedBiasedValues();
+
   /// This is a global counter of the number of AsyncValue instances currently
   /// live in the process.  This is intended to be used for debugging only, and
   /// is only kept in sync if AsyncValueAllocationTrackingEnabled() returns
@@ -507,16 +607,6 @@ class ConcreteAsyncValue : public AsyncValue {
   }
 
   static void VerifyOffsets() {
-#ifdef _WIN32
-    static_assert(offsetof(ConcreteAsyncValue<T>, mData) ==
-                      AsyncValue::kDataOrErrorOffset,
-                  "Offset of ConcreteAsyncValue::mData is assumed to be "
-                  "AsyncValue::kDataOrErrorOffset == 24");
-    static_assert(offsetof(ConcreteAsyncValue<T>, mError) ==
-                      AsyncValue::kDataOrErrorOffset,
-                  "Offset of ConcreteAsyncValue::mError is assumed to be "
-                  "AsyncValue::kDataOrErrorOffset == 24");
-#else
     static_assert(offsetof(ConcreteAsyncValue<T>, mData) ==
                       AsyncValue::kDataOrErrorOffset,
                   "Offset of ConcreteAsyncValue::mData is assumed to be "
@@ -525,7 +615,14 @@ class ConcreteAsyncValue : public AsyncValue {
                       AsyncValue::kDataOrErrorOffset,
                   "Offset of ConcreteAsyncValue::mError is assumed to be "
                   "AsyncValue::kDataOrErrorOffset == 16");
-#endif
+    // Nothing but the payload, or the error pointer, follows the header.
+    constexpr size_t kSize = std::max(sizeof(T), sizeof(DecodedDiagnostic *));
+    constexpr size_t kAlign =
+        std::max(alignof(T), alignof(DecodedDiagnostic *));
+    static_assert(sizeof(ConcreteAsyncValue<T>) ==
+                      AsyncValue::kDataOrErrorOffset +
+                          (kSize + kAlign - 1) / kAlign * kAlign,
+                  "Unexpected padding in ConcreteAsyncValue");
   }
 
   static const uint16_t concrete_type_id_;
@@ -626,6 +723,10 @@ inline bool AsyncValue::IsUnresolvedIndirect() const {
 inline AsyncValue *AsyncValue::AddRef(uint32_t count) {
   if (count > 0) {
     assert(mRefCount.load() > 0);
+    if (mBiased && IsBiasedOwner()) {
+      GetBiasedRefCount().biased += count;
+      return this;
+    }
     // Increasing the reference counter can always be done with
     // memory_order_relaxed: New references to an object can only be formed from
     // an existing reference, and passing an existing reference from one thread
@@ -637,6 +738,23 @@ inline AsyncValue *AsyncValue::AddRef(uint32_t count) {
 
 inline void AsyncValue::DropRef(uint32_t count) {
   assert(mRefCount.load() > 0);
+  if (mBiased) {
+    internal::BiasedRefCount &counts = GetBiasedRefCount();
+    if (!IsBiasedOwner()) {
+      DropSharedRef(count);
+    } else {
+      if (counts.biased > count) {
+        counts.biased -= count;
+      } else {
+        // The owner may also drop references it got from other threads.
+        MergeBiasedRefCount(count, /*queued=*/false);
+      }
+      if (internal::biased_merge_pending.load(std::memory_order_relaxed)) {
+        MergeQueuedBiasedValues();
+      }
+    }
+    return;
+  }
   // We expect that `count` argument will often equal the actual reference count
   // here; optimize for that.
   // If `count` == reference count, only an acquire barrier is needed
@@ -0,0 +1,134 @@
+#include "async/context/async_value_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include <vector>
+
+#include "async/context/host_allocator.h"
+#include "async/support/thread_local.h"
+
+namespace sss {
+namespace async {
+namespace internal {
+
+namespace {
+
+// A thread caches up to this many bytes of free values per type.
+constexpr size_t kMaxCachedBytes = 16 * 1024;
+
+size_t LayoutSize(uint32_t layout) { return layout & 0xffff; }
+size_t LayoutAlignment(uint32_t layout) { return layout >> 16; }
+
+std::atomic<uint64_t> nextPoolId{1};
+
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+struct FreeList {
+  FreeBlock *head = nullptr;
+  unsigned length = 0;
+};
+
+}  // namespace
+
+struct AsyncValuePool::ThreadLists {
+  // Indexed by type id, grown on the first deallocation of a type.
+  std::vector<FreeList> lists;
+};
+
+class AsyncValuePool::PerThreadLists {
+ public:
+  struct NewThreadLists {
+    std::unique_ptr<ThreadLists> Construct() {
+      return std::make_unique<ThreadLists>();
+    }
+  };
+  using Lists = ThreadLocal<std::unique_ptr<ThreadLists>, NewThreadLists>;
+
+  Lists lists{
+      Lists::Capacity(4 * std::max(1u, std::thread::hardware_concurrency()))};
+};
+
+AsyncValuePool::AsyncValuePool(HostAllocator *allocator)
+    : mId(nextPoolId.fetch_add(1, std::memory_order_relaxed)),
+      mAllocator(allocator),
+      mLists(std::make_unique<PerThreadLists>()) {
+  for (std::atomic<uint32_t> &layout : mLayouts) {
+    layout.store(0, std::memory_order_relaxed);
+  }
+}
+
+AsyncValuePool::~AsyncValuePool() {
+  mLists->lists.ForEach([this](std::thread::id, std::unique_ptr<ThreadLists> &local) {
+    for (size_t type_id = 0; type_id < local->lists.size(); ++type_id) {
+      const size_t size =
+          LayoutSize(mLayouts[type_id].load(std::memory_order_relaxed));
+      FreeBlock *block = local->lists[type_id].head;
+      while (block != nullptr) {
+        FreeBlock *next = block->next;
+        mAllocator->DeallocateBytes(block, size);
+        block = next;
+      }
+    }
+  });
+}
+
+bool AsyncValuePool::Enable(uint16_t type_id, size_t size, size_t alignment) {
+  if (type_id >= kMaxTypeId || size > kMaxValueSize) return false;
+  assert(size >= sizeof(FreeBlock) && alignment <= 0xffff);
+  const uint32_t layout =
+      static_cast<uint32_t>(size) | static_cast<uint32_t>(alignment) << 16;
+  mLayouts[type_id].store(layout, std::memory_order_relaxed);
+  return true;
+}
+
+AsyncValuePool::ThreadLists *AsyncValuePool::LocalLists() {
+  // Most threads use the pool of a single host context, remember the last one.
+  struct LastLists {
+    uint64_t poolId = 0;
+    ThreadLists *lists = nullptr;
+  };
+  static thread_local LastLists last;
+  if (last.poolId != mId) {
+    last.lists = mLists->lists.Local().get();
+    last.poolId = mId;
+  }
+  return last.lists;
+}
+
+void *AsyncValuePool::Allocate(uint16_t type_id) {
+  assert(IsEnabled(type_id));
+  std::vector<FreeList> &lists = LocalLists()->lists;
+  if (type_id < lists.size() && lists[type_id].head != nullptr) {
+    FreeList &list = lists[type_id];
+    FreeBlock *block = list.head;
+    list.head = block->next;
+    --list.length;
+    return block;
+  }
+  const uint32_t layout = mLayouts[type_id].load(std::memory_order_relaxed);
+  return mAllocator->AllocateBytes(LayoutSize(layout), LayoutAlignment(layout));
+}
+
+void AsyncValuePool::Deallocate(void *ptr, uint16_t type_id) {
+  assert(IsEnabled(type_id));
+  const size_t size =
+      LayoutSize(mLayouts[type_id].load(std::memory_order_relaxed));
+  std::vector<FreeList> &lists = LocalLists()->lists;
+  if (type_id >= lists.size()) lists.resize(type_id + 1);
+  FreeList &list = lists[type_id];
+  if (list.length * size >= kMaxCachedBytes) {
+    mAllocator->DeallocateBytes(ptr, size);
+    return;
+  }
+  FreeBlock *block = static_cast<FreeBlock *>(ptr);
+  block->next = list.head;
+  list.head = block;
+  ++list.length;
+}
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
@@ -0,0 +1,74 @@
+#ifndef ASYNC_CONTEXT_ASYNC_VALUE_POOL_
+#define ASYNC_CONTEXT_ASYNC_VALUE_POOL_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace sss {
+namespace async {
+
+class HostAllocator;
+
+namespace internal {
+
+// AsyncValuePool recycles the memory of the async values of the types enabled
+// with Enable(), keyed by their type id. Every thread keeps a free list per
+// type: a value destroyed by a thread is reused by the next value of the same
+// type that thread creates, without touching the allocator. A full list
+// returns the blocks to the allocator, and the pool returns all the cached
+// blocks when it is destroyed.
+//
+// A value destroyed by another thread than the one that created it joins the
+// list of the destroying thread. A consumer thread accumulates blocks up to the
+// list limit and returns the rest to the allocator, while the producer thread
+// keeps allocating new ones, the pool pays off for the values that are created
+// and destroyed by the same workers.
+class AsyncValuePool {
+ public:
+  // Only the types with an id below kMaxTypeId, and values up to kMaxValueSize
+  // bytes, can be pooled. Type ids are assigned densely from 1, in the order
+  // of the first use of the types.
+  static constexpr uint16_t kMaxTypeId = 4096;
+  static constexpr size_t kMaxValueSize = 1024;
+
+  explicit AsyncValuePool(HostAllocator *allocator);
+  ~AsyncValuePool();
+  AsyncValuePool(const AsyncValuePool &) = delete;
+  AsyncValuePool &operator=(const AsyncValuePool &) = delete;
+
+  // Enables pooling of the values of `type_id`, which are `size` bytes aligned
+  // to `alignment`. Returns false if the type can't be pooled.
+  bool Enable(uint16_t type_id, size_t size, size_t alignment);
+
+  bool IsEnabled(uint16_t type_id) const {
+    return type_id < kMaxTypeId &&
+           mLayouts[type_id].load(std::memory_order_relaxed) != 0;
+  }
+
+  // Allocate() and Deallocate() can be called only for enabled types.
+  void *Allocate(uint16_t type_id);
+  void Deallocate(void *ptr, uint16_t type_id);
+
+ private:
+  struct ThreadLists;
+  class PerThreadLists;
+
+  ThreadLists *LocalLists();
+
+  // Distinguishes this pool in the per-thread LocalLists() lookup, never
+  // reused.
+  const uint64_t mId;
+  HostAllocator *const mAllocator;
+  // Size in the low and alignment in the high 16 bits, zero if not enabled.
+  std::array<std::atomic<uint32_t>, kMaxTypeId> mLayouts;
+  std::unique_ptr<PerThreadLists> mLists;
+};
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONTEXT_ASYNC_VALUE_POOL_ */
@@ -1,6 +1,8 @@
 #ifndef ASYNC_CONTEXT_ASYNC_VALUE_REF_
 #define ASYNC_CONTEXT_ASYNC_VALUE_REF_
 
+#include <type_traits>
+
 #include "async/context/async_value.h"
 #include "async/context/diagnostic.h"
 #include "async/context/location.h"
@@ -9,6 +11,34 @@
 namespace sss {
 namespace async {
 class ExecutionContext;
+template <typename T>
+class AsyncValueRef;
+
+// Where the continuations of AsyncValueRef::Map and AsyncValueRef::Then run.
+enum class ExecutionPolicy {
+  // In the thread that makes the value available, or in the caller if the
+  // value is already available. For short continuations.
+  kInline,
+  // As non-blocking work of the HostContext of the value.
+  kEnqueue,
+  // As blocking work of the HostContext of the value. The result is set to an
+  // error if the work can't be enqueued.
+  kEnqueueBlocking,
+  // Inline on the worker threads of the HostContext, enqueued as non-blocking
+  // work from any other thread (I/O threads, client threads), which then
+  // never run the continuation themselves.
+  kInlineIfCheap,
+};
+
+namespace internal {
+template <typename T>
+struct AsyncValueRefType {};
+template <typename R>
+struct AsyncValueRefType<AsyncValueRef<R>> {
+  using type = R;
+};
+}  // namespace internal
+
 template <typename T>
 class AsyncValueRef {
  public:
@@ -73,6 +103,24 @@ class AsyncValueRef {
     mValue->AndThen(std::move(waiter));
   }
 
+  // Returns a value with the result of `f(get())` once this value is
+  // available, or with the error of this value. `f` runs according to
+  // `policy`. Defined in host_context.h.
+  //
+  // Example:
+  //   AsyncValueRef<size_t> size = buffer.Map(
+  //       [](Buffer &b) { return b.size(); }, ExecutionPolicy::kInline);
+  template <typename F, typename R = std::invoke_result_t<F, T &>>
+  AsyncValueRef<R> Map(F &&f,
+                       ExecutionPolicy policy = ExecutionPolicy::kInline) const;
+
+  // Same as Map for an asynchronous `f`, which returns an AsyncValueRef<R>.
+  // The returned value forwards to the value returned by `f`.
+  template <typename F, typename R = typename internal::AsyncValueRefType<
+                            std::invoke_result_t<F, T &>>::type>
+  AsyncValueRef<R> Then(
+      F &&f, ExecutionPolicy policy = ExecutionPolicy::kInline) const;
+
   // Return true if this AsyncValueRef represents an error.
   bool IsError() const { return mValue->IsError(); }
 
@@ -119,6 +167,12 @@ class AsyncValueRef {
   RCReference<AsyncValue> ReleaseRCRef() { return std::move(mValue); }
 
  private:
+  // Runs `continuation(source)` when `source` is available, according to
+  // `policy`. `continuation.result` is set to an error if it can't be enqueued.
+  template <typename Continuation>
+  static void RunContinuation(AsyncValue *source, ExecutionPolicy policy,
+                              Continuation continuation);
+
   RCReference<AsyncValue> mValue;
 };
 
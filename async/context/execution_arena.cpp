@@ -0,0 +1,196 @@
+#include "async/context/execution_arena.h"
+
+#include <array>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "async/support/alloc.h"
+
+namespace sss {
+namespace async {
+
+namespace {
+
+// A chunk is open while its arena is alive. The live count of an open chunk is
+// biased by kOpen, so the frees never bring it to zero, and the arena removes
+// the bias minus the number of blocks allocated from the chunk when it is
+// destroyed.
+constexpr int64_t kOpen = int64_t{1} << 62;
+
+constexpr size_t kChunkHeaderSize = 128;
+
+std::atomic<uint64_t> nextArenaId{1};
+std::atomic<int64_t> numLiveChunks{0};
+
+// Chunks released by a thread are kept in a small per-thread cache and reused
+// for the next chunks it needs, most executions then never reach malloc.
+constexpr unsigned kMaxCachedChunks = 16;
+
+struct FreeChunk {
+  FreeChunk *next;
+};
+
+struct ChunkCache {
+  FreeChunk *head = nullptr;
+  unsigned size = 0;
+  bool exited = false;
+};
+thread_local ChunkCache chunk_cache;
+
+// Frees the cached chunks when the thread exits. Chunks released later by the
+// destructors of other thread locals go straight to free().
+struct ChunkCacheReaper {
+  ~ChunkCacheReaper() {
+    chunk_cache.exited = true;
+    while (FreeChunk *chunk = chunk_cache.head) {
+      chunk_cache.head = chunk->next;
+      free(chunk);
+    }
+    chunk_cache.size = 0;
+  }
+};
+
+void *NewChunkMemory() {
+  ChunkCache &cache = chunk_cache;
+  if (FreeChunk *chunk = cache.head) {
+    cache.head = chunk->next;
+    --cache.size;
+    return chunk;
+  }
+  return AlignedAlloc(ExecutionArena::kChunkSize, ExecutionArena::kChunkSize);
+}
+
+void FreeChunkMemory(void *memory) {
+  ChunkCache &cache = chunk_cache;
+  if (cache.exited || cache.size == kMaxCachedChunks) {
+    free(memory);
+    return;
+  }
+  static thread_local ChunkCacheReaper reaper;
+  (void)reaper;
+  FreeChunk *chunk = static_cast<FreeChunk *>(memory);
+  chunk->next = cache.head;
+  cache.head = chunk;
+  ++cache.size;
+}
+
+}  // namespace
+
+struct ExecutionArena::Chunk {
+  std::atomic<int64_t> live;
+  Chunk *next;
+  // Written by the owner thread only, read by the arena destructor. Kept off
+  // the cache line of `live`, which the frees of other threads write to.
+  alignas(64) std::atomic<int64_t> numBlocks;
+};
+
+// The chunk a thread allocates from for one arena. A thread keeps chunks of a
+// few arenas, indexed by the arena id, to run the kernels of concurrent
+// executions without starting a new chunk on every switch. A replaced chunk is
+// simply not filled any further.
+struct ExecutionArena::LocalChunk {
+  uint64_t arenaId = 0;
+  Chunk *chunk = nullptr;
+  char *top = nullptr;
+  char *end = nullptr;
+  int64_t numBlocks = 0;
+};
+
+namespace {
+
+constexpr size_t kNumLocalChunks = 4;
+
+char *AlignUp(char *ptr, size_t alignment) {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+  return reinterpret_cast<char *>((address + alignment - 1) &
+                                  ~(uintptr_t{alignment} - 1));
+}
+
+}  // namespace
+
+void ExecutionArena::ReleaseChunk(Chunk *chunk, int64_t count) {
+  if (chunk->live.fetch_sub(count, std::memory_order_acq_rel) == count) {
+    numLiveChunks.fetch_sub(1, std::memory_order_relaxed);
+    FreeChunkMemory(chunk);
+  }
+}
+
+ExecutionArena::ExecutionArena(HostAllocator *allocator)
+    : mId(nextArenaId.fetch_add(1, std::memory_order_relaxed)),
+      mAllocator(allocator),
+      mChunks(nullptr) {}
+
+ExecutionArena::~ExecutionArena() {
+  Chunk *chunk = mChunks.load(std::memory_order_acquire);
+  while (chunk != nullptr) {
+    Chunk *next = chunk->next;
+    ReleaseChunk(chunk,
+                 kOpen - chunk->numBlocks.load(std::memory_order_relaxed));
+    chunk = next;
+  }
+}
+
+void *ExecutionArena::AllocateBytes(size_t size, size_t alignment) {
+  if (size > kMaxBlockSize) return mAllocator->AllocateBytes(size, alignment);
+  assert(alignment <= kMaxBlockSize && "alignment is too large");
+
+  static thread_local std::array<LocalChunk, kNumLocalChunks> local_chunks;
+  LocalChunk &local = local_chunks[mId % kNumLocalChunks];
+  if (local.arenaId == mId) {
+    char *ptr = AlignUp(local.top, alignment);
+    if (ptr + size <= local.end) {
+      local.top = ptr + size;
+      local.chunk->numBlocks.store(++local.numBlocks,
+                                   std::memory_order_relaxed);
+      return ptr;
+    }
+  }
+  return AllocateFromNewChunk(&local, size, alignment);
+}
+
+void *ExecutionArena::AllocateFromNewChunk(LocalChunk *local, size_t size,
+                                           size_t alignment) {
+  static_assert(sizeof(Chunk) <= kChunkHeaderSize, "chunk header too large");
+  void *memory = NewChunkMemory();
+  if (memory == nullptr) return nullptr;
+  numLiveChunks.fetch_add(1, std::memory_order_relaxed);
+  Chunk *chunk = new (memory) Chunk;
+  chunk->live.store(kOpen, std::memory_order_relaxed);
+  chunk->numBlocks.store(1, std::memory_order_relaxed);
+  chunk->next = mChunks.load(std::memory_order_relaxed);
+  while (!mChunks.compare_exchange_weak(chunk->next, chunk,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+  }
+
+  char *begin = static_cast<char *>(memory);
+  char *ptr = AlignUp(begin + kChunkHeaderSize, alignment);
+  local->arenaId = mId;
+  local->chunk = chunk;
+  local->top = ptr + size;
+  local->end = begin + kChunkSize;
+  local->numBlocks = 1;
+  return ptr;
+}
+
+void ExecutionArena::DeallocateBytes(void *ptr, size_t size) {
+  if (size > kMaxBlockSize) {
+    mAllocator->DeallocateBytes(ptr, size);
+    return;
+  }
+  Free(ptr);
+}
+
+int64_t ExecutionArena::NumLiveChunks() {
+  return numLiveChunks.load(std::memory_order_relaxed);
+}
+
+void ExecutionArena::Free(void *ptr) {
+  Chunk *chunk = reinterpret_cast<Chunk *>(reinterpret_cast<uintptr_t>(ptr) &
+                                           ~(uintptr_t{kChunkSize} - 1));
+  ReleaseChunk(chunk, 1);
+}
+
+}  // namespace async
+}  // namespace sss
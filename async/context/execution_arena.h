@@ -0,0 +1,93 @@
+#ifndef ASYNC_CONTEXT_EXECUTION_ARENA_
+#define ASYNC_CONTEXT_EXECUTION_ARENA_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "async/context/host_allocator.h"
+
+namespace sss {
+namespace async {
+
+// ExecutionArena is a HostAllocator for the transient objects of one execution
+// (a graph run, a request). Small blocks are bump allocated from chunks owned
+// by the allocating thread, so concurrent kernels of one execution don't share
+// any cache line, and freeing a block only decrements the counter of its
+// chunk. Memory is released in bulk: a chunk is released when the arena is
+// destroyed and all of its blocks are freed, and the releasing thread keeps it
+// for its next chunks.
+//
+// Blocks may outlive the arena. A value that escapes the execution keeps its
+// chunk alive until it is freed, the rest of the arena memory is released
+// without waiting for it. Freed blocks are not reused, the arena is meant for
+// executions whose memory is bounded.
+//
+// All the allocations from an arena must happen before its destruction, the
+// owner usually guarantees that with the reference count of the execution.
+class ExecutionArena : public HostAllocator {
+ public:
+  // Allocations up to kMaxBlockSize bytes are served from the chunks, larger
+  // ones by the underlying allocator.
+  static constexpr size_t kChunkSize = 8 * 1024;
+  static constexpr size_t kMaxBlockSize = 1024;
+
+  // Blocks larger than kMaxBlockSize are allocated from `allocator`.
+  explicit ExecutionArena(HostAllocator *allocator);
+  ~ExecutionArena() override;
+
+  void *AllocateBytes(size_t size, size_t alignment) override;
+  void DeallocateBytes(void *ptr, size_t size) override;
+
+  // Frees a block of at most kMaxBlockSize bytes returned by AllocateBytes() of
+  // any arena. Can be called from any thread, also after the arena is
+  // destroyed.
+  static void Free(void *ptr);
+
+  // Returns the number of chunks of all the arenas that are not released yet.
+  static int64_t NumLiveChunks();
+
+  // Makes `arena` the current arena of the calling thread for the lifetime of
+  // the scope. HostContext allocates the async values created in the scope in
+  // the current arena. Scopes can be nested.
+  class Scope {
+   public:
+    explicit Scope(ExecutionArena *arena) : mPrevious(CurrentRef()) {
+      CurrentRef() = arena;
+    }
+    ~Scope() { CurrentRef() = mPrevious; }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+   private:
+    ExecutionArena *mPrevious;
+  };
+
+  // Returns the arena of the innermost Scope of the calling thread, or nullptr.
+  static ExecutionArena *Current() { return CurrentRef(); }
+
+ private:
+  struct Chunk;
+  struct LocalChunk;
+
+  static ExecutionArena *&CurrentRef() {
+    static thread_local ExecutionArena *current = nullptr;
+    return current;
+  }
+
+  // Drops `count` from the live count of `chunk`, and frees the chunk if it
+  // reaches zero.
+  static void ReleaseChunk(Chunk *chunk, int64_t count);
+  void *AllocateFromNewChunk(LocalChunk *local, size_t size, size_t alignment);
+
+  // Distinguishes this arena in the per-thread chunk cache, never reused.
+  const uint64_t mId;
+  HostAllocator *const mAllocator;
+  // All the chunks of the arena, linked through Chunk::next.
+  std::atomic<Chunk *> mChunks;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONTEXT_EXECUTION_ARENA_ */
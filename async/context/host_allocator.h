@@ -1,6 +1,7 @@
 #ifndef INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONTEXT_HOST_ALLOCATOR_
 #define INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONTEXT_HOST_ALLOCATOR_
 
+#include <cstdint>
 #include <memory>
 
 #include "absl/types/span.h"
@@ -31,6 +32,10 @@ class HostAllocator {
   // Deallocate the specified pointer that has the specified size.
   virtual void DeallocateBytes(void *ptr, size_t size) = 0;
 
+  // Returns the total number of allocations made through this allocator, or -1
+  // if the allocator does not count them.
+  virtual int64_t TotalNumAllocations() const { return -1; }
+
  protected:
   friend class HostContext;
   friend class FixedSizeAllocator;
@@ -44,9 +49,19 @@ class HostAllocator {
 };
 
 std::unique_ptr<HostAllocator> CreateMallocAllocator();
+// Allocator with per-thread caches of size class free lists, for the small
+// objects churned by the runtime (async values, notifier nodes, executors).
+// Allocations larger than 4096 bytes, or aligned to more than 4096 bytes, go to
+// malloc. The memory is kept until the allocator is destroyed, and the cache of
+// an exited thread until a new thread gets the same id, so it suits a fixed
+// set of long lived threads.
+std::unique_ptr<HostAllocator> CreateThreadCachingAllocator();
 std::unique_ptr<HostAllocator> CreateFixedSizeAllocator(size_t capacity = 1024);
 std::unique_ptr<HostAllocator> CreateProfiledAllocator(
     std::unique_ptr<HostAllocator> allocator);
+// Returns the total number of allocations made through `allocator`, or -1 if
+// it was not created by CreateProfiledAllocator().
+int64_t GetTotalNumAllocations(const HostAllocator &allocator);
 std::unique_ptr<HostAllocator> CreateLeakCheckAllocator(
     std::unique_ptr<HostAllocator> allocator);
 template <typename ObjectT>
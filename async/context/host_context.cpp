@@ -1,15 +1,20 @@
 #include "host_context.h"
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <mutex>
 #include <thread>
 #include <glog/logging.h>
 
+#include "absl/container/inlined_vector.h"
 #include "async/concurrent/concurrent_work_queue.h"
+#include "async/concurrent/cpu_info.h"
 #include "async/context/chain.h"
 #include "async/context/function.h"
 #include "async/context/host_allocator.h"
 #include "async/context/location.h"
+#include "async/support/block_cache.h"
 #include "async/support/string_util.h"
 
 namespace sss {
@@ -26,6 +31,7 @@ HostContext::HostContext(
     std::unique_ptr<ConcurrentWorkQueue> work_queue)
     : mDiagHandler(std::move(diag_handler)),
       mAllocator(std::move(allocator)),
+      mAsyncValuePool(mAllocator.get()),
       mWorkQueue(std::move(work_queue)),
       mSharedCtxMgr(std::make_unique<SharedContextManager>(this)),
       mInstancePtr(next_host_context_index.fetch_add(1)) {
@@ -38,6 +44,8 @@ HostContext::HostContext(
 HostContext::~HostContext() {
   // Wait for the completion of all async tasks managed by this host context.
   Quiesce();
+  // The owner threads of biased values may not free them before they exit.
+  AsyncValue::MergeQueuedBiasedValues(this);
   // We need to free the ready chain AsyncValue first, as the destructor of the
   // AsyncValue calls the HostContext to free its memory.
   mReadyChain.reset();
@@ -48,7 +56,7 @@ void Function::VtableAnchor() {}
 
 // Construct an empty IndirectAsyncValue, not forwarding to anything.
 RCReference<IndirectAsyncValue> HostContext::MakeIndirectAsyncValue() {
-  return TakeRef(Construct<IndirectAsyncValue>(mInstancePtr));
+  return TakeRef(ConstructAsyncValue<IndirectAsyncValue>(mInstancePtr));
 }
 
 //===----------------------------------------------------------------------===//
@@ -69,7 +77,7 @@ RCReference<ErrorAsyncValue> HostContext::MakeErrorAsyncValueRef(
     DecodedDiagnostic &&diagnostic) {
   // Create an AsyncValue for this error condition.
   auto *error_value =
-      Construct<ErrorAsyncValue>(mInstancePtr, std::move(diagnostic));
+      ConstructAsyncValue<ErrorAsyncValue>(mInstancePtr, std::move(diagnostic));
 
   return TakeRef(error_value);
 }
@@ -130,11 +138,55 @@ void HostContext::Await(absl::Span<const RCReference<AsyncValue>> values) {
   mWorkQueue->Await(values);
 }
 
+bool HostContext::RunPendingWork() { return mWorkQueue->RunPendingTask(); }
+
 // Add some work to the workqueue managed by this CPU device.
 void HostContext::EnqueueWork(unique_function<void()> work) {
   mWorkQueue->AddTask(TaskFunction(std::move(work)));
 }
 
+void HostContext::EnqueueWork(RCReference<CancellationToken> token,
+                              unique_function<void()> work) {
+  mWorkQueue->AddTask(TaskFunction(std::move(work), std::move(token)));
+}
+
+void HostContext::EnqueueWork(std::chrono::steady_clock::time_point deadline,
+                              unique_function<void()> work) {
+  EnqueueWork(CancellationToken::Create(deadline), std::move(work));
+}
+
+void HostContext::EnqueueWork(WorkerAffinity affinity,
+                              unique_function<void()> work) {
+  mWorkQueue->AddTask(TaskFunction(std::move(work)), affinity);
+}
+
+void HostContext::EnqueueWorkBatch(absl::Span<unique_function<void()>> work) {
+  // Tasks are wrapped in a chunk on the stack, large batches are submitted one
+  // chunk at a time.
+  constexpr size_t kBatchChunkSize = 32;
+  std::array<TaskFunction, kBatchChunkSize> tasks;
+  while (!work.empty()) {
+    const size_t n = std::min(work.size(), kBatchChunkSize);
+    for (size_t i = 0; i < n; ++i) {
+      tasks[i] = TaskFunction(std::move(work[i]));
+    }
+    mWorkQueue->AddTasks(absl::MakeSpan(tasks.data(), n));
+    work.remove_prefix(n);
+  }
+}
+
+TimerHandle HostContext::EnqueueWorkAfter(
+    std::chrono::steady_clock::duration delay, unique_function<void()> work) {
+  return EnqueueWorkAt(std::chrono::steady_clock::now() + delay,
+                       std::move(work));
+}
+
+TimerHandle HostContext::EnqueueWorkAt(
+    std::chrono::steady_clock::time_point deadline,
+    unique_function<void()> work) {
+  return mWorkQueue->AddTimer(deadline, TaskFunction(std::move(work)));
+}
+
 // Add some work to the workqueue managed by this CPU device.
 bool HostContext::EnqueueBlockingWork(unique_function<void()> work) {
   std::optional<TaskFunction> task = mWorkQueue->AddBlockingTask(
@@ -142,17 +194,47 @@ bool HostContext::EnqueueBlockingWork(unique_function<void()> work) {
   return !task.has_value();
 }
 
+bool HostContext::EnqueueBlockingWork(RCReference<CancellationToken> token,
+                                      unique_function<void()> work) {
+  std::optional<TaskFunction> task = mWorkQueue->AddBlockingTask(
+      TaskFunction(std::move(work), std::move(token)), /*allow_queuing=*/true);
+  return !task.has_value();
+}
+
 int HostContext::GetNumWorkerThreads() const {
   return mWorkQueue->GetParallelismLevel();
 }
 
+int HostContext::SetNumWorkerThreads(int num_threads) {
+  return mWorkQueue->SetParallelismLevel(num_threads);
+}
+
+WorkQueueStats HostContext::GetWorkQueueStats() const {
+  return mWorkQueue->GetStats();
+}
+
+namespace {
+
+// Shared by the waiters of a multi-input RunWhenReady, the last one to run
+// calls the callee.
+struct CounterAndCallee {
+  std::atomic<size_t> counter;
+  unique_function<void()> callee;
+};
+using CounterCache = BlockCache<sizeof(CounterAndCallee)>;
+
+// RunWhenReady on up to this many inputs keeps its bookkeeping on the stack.
+constexpr size_t kInlineInputs = 8;
+
+}  // namespace
+
 // Run the specified function when the specified set of AsyncValue's are all
 // resolved.  This is a set-version of "AndThen".
 void HostContext::RunWhenReady(absl::Span<AsyncValue *const> values,
                                unique_function<void()> callee) {
   // Perform a quick scan of the arguments.  If they are all available, or if
   // any is already an error, then we can run the callee synchronously.
-  std::vector<AsyncValue *> unavailable_values;
+  absl::InlinedVector<AsyncValue *, kInlineInputs> unavailable_values;
   for (auto i : values) {
     if (!i->IsAvailable()) unavailable_values.push_back(i);
   }
@@ -167,15 +249,10 @@ void HostContext::RunWhenReady(absl::Span<AsyncValue *const> values,
     return;
   }
 
-  struct CounterAndCallee {
-    std::atomic<size_t> counter;
-    unique_function<void()> callee;
-  };
-
-  // Otherwise, we have multiple unavailable values.  Put a counter on the heap
-  // and have each unavailable value decrement and test it.
-  auto *data =
-      new CounterAndCallee{{unavailable_values.size()}, std::move(callee)};
+  // Otherwise, we have multiple unavailable values.  Put a counter in a
+  // recycled block and have each unavailable value decrement and test it.
+  auto *data = new (CounterCache::Allocate())
+      CounterAndCallee{{unavailable_values.size()}, std::move(callee)};
 
   for (auto *val : unavailable_values) {
     val->AndThen([data]() {
@@ -184,14 +261,15 @@ void HostContext::RunWhenReady(absl::Span<AsyncValue *const> values,
 
       // If we are the last one, then run the callee and free the data.
       data->callee();
-      delete data;
+      data->~CounterAndCallee();
+      CounterCache::Deallocate(data);
     });
   }
 }
 
 void HostContext::RunWhenReady(absl::Span<const RCReference<AsyncValue>> values,
                                unique_function<void()> callee) {
-  std::vector<AsyncValue *> values_ptr;
+  absl::InlinedVector<AsyncValue *, kInlineInputs> values_ptr;
   values_ptr.reserve(values.size());
   for (auto &data : values) {
     values_ptr.push_back(data.get());
@@ -200,6 +278,69 @@ void HostContext::RunWhenReady(absl::Span<const RCReference<AsyncValue>> values,
                std::move(callee));
 }
 
+namespace {
+
+// Shared by the waiters of WhenAny, the first one to run sets the result.
+// Allocated by the host allocator, the last waiter frees it.
+struct WhenAnyState : ReferenceCounted<WhenAnyState> {
+  WhenAnyState(HostContext *host, AsyncValueRef<size_t> result,
+               RCReference<CancellationToken> cancel_losers)
+      : host(host),
+        result(std::move(result)),
+        cancelLosers(std::move(cancel_losers)) {}
+
+  void Destroy() { host->Destruct(this); }
+
+  void SetWinner(size_t index) {
+    if (done.exchange(true, std::memory_order_acq_rel)) return;
+    if (cancelLosers) cancelLosers->Cancel();
+    // The other waiters don't touch the result any more.
+    AsyncValueRef<size_t> winner = std::move(result);
+    winner.emplace(index);
+  }
+
+  HostContext *host;
+  std::atomic<bool> done{false};
+  AsyncValueRef<size_t> result;
+  RCReference<CancellationToken> cancelLosers;
+};
+
+}  // namespace
+
+AsyncValueRef<size_t> HostContext::WhenAny(
+    absl::Span<AsyncValue *const> values,
+    RCReference<CancellationToken> cancel_losers) {
+  assert(!values.empty() && "WhenAny needs at least one value");
+  if (values.empty()) {
+    return MakeErrorAsyncValueRef("WhenAny called with no values");
+  }
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (values[i]->IsAvailable()) {
+      if (cancel_losers) cancel_losers->Cancel();
+      return MakeAvailableAsyncValueRef<size_t>(i);
+    }
+  }
+
+  AsyncValueRef<size_t> result = MakeUnconstructedAsyncValueRef<size_t>();
+  auto state = TakeRef(Construct<WhenAnyState>(this, result.CopyRef(),
+                                               std::move(cancel_losers)));
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i]->AndThen(
+        [state = state.CopyRef(), i]() { state->SetWinner(i); });
+  }
+  return result;
+}
+
+AsyncValueRef<size_t> HostContext::WhenAny(
+    absl::Span<const RCReference<AsyncValue>> values,
+    RCReference<CancellationToken> cancel_losers) {
+  absl::InlinedVector<AsyncValue *, kInlineInputs> values_ptr;
+  values_ptr.reserve(values.size());
+  for (auto &value : values) values_ptr.push_back(value.get());
+  return WhenAny(absl::MakeConstSpan(values_ptr.data(), values_ptr.size()),
+                 std::move(cancel_losers));
+}
+
 //===----------------------------------------------------------------------===//
 // SharedContext management
 //===----------------------------------------------------------------------===//
@@ -244,11 +385,16 @@ bool HostContext::IsInWorkerThread() const {
 SharedContext::~SharedContext() {}
 
 std::unique_ptr<HostContext> CreateSimpleHostContext() {
+  // Inside a CPU quota limited container hardware_concurrency() reports all
+  // the host cores, and one worker per core would be throttled.
+  const int numThreads = GetAvailableCpuCount();
+  const int maxNumThreads = std::max(numThreads, GetSchedulableCpuCount());
+  WorkQueueOptions options;
+  options.maxNumThreads = maxNumThreads;
   return std::make_unique<HostContext>(
       [](const DecodedDiagnostic &in) { LOG(INFO) << in.message; },
       CreateMallocAllocator(),
-      CreateMultiThreadedWorkQueue(std::thread::hardware_concurrency(),
-                                   2 * std::thread::hardware_concurrency()));
+      CreateMultiThreadedWorkQueue(numThreads, 2 * numThreads, options));
 }
 
 std::unique_ptr<HostContext> CreateCustomHostContext(int numNonBlockThreads,
@@ -1,12 +1,22 @@
 #ifndef ASYNC_CONTEXT_HOST_CONTEXT_
 #define ASYNC_CONTEXT_HOST_CONTEXT_
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <type_traits>
 
 #include "absl/types/span.h"
+#include "async/concurrent/timer_wheel.h"
+#include "async/concurrent/work_queue_stats.h"
+#include "async/concurrent/worker_affinity.h"
+#include "async/support/cancellation_token.h"
+#include "async/context/async_value_pool.h"
 #include "async/context/async_value_ref.h"
+#include "async/context/execution_arena.h"
 
 namespace sss {
 namespace async {
@@ -19,6 +29,7 @@ class HostAllocator;
 class TypeDescriptor;
 class IndirectAsyncValue;
 class SharedContext;
+class TaskGroup;
 
 class HostContext {
   // Extract result type for EnqueueWork and EnqueueBlockingWork.
@@ -120,6 +131,41 @@ class HostContext {
     Deallocate(t);
   }
 
+  // Recycles the memory of the AsyncValues of type T created by this context
+  // through per-thread pools, instead of freeing it to the allocator. Meant for
+  // the hot payload types (Chain, scalars, small structs). Returns false if T
+  // can't be pooled.
+  template <typename T>
+  bool EnableAsyncValuePool() {
+    using Value = internal::ConcreteAsyncValue<T>;
+    return mAsyncValuePool.Enable(AsyncValue::GetTypeId<T>(), sizeof(Value),
+                                  alignof(Value));
+  }
+
+  // Counts the references to the AsyncValues of type T created by this context
+  // with biased reference counting: the thread that creates a value adds and
+  // drops its references without atomic operations, the other threads count
+  // theirs apart. Pays off for the values mostly referenced by the thread that
+  // created them, like the intermediates of a chain of kernels run inline.
+  //
+  // Each value takes 8 more bytes and is not pooled. A value whose last
+  // reference is dropped by another thread is freed by the creating thread, the
+  // next time it drops a reference to one of its biased values or creates one,
+  // when it exits, or when the context is destroyed. Returns false if T can't
+  // use biased reference counting.
+  template <typename T>
+  bool EnableBiasedRefCount() {
+    const uint16_t type_id = AsyncValue::GetTypeId<T>();
+    if (type_id >= internal::AsyncValuePool::kMaxTypeId ||
+        alignof(internal::ConcreteAsyncValue<T>) >
+            sizeof(internal::BiasedRefCount)) {
+      return false;
+    }
+    mBiasedTypes[type_id / 64].fetch_or(uint64_t{1} << type_id % 64,
+                                        std::memory_order_relaxed);
+    return true;
+  }
+
   // Allocate an unconstructed AsyncValueRef. The AsyncValueRef should be made
   // available later by invoking AsyncValueRef::emplace or
   // AsyncValueRef::SetError.
@@ -157,6 +203,42 @@ class HostContext {
   // Add some non-blocking work to the work_queue managed by this CPU device.
   void EnqueueWork(unique_function<void()> work);
 
+  // Add some non-blocking work to the work_queue managed by this CPU device.
+  // The work is dropped without execution if `token` is cancelled (or its
+  // deadline has passed) before a worker thread picks it up.
+  void EnqueueWork(RCReference<CancellationToken> token,
+                   unique_function<void()> work);
+
+  // Add some non-blocking work to the work_queue managed by this CPU device.
+  // The work is dropped without execution if it is not started by `deadline`.
+  void EnqueueWork(std::chrono::steady_clock::time_point deadline,
+                   unique_function<void()> work);
+
+  // Add some non-blocking work to the work_queue managed by this CPU device,
+  // preferably to be run by the worker thread selected by `affinity` (a worker
+  // index, or a key hashed to a stable worker). Work that shares per-worker or
+  // sharded state should use the same affinity, to keep that state in the
+  // worker's caches. Idle workers still can steal the work.
+  void EnqueueWork(WorkerAffinity affinity, unique_function<void()> work);
+
+  // Add a batch of non-blocking work to the work_queue managed by this CPU
+  // device. Work items are published to the work queue in chunks of a few
+  // dozen, and the worker threads are woken up once per chunk, which is
+  // cheaper than calling EnqueueWork in a loop when many tasks become ready at
+  // once. Work items are moved out of the `work` span.
+  void EnqueueWorkBatch(absl::Span<unique_function<void()>> work);
+
+  // Add some non-blocking work to the work_queue managed by this CPU device
+  // after `delay`, or at `deadline`. Timers have a millisecond resolution and
+  // never fire early. They are serviced by the worker threads themselves, so a
+  // timer can fire late if all the workers are busy with long running work.
+  // The returned handle cancels the work if it has not fired yet. Timers that
+  // are still pending when the HostContext is destroyed are dropped.
+  TimerHandle EnqueueWorkAfter(std::chrono::steady_clock::duration delay,
+                               unique_function<void()> work);
+  TimerHandle EnqueueWorkAt(std::chrono::steady_clock::time_point deadline,
+                            unique_function<void()> work);
+
   // Add some non-blocking work to the work_queue managed by this CPU device.
   // Return AsyncValueRef<R> for work that returns R. R cannot be void.
   //
@@ -170,6 +252,12 @@ class HostContext {
   // Add some blocking work to the work_queue managed by this CPU device.
   bool EnqueueBlockingWork(unique_function<void()> work);
 
+  // Add some blocking work to the work_queue managed by this CPU device. The
+  // work is dropped without execution if `token` is cancelled before it is
+  // started.
+  bool EnqueueBlockingWork(RCReference<CancellationToken> token,
+                           unique_function<void()> work);
+
   // Add some blocking work to the work_queue managed by this CPU device.
   template <typename F, typename R = ResultTypeT<F>,
             std::enable_if_t<!std::is_void<R>(), int> = 0>
@@ -180,6 +268,18 @@ class HostContext {
   // created to handle blocking work (enqueued by EnqueueBlockingWork).
   int GetNumWorkerThreads() const;
 
+  // Grows or shrinks the set of worker threads executing non-blocking work.
+  // Surplus workers are parked, not destroyed, and the set can't grow beyond
+  // the number of threads the work queue was created with (see
+  // CreateMultiThreadedWorkQueue). Returns the new number of worker threads.
+  int SetNumWorkerThreads(int num_threads);
+
+  // Returns a snapshot of the work queue statistics: per-worker task, steal,
+  // spin and park counters, queue depths and blocking threads usage. Counters
+  // are collected only if the library is built with ASYNC_WORK_QUEUE_STATS,
+  // see async/concurrent/work_queue_stats.h.
+  WorkQueueStats GetWorkQueueStats() const;
+
   // Run the specified function when the specified set of AsyncValue's are all
   // resolved.  This is a set-version of "AndThen".
   void RunWhenReady(absl::Span<AsyncValue *const> values,
@@ -187,6 +287,44 @@ class HostContext {
   void RunWhenReady(absl::Span<const RCReference<AsyncValue>> values,
                     unique_function<void()> callee);
 
+  // Returns a value that becomes available with the index of the first of
+  // `values` to become available, with a concrete value or an error. If
+  // several are already available, the lowest index wins. `values` must not
+  // be empty.
+  //
+  // `cancel_losers`, if any, is cancelled as soon as the winner is known, so
+  // the producers of the other values can stop early: they can poll the token,
+  // and their helper work enqueued with the token is dropped. A producer that
+  // stops early must still set its value (usually to an error), the values
+  // can't be destroyed with the pending waiters of WhenAny.
+  //
+  // Example, a hedged request:
+  //   auto token = CancellationToken::Create();
+  //   auto a = host->EnqueueWork([t = token.CopyRef()] { return Get(0, t); });
+  //   auto b = host->EnqueueWork([t = token.CopyRef()] { return Get(1, t); });
+  //   AsyncValueRef<size_t> first = host->WhenAny(
+  //       {a.GetAsyncValue(), b.GetAsyncValue()}, std::move(token));
+  AsyncValueRef<size_t> WhenAny(
+      absl::Span<AsyncValue *const> values,
+      RCReference<CancellationToken> cancel_losers = {});
+  AsyncValueRef<size_t> WhenAny(
+      absl::Span<const RCReference<AsyncValue>> values,
+      RCReference<CancellationToken> cancel_losers = {});
+
+  // Waiters of an AsyncValue (AndThen, RunWhenReady) run in the thread that
+  // makes the value available. When a value of this context with more than
+  // `threshold` waiters becomes available, that thread runs the first
+  // `threshold` waiters and enqueues the rest as non-blocking work, in tasks
+  // of up to `threshold` waiters each, so that a widely consumed value is
+  // consumed in parallel. Zero, the default, runs all the waiters in the
+  // calling thread.
+  void SetWaiterFanOutThreshold(size_t threshold) {
+    mWaiterFanOutThreshold.store(threshold, std::memory_order_relaxed);
+  }
+  size_t GetWaiterFanOutThreshold() const {
+    return mWaiterFanOutThreshold.load(std::memory_order_relaxed);
+  }
+
   //===--------------------------------------------------------------------===//
   // Shared context
   //===--------------------------------------------------------------------===//
@@ -203,7 +341,13 @@ class HostContext {
   // const KernelRegistry& GetKernelRegistry() { return registry_; }
 
  private:
+  friend class AsyncValue;
   friend class HostContextPtr;
+  friend class TaskGroup;
+
+  // Runs one pending non-blocking work item in the caller thread. Returns
+  // false if there is nothing to run.
+  bool RunPendingWork();
 
   // Factory function for creating a SharedContext.
   using SharedContextFactory =
@@ -232,38 +376,98 @@ class HostContext {
   SharedContext &GetOrCreateSharedContext(int shared_context_id,
                                           SharedContextFactory factory);
 
+  // Allocates and constructs an async value, in the ExecutionArena of the
+  // calling thread if there is one.
+  template <typename T, typename... Args>
+  T *ConstructAsyncValue(Args &&...args);
+  // Same for ConcreteAsyncValue<T>, which is taken from the AsyncValuePool if
+  // the pooling of T is enabled and there is no ExecutionArena.
+  template <typename T, typename... Args>
+  internal::ConcreteAsyncValue<T> *ConstructConcreteAsyncValue(
+      Args &&...args);
+
+  bool IsBiasedRefCountEnabled(uint16_t type_id) const {
+    return type_id < internal::AsyncValuePool::kMaxTypeId &&
+           (mBiasedTypes[type_id / 64].load(std::memory_order_relaxed) >>
+                type_id % 64 & 1) != 0;
+  }
+
   std::atomic<AsyncValue *> mCancelValue{nullptr};
+  std::atomic<size_t> mWaiterFanOutThreshold{0};
   // Store a ready chain in HostContext to avoid repeated creations of ready
   // chains on the heap.
   AsyncValueRef<Chain> mReadyChain;
   // KernelRegistry registry_;
   std::function<void(const DecodedDiagnostic &)> mDiagHandler;
   std::unique_ptr<HostAllocator> mAllocator;
+  internal::AsyncValuePool mAsyncValuePool;
+  // A bit per type id, set for the types with biased reference counting.
+  std::array<std::atomic<uint64_t>, internal::AsyncValuePool::kMaxTypeId / 64>
+      mBiasedTypes{};
   std::unique_ptr<ConcurrentWorkQueue> mWorkQueue;
 
   std::unique_ptr<SharedContextManager> mSharedCtxMgr;
   const HostContextPtr mInstancePtr;
 };
 
+template <typename T, typename... Args>
+T *HostContext::ConstructAsyncValue(Args &&...args) {
+  if (sizeof(T) <= ExecutionArena::kMaxBlockSize) {
+    if (ExecutionArena *arena = ExecutionArena::Current()) {
+      T *value = new (arena->Allocate<T>()) T(std::forward<Args>(args)...);
+      static_cast<AsyncValue *>(value)->mInArena = true;
+      return value;
+    }
+  }
+  return Construct<T>(std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+internal::ConcreteAsyncValue<T> *HostContext::ConstructConcreteAsyncValue(
+    Args &&...args) {
+  using Value = internal::ConcreteAsyncValue<T>;
+  const uint16_t type_id = AsyncValue::GetTypeId<T>();
+  if (IsBiasedRefCountEnabled(type_id)) {
+    constexpr size_t kSize = sizeof(internal::BiasedRefCount) + sizeof(Value);
+    ExecutionArena *arena = kSize <= ExecutionArena::kMaxBlockSize
+                                ? ExecutionArena::Current()
+                                : nullptr;
+    char *memory = static_cast<char *>(
+        arena != nullptr ? arena->AllocateBytes(kSize, alignof(Value))
+                         : AllocateBytes(kSize, alignof(Value)));
+    Value *value = new (memory + sizeof(internal::BiasedRefCount))
+        Value(mInstancePtr, std::forward<Args>(args)...);
+    static_cast<AsyncValue *>(value)->mInArena = arena != nullptr;
+    static_cast<AsyncValue *>(value)->InitBiasedRefCount();
+    return value;
+  }
+  if (mAsyncValuePool.IsEnabled(type_id) &&
+      ExecutionArena::Current() == nullptr) {
+    Value *value = new (mAsyncValuePool.Allocate(type_id))
+        Value(mInstancePtr, std::forward<Args>(args)...);
+    static_cast<AsyncValue *>(value)->mPooled = true;
+    return value;
+  }
+  return ConstructAsyncValue<Value>(mInstancePtr, std::forward<Args>(args)...);
+}
+
 template <typename T, typename... Args>
 AsyncValueRef<T> HostContext::MakeConstructedAsyncValueRef(Args &&...args) {
-  return AsyncValueRef<T>(TakeRef(Construct<internal::ConcreteAsyncValue<T>>(
-      mInstancePtr,
+  return AsyncValueRef<T>(TakeRef(ConstructConcreteAsyncValue<T>(
       typename internal::ConcreteAsyncValue<T>::ConstructedPayload{},
       std::forward<Args>(args)...)));
 }
 
 template <typename T, typename... Args>
 AsyncValueRef<T> HostContext::MakeAvailableAsyncValueRef(Args &&...args) {
-  return AsyncValueRef<T>(TakeRef(Construct<internal::ConcreteAsyncValue<T>>(
-      mInstancePtr, typename internal::ConcreteAsyncValue<T>::ConcretePayload{},
+  return AsyncValueRef<T>(TakeRef(ConstructConcreteAsyncValue<T>(
+      typename internal::ConcreteAsyncValue<T>::ConcretePayload{},
       std::forward<Args>(args)...)));
 }
 
 template <typename T>
 AsyncValueRef<T> HostContext::MakeUnconstructedAsyncValueRef() {
-  return AsyncValueRef<T>(TakeRef(Construct<internal::ConcreteAsyncValue<T>>(
-      mInstancePtr,
+  return AsyncValueRef<T>(TakeRef(ConstructConcreteAsyncValue<T>(
       typename internal::ConcreteAsyncValue<T>::UnconstructedPayload{})));
 }
 
@@ -305,11 +509,138 @@ AsyncValueRef<R> HostContext::EnqueueBlockingWork(F &&work) {
   }
   return result;
 }
+
+namespace internal {
+
+// The continuations of AsyncValueRef::Map and AsyncValueRef::Then. They are
+// small, the waiters and the tasks that run them fit in unique_function.
+template <typename T, typename R, typename F>
+struct MapContinuation {
+  void operator()(AsyncValue *source) {
+    if (source->IsError()) {
+      result->SetError(source->GetError());
+      return;
+    }
+    result->emplace<R>(f(source->get<T>()));
+  }
+
+  RCReference<AsyncValue> result;
+  F f;
+};
+
+template <typename T, typename F>
+struct ThenContinuation {
+  void operator()(AsyncValue *source) {
+    auto *indirect = static_cast<IndirectAsyncValue *>(result.get());
+    if (source->IsError()) {
+      indirect->ForwardTo(FormRef(source));
+      return;
+    }
+    indirect->ForwardTo(f(source->get<T>()).ReleaseRCRef());
+  }
+
+  RCReference<AsyncValue> result;
+  F f;
+};
+
+}  // namespace internal
+
+template <typename T>
+template <typename Continuation>
+void AsyncValueRef<T>::RunContinuation(AsyncValue *source,
+                                       ExecutionPolicy policy,
+                                       Continuation continuation) {
+  // Every waiter holds a reference to `source`, the caller may release its own
+  // before `source` becomes available.
+  switch (policy) {
+    case ExecutionPolicy::kInline:
+      source->AndThen(
+          [source = FormRef(source), c = std::move(continuation)]() mutable {
+            c(source.get());
+          });
+      return;
+    case ExecutionPolicy::kEnqueue:
+      source->AndThen([source = FormRef(source),
+                       c = std::move(continuation)]() mutable {
+        HostContext *host = source->GetHostContext();
+        host->EnqueueWork(
+            [source = std::move(source), c = std::move(c)]() mutable {
+              c(source.get());
+            });
+      });
+      return;
+    case ExecutionPolicy::kEnqueueBlocking:
+      source->AndThen([source = FormRef(source),
+                       c = std::move(continuation)]() mutable {
+        RCReference<AsyncValue> result = c.result.CopyRef();
+        HostContext *host = source->GetHostContext();
+        bool enqueued = host->EnqueueBlockingWork(
+            [source = std::move(source), c = std::move(c)]() mutable {
+              c(source.get());
+            });
+        if (!enqueued) {
+          result->SetError(
+              DecodedDiagnostic("Failed to enqueue blocking work."));
+        }
+      });
+      return;
+    case ExecutionPolicy::kInlineIfCheap:
+      source->AndThen([source = FormRef(source),
+                       c = std::move(continuation)]() mutable {
+        HostContext *host = source->GetHostContext();
+        if (host->IsInWorkerThread()) {
+          c(source.get());
+          return;
+        }
+        host->EnqueueWork(
+            [source = std::move(source), c = std::move(c)]() mutable {
+              c(source.get());
+            });
+      });
+      return;
+  }
+}
+
+template <typename T>
+template <typename F, typename R>
+AsyncValueRef<R> AsyncValueRef<T>::Map(F &&f, ExecutionPolicy policy) const {
+  static_assert(!std::is_void<R>::value, "Map needs a result");
+  // Errors are shared with the result, they have no payload.
+  if (mValue->IsError()) return AsyncValueRef<R>(CopyRCRef());
+  HostContext *host = mValue->GetHostContext();
+  if (policy == ExecutionPolicy::kInline && mValue->IsAvailable()) {
+    return host->MakeAvailableAsyncValueRef<R>(f(get()));
+  }
+  AsyncValueRef<R> result = host->MakeUnconstructedAsyncValueRef<R>();
+  RunContinuation(mValue.get(), policy,
+                  internal::MapContinuation<T, R, std::decay_t<F>>{
+                      result.CopyRCRef(), std::forward<F>(f)});
+  return result;
+}
+
+template <typename T>
+template <typename F, typename R>
+AsyncValueRef<R> AsyncValueRef<T>::Then(F &&f, ExecutionPolicy policy) const {
+  if (mValue->IsError()) return AsyncValueRef<R>(CopyRCRef());
+  if (policy == ExecutionPolicy::kInline && mValue->IsAvailable()) {
+    return f(get());
+  }
+  RCReference<IndirectAsyncValue> result =
+      mValue->GetHostContext()->MakeIndirectAsyncValue();
+  RunContinuation(mValue.get(), policy,
+                  internal::ThenContinuation<T, std::decay_t<F>>{
+                      result.CopyRef(), std::forward<F>(f)});
+  return AsyncValueRef<R>(std::move(result));
+}
 class SharedContext {
  public:
   virtual ~SharedContext();
 };
 
+// Creates a HostContext with a worker thread for every CPU available to the
+// process, respecting cgroup CPU quotas and the CPU affinity mask (see
+// GetAvailableCpuCount). It can grow up to the number of schedulable CPUs with
+// SetNumWorkerThreads().
 std::unique_ptr<HostContext> CreateSimpleHostContext();
 std::unique_ptr<HostContext> CreateCustomHostContext(int numNonBlockThreads,
                                                      int numBlockThreads);
@@ -1,3 +1,7 @@
+#include <glog/logging.h>
+
+#include <algorithm>
+
 #include "async/concurrent/blocking_work_queue.h"
 #include "async/concurrent/concurrent_work_queue.h"
 #include "async/concurrent/environment.h"
@@ -9,50 +13,103 @@
 
 namespace sss {
 namespace async {
+namespace {
+
+void LogBlockedWorker(const BlockedWorkerReport &report) {
+  LOG(WARNING) << "Non-blocking worker " << report.worker
+               << " is blocked in task '"
+               << (report.taskName.empty() ? "<unnamed>" : report.taskName)
+               << "' for more than "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(
+                      report.duration)
+                      .count()
+               << "ms"
+               << (report.compensated
+                       ? ", started a compensating worker"
+                       : ", all compensating workers are already running");
+}
+
+WorkQueueOptions WithDefaultReport(WorkQueueOptions options) {
+  if (options.blockingCalls.report == nullptr) {
+    options.blockingCalls.report = LogBlockedWorker;
+  }
+  return options;
+}
+
+}  // namespace
 
 class MultiThreadedWorkQueue : public ConcurrentWorkQueue {
   using ThreadingEnvironment = internal::StdThreadingEnvironment;
 
  public:
-  MultiThreadedWorkQueue(int numThreads, int maxBlockingWorkQueueThread);
+  MultiThreadedWorkQueue(int numThreads, int maxBlockingWorkQueueThread,
+                         const WorkQueueOptions &options);
   ~MultiThreadedWorkQueue() override;
 
   std::string name() const override {
     return StrCat("Multi-threaded C++ work queue (", mNumThreads, " threads)");
   }
 
-  int GetParallelismLevel() const final { return mNumThreads; }
+  int GetParallelismLevel() const final {
+    return mNonBlockingWorkQueue.NumActiveWorkers();
+  }
+  int SetParallelismLevel(int level) final;
 
   void AddTask(TaskFunction task) final;
+  void AddTask(TaskFunction task, WorkerAffinity affinity) final;
+  void AddTasks(absl::Span<TaskFunction> tasks) final;
   std::optional<TaskFunction> AddBlockingTask(TaskFunction task,
                                               bool allow_queuing) final;
+  TimerHandle AddTimer(std::chrono::steady_clock::time_point deadline,
+                       TaskFunction task) final;
   void Quiesce() final;
+  bool RunPendingTask() final;
   void Await(absl::Span<const RCReference<AsyncValue>> values) final;
   bool IsInWorkerThread() const final;
+  WorkQueueStats GetStats() final;
 
  private:
+  // The number of started non-blocking worker threads, the upper bound of the
+  // parallelism level.
   const int mNumThreads;
   std::unique_ptr<internal::QuiescingState> mQuiescingState;
   internal::NonBlockingWorkQueue<ThreadingEnvironment> mNonBlockingWorkQueue;
   internal::BlockingWorkQueue<ThreadingEnvironment> mBlockingWorkQueue;
 };
 
-MultiThreadedWorkQueue::MultiThreadedWorkQueue(int numThreads,
-                                               int maxBlockingWorkQueueThread)
-    : mNumThreads(numThreads),
+MultiThreadedWorkQueue::MultiThreadedWorkQueue(
+    int numThreads, int maxBlockingWorkQueueThread,
+    const WorkQueueOptions &options)
+    : mNumThreads(std::max(numThreads, options.maxNumThreads)),
       mQuiescingState(std::make_unique<internal::QuiescingState>()),
-      mNonBlockingWorkQueue(mQuiescingState.get(), numThreads),
-      mBlockingWorkQueue(mQuiescingState.get(), maxBlockingWorkQueueThread) {}
+      mNonBlockingWorkQueue(mQuiescingState.get(), mNumThreads,
+                            WithDefaultReport(options)),
+      mBlockingWorkQueue(mQuiescingState.get(), maxBlockingWorkQueueThread) {
+  mNonBlockingWorkQueue.SetNumActiveWorkers(numThreads);
+}
 MultiThreadedWorkQueue::~MultiThreadedWorkQueue() {
   // Pending tasks in the underlying queues might submit new tasks to each other
   // during destruction.
   Quiesce();
 }
 
+int MultiThreadedWorkQueue::SetParallelismLevel(int level) {
+  return mNonBlockingWorkQueue.SetNumActiveWorkers(std::max(level, 1));
+}
+
 void MultiThreadedWorkQueue::AddTask(TaskFunction task) {
   mNonBlockingWorkQueue.AddTask(std::move(task));
 }
 
+void MultiThreadedWorkQueue::AddTask(TaskFunction task,
+                                     WorkerAffinity affinity) {
+  mNonBlockingWorkQueue.AddTask(std::move(task), affinity);
+}
+
+void MultiThreadedWorkQueue::AddTasks(absl::Span<TaskFunction> tasks) {
+  mNonBlockingWorkQueue.AddTasks(tasks);
+}
+
 std::optional<TaskFunction> MultiThreadedWorkQueue::AddBlockingTask(
     TaskFunction task, bool allow_queuing) {
   if (allow_queuing) {
@@ -62,6 +119,11 @@ std::optional<TaskFunction> MultiThreadedWorkQueue::AddBlockingTask(
   }
 }
 
+TimerHandle MultiThreadedWorkQueue::AddTimer(
+    std::chrono::steady_clock::time_point deadline, TaskFunction task) {
+  return mNonBlockingWorkQueue.AddTimer(deadline, std::move(task));
+}
+
 void MultiThreadedWorkQueue::Quiesce() {
   // Turn on pending tasks counter inside both work queues.
   auto quiescing = internal::Quiescing::Start(mQuiescingState.get());
@@ -82,6 +144,10 @@ void MultiThreadedWorkQueue::Quiesce() {
   }
 }
 
+bool MultiThreadedWorkQueue::RunPendingTask() {
+  return mNonBlockingWorkQueue.RunPendingTask();
+}
+
 void MultiThreadedWorkQueue::Await(
     absl::Span<const RCReference<AsyncValue>> values) {
   // We might block on a latch waiting for the completion of all tasks, and
@@ -104,11 +170,18 @@ bool MultiThreadedWorkQueue::IsInWorkerThread() const {
   return mNonBlockingWorkQueue.IsInWorkerThread();
 }
 
+WorkQueueStats MultiThreadedWorkQueue::GetStats() {
+  WorkQueueStats stats;
+  mNonBlockingWorkQueue.GetStats(&stats);
+  mBlockingWorkQueue.GetStats(&stats);
+  return stats;
+}
+
 std::unique_ptr<ConcurrentWorkQueue> CreateMultiThreadedWorkQueue(
-    int numThreads, int numBlockingThreads) {
+    int numThreads, int numBlockingThreads, const WorkQueueOptions &options) {
   assert(numThreads > 0 && numBlockingThreads > 0);
   return std::make_unique<MultiThreadedWorkQueue>(numThreads,
-                                                  numBlockingThreads);
+                                                  numBlockingThreads, options);
 }
 
 }  // namespace async
@@ -1,11 +1,14 @@
 #ifndef INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONTEXT_NATIVE_FUNCTION_
 #define INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONTEXT_NATIVE_FUNCTION_
 
+#include <new>
 #include <string_view>
 
+#include "absl/container/inlined_vector.h"
 #include "absl/types/span.h"
 #include "async/context/async_value.h"
 #include "async/context/host_context.h"
+#include "async/support/block_cache.h"
 #include "function.h"
 
 namespace sss {
@@ -46,44 +49,73 @@ class GeneralFunction : public Function {
   GeneralCallable mCallable;
 };
 
-template <typename T>
-void GeneralFunction<T>::Execute(absl::Span<AsyncValue *const> arguments,
-                                 absl::Span<RCReference<AsyncValue>> results,
-                                 HostContext *host) const {
-  std::vector<AsyncValue *> unavailableArgs;
+namespace internal {
+
+// Calls `callable` with `arguments` once they are all available. If some are
+// not, `results` are set to IndirectAsyncValues, which are forwarded to the
+// results of the call. `callable` must outlive the call.
+//
+// The arguments and results of a pending call are kept in a recycled block,
+// so calls with up to kInlineArgs arguments and kInlineResults results don't
+// allocate, and the callback fits in the inline storage of unique_function.
+template <typename Callable>
+void CallWhenReady(const Callable &callable,
+                   absl::Span<AsyncValue *const> arguments,
+                   absl::Span<RCReference<AsyncValue>> results,
+                   HostContext *host) {
+  bool allAvailable = true;
   for (auto *av : arguments) {
-    if (!av->IsAvailable()) unavailableArgs.push_back(av);
+    if (!av->IsAvailable()) {
+      allAvailable = false;
+      break;
+    }
   }
-  if (unavailableArgs.empty()) {
-    mCallable(arguments.data(), arguments.size(), results.data(),
-              results.size(), host);
+  if (allAvailable) {
+    callable(arguments.data(), arguments.size(), results.data(),
+             results.size(), host);
     return;
   }
-  std::vector<RCReference<AsyncValue>> args;
-  args.reserve(arguments.size());
-  for (auto *av : arguments) args.push_back(FormRef(av));
 
-  std::vector<RCReference<IndirectAsyncValue>> indirectResults;
-  indirectResults.reserve(results.size());
+  constexpr size_t kInlineArgs = 8;
+  constexpr size_t kInlineResults = 4;
+  struct PendingCall {
+    absl::InlinedVector<RCReference<AsyncValue>, kInlineArgs> args;
+    absl::InlinedVector<RCReference<IndirectAsyncValue>, kInlineResults>
+        indirectResults;
+  };
+  using CallCache = BlockCache<sizeof(PendingCall)>;
+
+  auto *call = new (CallCache::Allocate()) PendingCall;
+  call->args.reserve(arguments.size());
+  for (auto *av : arguments) call->args.push_back(FormRef(av));
+  call->indirectResults.reserve(results.size());
   for (auto &avRef : results) {
-    indirectResults.push_back(host->MakeIndirectAsyncValue());
-    avRef = indirectResults.back().CopyRef();
+    call->indirectResults.push_back(host->MakeIndirectAsyncValue());
+    avRef = call->indirectResults.back().CopyRef();
   }
-  host->RunWhenReady(unavailableArgs,
-                     [this, host, args = std::move(args),
-                      indirectResults = std::move(indirectResults)]() mutable {
-                       std::vector<AsyncValue *> argAvs;
-                       argAvs.reserve(args.size());
-                       for (const auto &arg : args) argAvs.push_back(arg.get());
-                       std::vector<RCReference<AsyncValue>> results;
-                       results.resize(indirectResults.size());
-                       mCallable(argAvs.data(), argAvs.size(), results.data(),
-                                 results.size(), host);
-                       for (int i = 0, e = results.size(); i != e; ++i) {
-                         assert(results[i]);
-                         indirectResults[i]->ForwardTo(std::move(results[i]));
-                       }
-                     });
+  host->RunWhenReady(arguments, [fn = &callable, host, call]() {
+    absl::InlinedVector<AsyncValue *, kInlineArgs> argAvs;
+    argAvs.reserve(call->args.size());
+    for (const auto &arg : call->args) argAvs.push_back(arg.get());
+    absl::InlinedVector<RCReference<AsyncValue>, kInlineResults> results(
+        call->indirectResults.size());
+    (*fn)(argAvs.data(), argAvs.size(), results.data(), results.size(), host);
+    for (int i = 0, e = results.size(); i != e; ++i) {
+      assert(results[i]);
+      call->indirectResults[i]->ForwardTo(std::move(results[i]));
+    }
+    call->~PendingCall();
+    CallCache::Deallocate(call);
+  });
+}
+
+}  // namespace internal
+
+template <typename T>
+void GeneralFunction<T>::Execute(absl::Span<AsyncValue *const> arguments,
+                                 absl::Span<RCReference<AsyncValue>> results,
+                                 HostContext *host) const {
+  internal::CallWhenReady(mCallable, arguments, results, host);
 }
 
 // 工具类，用于生成最终的Function类别
@@ -39,6 +39,10 @@ class ProfiledAllocator : public HostAllocator {
     mAllocator->DeallocateBytes(ptr, size);
   }
 
+  int64_t TotalNumAllocations() const override {
+    return mCumNumAllocations.load();
+  }
+
  protected:
   void PrintStats() const {
     printf("HostAllocator profile:\n");
@@ -89,5 +93,9 @@ std::unique_ptr<HostAllocator> CreateProfiledAllocator(
       new ProfiledAllocator(std::move(allocator)));
 }
 
+int64_t GetTotalNumAllocations(const HostAllocator &allocator) {
+  return allocator.TotalNumAllocations();
+}
+
 }  // namespace async
 }  // namespace sss
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <optional>
@@ -15,17 +17,31 @@ class SingleThreadedWorkQueue : public ConcurrentWorkQueue {
   SingleThreadedWorkQueue() {}
   std::string name() const override { return "single-threaded"; }
   void AddTask(TaskFunction work) override;
+  void AddTasks(absl::Span<TaskFunction> work) override;
   std::optional<TaskFunction> AddBlockingTask(TaskFunction work,
                                               bool allow_queuing) override;
+  TimerHandle AddTimer(std::chrono::steady_clock::time_point deadline,
+                       TaskFunction work) override;
   void Quiesce() override;
+  bool RunPendingTask() override;
   void Await(absl::Span<const RCReference<AsyncValue>> values) override;
   int GetParallelismLevel() const override { return 1; }
   bool IsInWorkerThread() const final { return false; }
+  WorkQueueStats GetStats() override;
 
  private:
+  // Executes `task` unless it was cancelled before it was dequeued.
+  void RunTask(TaskFunction &task);
+
+  // Moves the tasks of expired timers to `mWorkItems`, `mMu` must be held.
+  void AddExpiredTimersLocked();
+
+  std::atomic<uint64_t> mNumCancelledTasks{0};
   mutable std::mutex mMu;
   std::condition_variable mCv;
   std::vector<TaskFunction> mWorkItems;
+  // Timers are fired by the thread calling Quiesce() or Await().
+  internal::TimerWheel mTimers;
 };
 
 void SingleThreadedWorkQueue::AddTask(TaskFunction work) {
@@ -35,6 +51,13 @@ void SingleThreadedWorkQueue::AddTask(TaskFunction work) {
   }
   mCv.notify_all();
 }
+void SingleThreadedWorkQueue::AddTasks(absl::Span<TaskFunction> work) {
+  {
+    std::lock_guard<std::mutex> l(mMu);
+    for (TaskFunction &task : work) mWorkItems.push_back(std::move(task));
+  }
+  mCv.notify_all();
+}
 std::optional<TaskFunction> SingleThreadedWorkQueue::AddBlockingTask(
     TaskFunction work, bool allow_queuing) {
   if (!allow_queuing) return {std::move(work)};
@@ -46,20 +69,54 @@ std::optional<TaskFunction> SingleThreadedWorkQueue::AddBlockingTask(
   return std::nullopt;
 }
 
+TimerHandle SingleThreadedWorkQueue::AddTimer(
+    std::chrono::steady_clock::time_point deadline, TaskFunction work) {
+  bool earliest = false;
+  TimerHandle handle(mTimers.Schedule(deadline, std::move(work), &earliest));
+  if (earliest) {
+    // Await() might be sleeping until the previous deadline.
+    std::lock_guard<std::mutex> l(mMu);
+    mCv.notify_all();
+  }
+  return handle;
+}
+
+void SingleThreadedWorkQueue::AddExpiredTimersLocked() {
+  if (mTimers.Empty()) return;
+  mTimers.Advance(std::chrono::steady_clock::now(), &mWorkItems);
+}
+
+// Quiesce() runs the timers that are already expired, but does not wait for
+// the ones with a deadline in the future.
 void SingleThreadedWorkQueue::Quiesce() {
   std::vector<TaskFunction> local_work_items;
   while (true) {
     {
       std::lock_guard<std::mutex> l(mMu);
+      AddExpiredTimersLocked();
       if (mWorkItems.empty()) break;
       std::swap(local_work_items, mWorkItems);
     }
     for (auto &item : local_work_items) {
-      item();
+      RunTask(item);
     }
     local_work_items.clear();
   }
 }
+// Runs the most recently added task, nested fork-join work runs depth first.
+bool SingleThreadedWorkQueue::RunPendingTask() {
+  std::optional<TaskFunction> task;
+  {
+    std::lock_guard<std::mutex> l(mMu);
+    AddExpiredTimersLocked();
+    if (mWorkItems.empty()) return false;
+    task = std::move(mWorkItems.back());
+    mWorkItems.pop_back();
+  }
+  RunTask(*task);
+  return true;
+}
+
 void SingleThreadedWorkQueue::Await(
     absl::Span<const RCReference<AsyncValue>> values) {
   int values_remaining = values.size();
@@ -86,15 +143,22 @@ void SingleThreadedWorkQueue::Await(
       local_work_items.clear();
       {
         std::unique_lock<std::mutex> l(mMu);
+        AddExpiredTimersLocked();
         while (no_items_and_values_remaining()) {
-          mCv.wait(l);
+          const auto deadline = mTimers.NextDeadline();
+          if (deadline == std::chrono::steady_clock::time_point::max()) {
+            mCv.wait(l);
+          } else {
+            mCv.wait_until(l, deadline);
+            AddExpiredTimersLocked();
+          }
         }
         if (values_remaining == 0) break;
         std::swap(local_work_items, mWorkItems);
       }
       next_work_item_index = 0;
     }
-    local_work_items[next_work_item_index]();
+    RunTask(local_work_items[next_work_item_index]);
     ++next_work_item_index;
   }
   if (next_work_item_index != local_work_items.size()) {
@@ -106,6 +170,22 @@ void SingleThreadedWorkQueue::Await(
   }
 }
 
+void SingleThreadedWorkQueue::RunTask(TaskFunction &task) {
+  if (task.IsCancelled()) {
+    task.reset();
+    mNumCancelledTasks.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  task();
+}
+
+WorkQueueStats SingleThreadedWorkQueue::GetStats() {
+  WorkQueueStats stats;
+  stats.nonBlocking.numCancelledTasks =
+      mNumCancelledTasks.load(std::memory_order_relaxed);
+  return stats;
+}
+
 std::unique_ptr<ConcurrentWorkQueue> CreateSingleThreadedWorkQueue() {
   return std::make_unique<SingleThreadedWorkQueue>();
 }
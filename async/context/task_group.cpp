@@ -0,0 +1,50 @@
+#include "async/context/task_group.h"
+
+#include <thread>
+
+#include "async/context/host_context.h"
+
+namespace sss {
+namespace async {
+
+TaskGroup::TaskGroup(HostContext *host)
+    : mHost(host), mState(TakeRef(new State())) {}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Run(unique_function<void()> work) {
+  mState->mPending.fetch_add(1, std::memory_order_relaxed);
+  mHost->EnqueueWork([state = mState.CopyRef(), work = std::move(work)]() mutable {
+    work();
+    if (state->mPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> lock(state->mMu);
+      state->mCV.notify_all();
+    }
+  });
+}
+
+void TaskGroup::Wait() {
+  State *state = mState.get();
+  auto done = [state]() {
+    return state->mPending.load(std::memory_order_acquire) == 0;
+  };
+
+  const bool inWorkerThread = mHost->IsInWorkerThread();
+  while (!done()) {
+    if (mHost->RunPendingWork()) continue;
+
+    // The rest of the group is running in other worker threads, and might
+    // still fork work to help with. Blocking a worker here would take it away
+    // from the pool (and deadlock if every worker waits), so it only yields.
+    if (inWorkerThread) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(state->mMu);
+    state->mCV.wait(lock, done);
+  }
+}
+
+}  // namespace async
+}  // namespace sss
@@ -0,0 +1,72 @@
+#ifndef ASYNC_CONTEXT_TASK_GROUP_
+#define ASYNC_CONTEXT_TASK_GROUP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "async/support/ref_count.h"
+#include "async/support/unique_function.h"
+
+namespace sss {
+namespace async {
+
+class HostContext;
+
+// TaskGroup runs non-blocking work on the HostContext work queue, and waits
+// for all of it to complete (fork-join). Unlike HostContext::Await(), Wait()
+// can be called from a worker thread: the waiting thread does not block, it
+// keeps executing pending work (its own queue first, then stolen from other
+// workers) until the group completes. Recursive divide and conquer does not
+// deadlock even with a single worker thread, and no worker sits blocked on a
+// sub-result.
+//
+// Example:
+//   int64_t Sum(HostContext *host, absl::Span<const int> v) {
+//     if (v.size() < kGrain) return std::accumulate(v.begin(), v.end(), 0);
+//     int64_t left, right;
+//     TaskGroup group(host);
+//     group.Run([&]() { left = Sum(host, v.subspan(0, v.size() / 2)); });
+//     right = Sum(host, v.subspan(v.size() / 2));
+//     group.Wait();
+//     return left + right;
+//   }
+//
+// Run() and Wait() can be called from any thread, work added to the group can
+// add more work to the same group. The thread calling Wait() can run work that
+// does not belong to the group.
+class TaskGroup {
+ public:
+  explicit TaskGroup(HostContext *host);
+  // Waits for the work that is still pending.
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  // Adds `work` to the group, and enqueues it to the host context.
+  void Run(unique_function<void()> work);
+
+  // Returns when all the work added to the group so far is completed. Worker
+  // threads help with the pending work, free-standing threads help until
+  // there is nothing to steal, and then block.
+  void Wait();
+
+ private:
+  // Shared with the running work, the last work item to complete must be able
+  // to notify a blocked waiter after the group itself is destroyed.
+  struct State : public ReferenceCounted<State> {
+    std::atomic<int64_t> mPending{0};
+    std::mutex mMu;
+    std::condition_variable mCV;
+  };
+
+  HostContext *mHost;
+  RCReference<State> mState;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_CONTEXT_TASK_GROUP_ */
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "async/context/host_allocator.h"
+#include "async/support/alloc.h"
+#include "async/support/thread_local.h"
+
+namespace sss {
+namespace async {
+
+namespace {
+
+// Allocations up to kMaxSmallSize bytes are rounded up to a size class: 16 byte
+// steps up to 128 bytes, then four classes per power of two. Larger ones go to
+// malloc.
+constexpr size_t kMaxSmallSize = 4096;
+constexpr unsigned kNumClasses = 28;
+
+// Small blocks are carved from spans of one size class. Spans are aligned to
+// their size, the span header is found from a block address.
+constexpr size_t kSpanSize = 64 * 1024;
+constexpr size_t kSpanHeaderSize = 64;
+
+// Free blocks move between the thread caches and the central pool in batches
+// of about this many bytes.
+constexpr size_t kBatchBytes = 8 * 1024;
+
+constexpr size_t ClassSize(unsigned size_class) {
+  if (size_class < 8) return (size_class + 1) * 16;
+  const unsigned octave = (size_class - 8) / 4;
+  const unsigned step = (size_class - 8) % 4 + 1;
+  return (size_t{128} << octave) + step * (size_t{32} << octave);
+}
+static_assert(ClassSize(kNumClasses - 1) == kMaxSmallSize,
+              "the last size class must be kMaxSmallSize");
+
+// Largest power of two dividing `size`, blocks of a class are aligned to it.
+constexpr size_t ClassAlignment(size_t size) { return size & (~size + 1); }
+
+constexpr unsigned ComputeSizeClass(size_t size) {
+  if (size <= 128) return static_cast<unsigned>((size + 15) / 16 - 1);
+  const unsigned octave = 63 - __builtin_clzll(size - 1) - 7;
+  const size_t base = size_t{128} << octave;
+  const size_t step = size_t{32} << octave;
+  return 8 + octave * 4 +
+         static_cast<unsigned>((size - base + step - 1) / step - 1);
+}
+
+// Size classes of the sizes up to kMaxTableSize, indexed by size / 16 rounded
+// up, computed at compile time.
+constexpr size_t kMaxTableSize = 1024;
+struct SizeClassTable {
+  std::array<uint8_t, kMaxTableSize / 16 + 1> sizeClass{};
+  std::array<uint8_t, kNumClasses> batchSize{};
+
+  constexpr SizeClassTable() {
+    for (size_t i = 0; i < sizeClass.size(); ++i) {
+      const size_t size = i == 0 ? 1 : i * 16;
+      sizeClass[i] = static_cast<uint8_t>(ComputeSizeClass(size));
+    }
+    for (unsigned c = 0; c < kNumClasses; ++c) {
+      const size_t batch = kBatchBytes / ClassSize(c);
+      batchSize[c] = static_cast<uint8_t>(std::clamp<size_t>(batch, 4, 64));
+    }
+  }
+};
+constexpr SizeClassTable kTable;
+
+unsigned BatchSize(unsigned size_class) {
+  return kTable.batchSize[size_class];
+}
+
+// Returns the smallest class that fits `size` bytes aligned to `alignment`.
+// Every octave ends with a power of two class, so any alignment up to
+// kMaxSmallSize is found within a few steps.
+unsigned SizeClass(size_t size, size_t alignment) {
+  unsigned size_class = size <= kMaxTableSize
+                            ? kTable.sizeClass[(size + 15) / 16]
+                            : ComputeSizeClass(size);
+  if (alignment > 16) {
+    while (ClassAlignment(ClassSize(size_class)) < alignment) ++size_class;
+  }
+  return size_class;
+}
+
+struct SpanHeader {
+  const void *owner;
+  unsigned sizeClass;
+};
+static_assert(sizeof(SpanHeader) <= kSpanHeaderSize, "span header too large");
+
+SpanHeader *SpanOf(void *ptr) {
+  return reinterpret_cast<SpanHeader *>(reinterpret_cast<uintptr_t>(ptr) &
+                                        ~(uintptr_t{kSpanSize} - 1));
+}
+
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+struct FreeList {
+  FreeBlock *head = nullptr;
+  unsigned length = 0;
+};
+
+struct ThreadCache {
+  std::array<FreeList, kNumClasses> lists;
+};
+
+struct NewThreadCache {
+  std::unique_ptr<ThreadCache> Construct() {
+    return std::make_unique<ThreadCache>();
+  }
+};
+
+std::atomic<uint64_t> nextAllocatorId{1};
+
+}  // namespace
+
+// ThreadCachingAllocator serves small allocations from per-thread free lists of
+// size classes, without any synchronization in the common case. A thread that
+// runs out of blocks of a class takes a batch from the central pool, and a
+// thread that frees more than two batches returns one. Blocks freed by another
+// thread simply join the cache of that thread.
+//
+// Memory of the spans is kept until the allocator is destroyed. The caches of
+// exited threads are reused by threads that get the same thread id.
+class ThreadCachingAllocator : public HostAllocator {
+ public:
+  ThreadCachingAllocator()
+      : mId(nextAllocatorId.fetch_add(1)),
+        mCaches(ThreadLocal<std::unique_ptr<ThreadCache>,
+                            NewThreadCache>::Capacity(
+            4 * std::max(1u, std::thread::hardware_concurrency()))) {}
+
+  ~ThreadCachingAllocator() override {
+    for (void *span : mSpans) free(span);
+  }
+
+  void *AllocateBytes(size_t size, size_t alignment) override {
+    if (size > kMaxSmallSize) return AllocateLarge(size, alignment);
+    // Small blocks never start a span, the span header does. Over-aligned
+    // small blocks are aligned to a span, DeallocateBytes recognizes them.
+    if (alignment > kMaxSmallSize) {
+      return AllocateLarge(size, std::max(alignment, kSpanSize));
+    }
+
+    const unsigned size_class = SizeClass(size, alignment);
+    FreeList &list = LocalCache()->lists[size_class];
+    if (list.head == nullptr && !Refill(size_class, &list)) return nullptr;
+    FreeBlock *block = list.head;
+    list.head = block->next;
+    --list.length;
+    return block;
+  }
+
+  void DeallocateBytes(void *ptr, size_t size) override {
+    if (size > kMaxSmallSize ||
+        (reinterpret_cast<uintptr_t>(ptr) & (kSpanSize - 1)) == 0) {
+      free(ptr);
+      return;
+    }
+    const SpanHeader *span = SpanOf(ptr);
+    assert(span->owner == this && "pointer is not owned by this allocator");
+    const unsigned size_class = span->sizeClass;
+    FreeList &list = LocalCache()->lists[size_class];
+    FreeBlock *block = static_cast<FreeBlock *>(ptr);
+    block->next = list.head;
+    list.head = block;
+    if (++list.length >= 2 * BatchSize(size_class)) Release(size_class, &list);
+  }
+
+ private:
+  static void *AllocateLarge(size_t size, size_t alignment) {
+    if (alignment <= 8) return malloc(size);
+    size = (size + alignment - 1) / alignment * alignment;
+    return AlignedAlloc(alignment, size);
+  }
+
+  ThreadCache *LocalCache() {
+    // Most threads use a single allocator, remember the last one.
+    struct LastCache {
+      uint64_t allocatorId = 0;
+      ThreadCache *cache = nullptr;
+    };
+    static thread_local LastCache last;
+    if (last.allocatorId != mId) {
+      last.cache = mCaches.Local().get();
+      last.allocatorId = mId;
+    }
+    return last.cache;
+  }
+
+  // Fills the empty `list` with a batch from the central pool, or from a new
+  // span. Returns false if out of memory.
+  bool Refill(unsigned size_class, FreeList *list) {
+    Central &central = mCentral[size_class];
+    {
+      std::lock_guard<std::mutex> lock(central.mu);
+      if (!central.batches.empty()) {
+        *list = central.batches.back();
+        central.batches.pop_back();
+        return true;
+      }
+    }
+
+    void *span = AlignedAlloc(kSpanSize, kSpanSize);
+    if (span == nullptr) return false;
+    {
+      std::lock_guard<std::mutex> lock(mSpansMu);
+      mSpans.push_back(span);
+    }
+    SpanHeader *header = static_cast<SpanHeader *>(span);
+    header->owner = this;
+    header->sizeClass = size_class;
+
+    // The first block is aligned like all the others.
+    const size_t block_size = ClassSize(size_class);
+    const size_t first = std::max(kSpanHeaderSize, ClassAlignment(block_size));
+    const size_t num_blocks = (kSpanSize - first) / block_size;
+    char *begin = static_cast<char *>(span) + first;
+
+    // The first batch goes to the caller, the rest to the central pool.
+    const unsigned batch_size = BatchSize(size_class);
+    std::vector<FreeList> batches;
+    for (size_t i = num_blocks; i-- > 0;) {
+      if (batches.empty() || batches.back().length == batch_size) {
+        batches.emplace_back();
+      }
+      FreeList &batch = batches.back();
+      FreeBlock *block = reinterpret_cast<FreeBlock *>(begin + i * block_size);
+      block->next = batch.head;
+      batch.head = block;
+      ++batch.length;
+    }
+    *list = batches.back();
+    batches.pop_back();
+    std::lock_guard<std::mutex> lock(central.mu);
+    central.batches.insert(central.batches.end(), batches.begin(),
+                           batches.end());
+    return true;
+  }
+
+  // Moves one batch from the thread cache `list` to the central pool.
+  void Release(unsigned size_class, FreeList *list) {
+    FreeList batch;
+    batch.head = list->head;
+    batch.length = BatchSize(size_class);
+    FreeBlock *last = batch.head;
+    for (unsigned i = 1; i < batch.length; ++i) last = last->next;
+    list->head = last->next;
+    list->length -= batch.length;
+    last->next = nullptr;
+
+    Central &central = mCentral[size_class];
+    std::lock_guard<std::mutex> lock(central.mu);
+    central.batches.push_back(batch);
+  }
+
+  struct Central {
+    std::mutex mu;
+    std::vector<FreeList> batches;
+  };
+
+  // Distinguishes this allocator in the per-thread LocalCache() lookup, never
+  // reused.
+  const uint64_t mId;
+  ThreadLocal<std::unique_ptr<ThreadCache>, NewThreadCache> mCaches;
+  std::array<Central, kNumClasses> mCentral;
+
+  std::mutex mSpansMu;
+  std::vector<void *> mSpans;
+};
+
+std::unique_ptr<HostAllocator> CreateThreadCachingAllocator() {
+  return std::make_unique<ThreadCachingAllocator>();
+}
+
+}  // namespace async
+}  // namespace sss
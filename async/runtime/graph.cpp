@@ -20,6 +20,7 @@
 #include "async/context/native_function.h"
 #include "async/runtime/proto/graph.pb.h"
 #include "async/runtime/register.h"
+#include "async/support/task_trace_name.h"
 
 namespace sss {
 
@@ -518,16 +519,21 @@ void GraphExecutor::ProcessPseudoKernelUsedBys(
 void GraphExecutor::ProcessReadyKernels(std::vector<unsigned> *readyKernelIdx) {
   CommonAsyncKernelFrame kernelFrame(GetContext());
   while (!readyKernelIdx->empty()) {
-    // 逐个计算已经Ready的相应Kernel
-    for (auto iter = std::next(readyKernelIdx->begin(), 1);
-         iter != readyKernelIdx->end(); ++iter) {
-      unsigned kernelId = *iter;
-      AddRef();
-      GetContext()->EnqueueWork([this, kernelId]() {
-        std::vector<unsigned> readyKernelIdxs = {kernelId};
-        this->ProcessReadyKernels(&readyKernelIdxs);
-        this->DropRef();
-      });
+    // 除第一个之外已经Ready的Kernel打包一次性提交到WorkQueue，只唤醒一次线程
+    if (readyKernelIdx->size() > 1) {
+      std::vector<unique_function<void()>> works;
+      works.reserve(readyKernelIdx->size() - 1);
+      for (auto iter = std::next(readyKernelIdx->begin(), 1);
+           iter != readyKernelIdx->end(); ++iter) {
+        unsigned kernelId = *iter;
+        AddRef();
+        works.emplace_back([this, kernelId]() {
+          std::vector<unsigned> readyKernelIdxs = {kernelId};
+          this->ProcessReadyKernels(&readyKernelIdxs);
+          this->DropRef();
+        });
+      }
+      GetContext()->EnqueueWorkBatch(absl::MakeSpan(works));
     }
     // 对于第一个ready的kernel，在当前函数被计算
     unsigned firstKernelId = readyKernelIdx->front();
@@ -563,6 +569,10 @@ void GraphExecutor::ProcessReadyKernel(
   }
   kernelFrame->SetNumResults(node->GetNumResults());
   if (errorArguments == nullptr) {
+    async::ScopedTaskTraceName traceName(node->mFuncName);
+    // 只在Kernel运行期间启用Arena，避免同一线程上执行的其他任务和回调
+    // 把AsyncValue分配到本Executor的Arena中
+    async::ExecutionArena::Scope arenaScope(&mArena);
     (*node)(kernelFrame);
   } else {
     for (size_t i = 0, e = kernelFrame->GetNumResults(); i != e; ++i) {
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "async/context/async_value.h"
+#include "async/context/execution_arena.h"
 #include "async/context/native_function.h"
 #include "async/runtime/async_kernel.h"
 #include "async/support/ref_count.h"
@@ -108,7 +109,8 @@ class AsyncGraph : public async::ReferenceCounted<AsyncGraph> {
 // 会负责所有Arguments的内存释放和对自身的内存释放
 class GraphExecutor : public async::ReferenceCounted<GraphExecutor> {
  public:
-  GraphExecutor(AsyncGraph *inGraph) : graph(inGraph) {
+  GraphExecutor(AsyncGraph *inGraph)
+      : graph(inGraph), mArena(inGraph->GetContext()->allocator()) {
     graph->AddRef();
     Reset(/*resetFromOri = true*/);
   }
@@ -165,6 +167,8 @@ class GraphExecutor : public async::ReferenceCounted<GraphExecutor> {
   AsyncGraph *graph;
   FunctionInfo mFunctionInfo;  // AsyncValue(use-count),
                                // kernel-info(指示多少Arguments还未Ready)
+  // Kernel执行期间创建的AsyncValue分配在这里，随Executor一起整体释放
+  async::ExecutionArena mArena;
 };
 
 // create a graph executor, caller must be responsible for
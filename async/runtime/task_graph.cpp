@@ -83,15 +83,21 @@ void TaskGraphExecutor::ProcessReadyNodeIndexs(
     std::vector<unsigned> *readyNodeIndex) {
   // 完成队列非空
   while (!readyNodeIndex->empty()) {
-    for (auto iter = std::next(readyNodeIndex->begin(), 1);
-         iter != readyNodeIndex->end(); ++iter) {
-      unsigned kernelId = *iter;
-      AddRef();
-      GetContext()->EnqueueWork([this, kernelId]() {
-        std::vector<unsigned> readyNodeIdxs = {kernelId};
-        this->ProcessReadyNodeIndexs(&readyNodeIdxs);
-        this->DropRef();
-      });
+    // 除第一个之外的ready node打包一次性提交，只唤醒一次线程
+    if (readyNodeIndex->size() > 1) {
+      std::vector<async::unique_function<void()>> works;
+      works.reserve(readyNodeIndex->size() - 1);
+      for (auto iter = std::next(readyNodeIndex->begin(), 1);
+           iter != readyNodeIndex->end(); ++iter) {
+        unsigned kernelId = *iter;
+        AddRef();
+        works.emplace_back([this, kernelId]() {
+          std::vector<unsigned> readyNodeIdxs = {kernelId};
+          this->ProcessReadyNodeIndexs(&readyNodeIdxs);
+          this->DropRef();
+        });
+      }
+      GetContext()->EnqueueWorkBatch(absl::MakeSpan(works));
     }
     unsigned firstNodeId = readyNodeIndex->front();
     readyNodeIndex->clear();
@@ -0,0 +1,81 @@
+#ifndef ASYNC_SUPPORT_BLOCK_CACHE_
+#define ASYNC_SUPPORT_BLOCK_CACHE_
+
+#include <cstddef>
+#include <new>
+
+namespace sss {
+namespace async {
+
+// BlockCache recycles blocks of kSize bytes through a per-thread free list of
+// up to kMaxBlocks blocks, for the small bookkeeping objects the runtime
+// creates and destroys on every wait (waiter nodes, counters). A block freed
+// by a thread is reused by the next allocation of that thread, the global
+// allocator is only used when the list is empty or full. Objects of the same
+// size share their blocks.
+//
+// Blocks are aligned like the memory returned by operator new. The cached
+// blocks are freed when the thread exits.
+template <size_t kSize, unsigned kMaxBlocks = 256>
+class BlockCache {
+ public:
+  static void *Allocate() {
+    Cache &cache = LocalCache();
+    if (FreeBlock *block = cache.head) {
+      cache.head = block->next;
+      --cache.size;
+      return block;
+    }
+    return ::operator new(kSize);
+  }
+
+  static void Deallocate(void *ptr) {
+    Cache &cache = LocalCache();
+    if (cache.exited || cache.size == kMaxBlocks) {
+      ::operator delete(ptr);
+      return;
+    }
+    static thread_local Reaper reaper;
+    (void)reaper;
+    FreeBlock *block = static_cast<FreeBlock *>(ptr);
+    block->next = cache.head;
+    cache.head = block;
+    ++cache.size;
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+  static_assert(kSize >= sizeof(FreeBlock), "blocks are too small");
+
+  struct Cache {
+    FreeBlock *head = nullptr;
+    unsigned size = 0;
+    bool exited = false;
+  };
+
+  // Frees the cached blocks when the thread exits. Blocks released later by
+  // the destructors of other thread locals go straight to operator delete.
+  struct Reaper {
+    ~Reaper() {
+      Cache &cache = LocalCache();
+      cache.exited = true;
+      while (FreeBlock *block = cache.head) {
+        cache.head = block->next;
+        ::operator delete(block);
+      }
+      cache.size = 0;
+    }
+  };
+
+  static Cache &LocalCache() {
+    static thread_local Cache cache;
+    return cache;
+  }
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_SUPPORT_BLOCK_CACHE_ */
@@ -0,0 +1,60 @@
+#ifndef ASYNC_SUPPORT_CANCELLATION_TOKEN_
+#define ASYNC_SUPPORT_CANCELLATION_TOKEN_
+
+#include <atomic>
+#include <chrono>
+
+#include "async/support/ref_count.h"
+
+namespace sss {
+namespace async {
+
+// CancellationToken is shared between the tasks submitted on behalf of a single
+// request (or any other unit of work). Once the token is cancelled, or its
+// deadline has passed, work queues drop the tasks that are still waiting in the
+// queues instead of executing them. Tasks that are already running are not
+// interrupted, they can poll `IsCancelled()` themselves.
+//
+// Example:
+//   RCReference<CancellationToken> token = CancellationToken::Create(
+//       std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+//   host->EnqueueWork(token.CopyRef(), [] { ... });
+//   ...
+//   token->Cancel();  // client went away
+class CancellationToken : public ReferenceCounted<CancellationToken> {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Creates a token without a deadline, it can be only cancelled explicitly.
+  static RCReference<CancellationToken> Create() {
+    return TakeRef(new CancellationToken(Clock::time_point::max()));
+  }
+
+  // Creates a token that is automatically cancelled at `deadline`.
+  static RCReference<CancellationToken> Create(Clock::time_point deadline) {
+    return TakeRef(new CancellationToken(deadline));
+  }
+
+  void Cancel() { mCancelled.store(true, std::memory_order_release); }
+
+  // Returns true if the token was cancelled, or if its deadline has passed.
+  // Reads the clock only for tokens with a deadline.
+  bool IsCancelled() const {
+    if (mCancelled.load(std::memory_order_acquire)) return true;
+    return mDeadline != Clock::time_point::max() && Clock::now() >= mDeadline;
+  }
+
+  Clock::time_point deadline() const { return mDeadline; }
+
+ private:
+  explicit CancellationToken(Clock::time_point deadline)
+      : mCancelled(false), mDeadline(deadline) {}
+
+  std::atomic<bool> mCancelled;
+  const Clock::time_point mDeadline;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_SUPPORT_CANCELLATION_TOKEN_ */
@@ -0,0 +1,78 @@
+#ifndef ASYNC_SUPPORT_FUTEX_
+#define ASYNC_SUPPORT_FUTEX_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Threads blocked in EventCount and latch park on a Linux futex if the library
+// is built with `ASYNC_USE_FUTEX` defined (`--define futex=on` in bazel,
+// `-DUSE_FUTEX=ON` in cmake). A futex wake up is a single syscall, instead of
+// a mutex acquisition plus a condition variable signal on both sides. On other
+// platforms the flag is ignored, and threads park on a mutex and a condition
+// variable.
+#if defined(ASYNC_USE_FUTEX) && defined(__linux__)
+#define ASYNC_FUTEX_PARKING 1
+#endif
+
+#if defined(ASYNC_FUTEX_PARKING)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#endif
+
+namespace sss {
+namespace async {
+namespace internal {
+
+#if defined(ASYNC_FUTEX_PARKING)
+inline constexpr bool kFutexParking = true;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex word must be a plain 32 bit integer");
+
+// Blocks the calling thread while `*word == expected`, until it is woken up by
+// FutexWake, or until `deadline`. Returns false if the deadline has passed.
+// Wake ups can be spurious, callers must re-check their condition.
+inline bool FutexWait(std::atomic<uint32_t> *word, uint32_t expected,
+                      std::chrono::steady_clock::time_point deadline =
+                          std::chrono::steady_clock::time_point::max()) {
+  timespec abs_time;
+  timespec *timeout = nullptr;
+  if (deadline != std::chrono::steady_clock::time_point::max()) {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline, the clock
+    // of std::chrono::steady_clock on Linux.
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        deadline.time_since_epoch())
+                        .count();
+    if (ns <= 0) return false;
+    abs_time.tv_sec = ns / 1000000000;
+    abs_time.tv_nsec = ns % 1000000000;
+    timeout = &abs_time;
+  }
+  const long rc = syscall(SYS_futex, reinterpret_cast<uint32_t *>(word),
+                          FUTEX_WAIT_BITSET_PRIVATE, expected, timeout,
+                          nullptr, FUTEX_BITSET_MATCH_ANY);
+  return !(rc == -1 && errno == ETIMEDOUT);
+}
+
+// Wakes up to `count` threads blocked in FutexWait on `word`. The word might
+// already be destroyed by a woken up thread (e.g. a latch going out of scope),
+// waking a futex on a stale address is harmless.
+inline void FutexWake(std::atomic<uint32_t> *word, int count = INT_MAX) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE_PRIVATE,
+          count, nullptr, nullptr, 0);
+}
+#else
+inline constexpr bool kFutexParking = false;
+#endif
+
+}  // namespace internal
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_SUPPORT_FUTEX_ */
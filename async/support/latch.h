@@ -9,6 +9,8 @@
 #include <cstddef>             // for ptrdiff_t
 #include <mutex>               // for mutex, lock_guard, unique_lock
 
+#include "async/support/futex.h"
+
 namespace sss {
 namespace async {
 
@@ -38,10 +40,17 @@ class latch {
   void arrive_and_wait(uint64_t n = 1);
 
  private:
+#if !defined(ASYNC_FUTEX_PARKING)
   mutable std::mutex mu_;
   mutable std::condition_variable cv_;
+#endif
   mutable std::atomic<uint64_t> state_;
+#if defined(ASYNC_FUTEX_PARKING)
+  // Futex word, set to one when the counter drops to zero with waiters.
+  mutable std::atomic<uint32_t> notified_;
+#else
   bool notified_;
+#endif
 };
 
 inline void latch::add_count(uint64_t n) { state_.fetch_add(n * 2); }
@@ -50,10 +59,16 @@ inline void latch::count_down(uint64_t n) {
   uint64_t state = state_.fetch_sub(n * 2);
   assert((state >> 1) >= n);
   if ((state >> 1) == n && (state & 1) == 1) {
+#if defined(ASYNC_FUTEX_PARKING)
+    assert(notified_.load() == 0);
+    notified_.store(1, std::memory_order_release);
+    internal::FutexWake(&notified_);
+#else
     std::lock_guard<std::mutex> lock(mu_);
     cv_.notify_all();
     assert(!notified_);
     notified_ = true;
+#endif
   }
 }
 inline bool latch::try_wait() const noexcept {
@@ -64,8 +79,14 @@ inline void latch::wait() const {
   uint64_t state = state_.fetch_or(1);
   // Counter already dropped reaches zero
   if ((state >> 1) == 0) return;
+#if defined(ASYNC_FUTEX_PARKING)
+  while (notified_.load(std::memory_order_acquire) == 0) {
+    internal::FutexWait(&notified_, 0);
+  }
+#else
   std::unique_lock<std::mutex> lock(mu_);
   cv_.wait(lock, [this]() { return notified_; });
+#endif
 }
 inline void latch::arrive_and_wait(uint64_t n) {
   count_down(n);
@@ -1,6 +1,8 @@
 #ifndef INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONTEXT_TASK_FUNCTION_
 #define INFERENCE_MEDICAL_COMMON_CPP_ASYNC_CONTEXT_TASK_FUNCTION_
 
+#include "async/support/cancellation_token.h"
+#include "async/support/ref_count.h"
 #include "async/support/unique_function.h"
 
 namespace sss {
@@ -10,17 +12,36 @@ class TaskFunction {
  public:
   explicit TaskFunction(unique_function<void()> work)
       : mFunc(std::move(work)) {}
+  // Work queues drop the task without executing it, if the `token` is
+  // cancelled by the time the task is dequeued.
+  TaskFunction(unique_function<void()> work,
+               RCReference<CancellationToken> token)
+      : mFunc(std::move(work)), mToken(std::move(token)) {}
   TaskFunction(TaskFunction &&) = default;
   TaskFunction() = default;
   void operator()() { mFunc(); }
   TaskFunction &operator=(TaskFunction &&f) = default;
-  void reset() { mFunc = nullptr; }
+  void reset() {
+    mFunc = nullptr;
+    mToken.reset();
+  }
   explicit operator bool() const { return static_cast<bool>(mFunc); }
 
+  // Returns true if the task has a cancellation token, and it was cancelled or
+  // its deadline has passed.
+  bool IsCancelled() const { return mToken && mToken->IsCancelled(); }
+
+  // Releases the cancellation token of the task, used to move the token into
+  // the task that wraps this one.
+  RCReference<CancellationToken> ReleaseCancellationToken() {
+    return std::move(mToken);
+  }
+
  private:
   TaskFunction(const TaskFunction &) = delete;
   TaskFunction &operator=(const TaskFunction &) = delete;
   unique_function<void()> mFunc;
+  RCReference<CancellationToken> mToken;
 };
 
 }  // namespace async
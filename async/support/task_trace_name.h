@@ -0,0 +1,101 @@
+#ifndef ASYNC_SUPPORT_TASK_TRACE_NAME_
+#define ASYNC_SUPPORT_TASK_TRACE_NAME_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace sss {
+namespace async {
+
+// TaskTraceName is the trace name of the task running on a thread. The owner
+// thread sets it, and other threads can read it while the task is running,
+// e.g. the work queue reports the name of a task that blocks a non-blocking
+// worker thread. Names are truncated to `kMaxLength` characters.
+//
+// The name is copied into the per-thread slot under a sequence lock, so the
+// reader never sees a half written name, and the writer never waits.
+class TaskTraceName {
+ public:
+  static constexpr size_t kMaxLength = 63;
+
+  // Returns the slot of the calling thread.
+  static TaskTraceName *ThisThread() {
+    if (TaskTraceName *slot = Redirected()) return slot;
+    static thread_local TaskTraceName name;
+    return &name;
+  }
+
+  // Makes `slot` the slot of the calling thread, nullptr restores the thread
+  // local one. Lets the readers of a thread that may exit, like an elastic
+  // worker, keep a slot that outlives the thread.
+  static void SetThisThread(TaskTraceName *slot) { Redirected() = slot; }
+
+  // Must be called only by the owner thread.
+  void Set(std::string_view name) {
+    std::array<char, kNumWords * sizeof(uint64_t)> bytes{};
+    const size_t length = std::min(name.size(), kMaxLength);
+    std::memcpy(bytes.data(), name.data(), length);
+
+    const uint32_t seq = mSeq.load(std::memory_order_relaxed);
+    mSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kNumWords; ++i) {
+      uint64_t word;
+      std::memcpy(&word, bytes.data() + i * sizeof(uint64_t), sizeof(word));
+      mWords[i].store(word, std::memory_order_relaxed);
+    }
+    mSeq.store(seq + 2, std::memory_order_release);
+  }
+
+  // Can be called by any thread.
+  std::string Get() const {
+    std::array<char, kNumWords * sizeof(uint64_t)> bytes;
+    for (;;) {
+      const uint32_t seq = mSeq.load(std::memory_order_acquire);
+      if (seq & 1) continue;
+      for (size_t i = 0; i < kNumWords; ++i) {
+        const uint64_t word = mWords[i].load(std::memory_order_relaxed);
+        std::memcpy(bytes.data() + i * sizeof(uint64_t), &word, sizeof(word));
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (mSeq.load(std::memory_order_relaxed) == seq) break;
+    }
+    return std::string(bytes.data());
+  }
+
+ private:
+  static TaskTraceName *&Redirected() {
+    static thread_local TaskTraceName *slot = nullptr;
+    return slot;
+  }
+
+  // One extra byte for the terminating zero.
+  static constexpr size_t kNumWords = (kMaxLength + 1) / sizeof(uint64_t);
+
+  std::atomic<uint32_t> mSeq{0};
+  std::array<std::atomic<uint64_t>, kNumWords> mWords{};
+};
+
+// Sets the trace name of the calling thread task for the scope lifetime. The
+// name is cleared at the end of the scope, nested scopes do not restore the
+// outer name.
+class ScopedTaskTraceName {
+ public:
+  explicit ScopedTaskTraceName(std::string_view name) {
+    TaskTraceName::ThisThread()->Set(name);
+  }
+  ~ScopedTaskTraceName() { TaskTraceName::ThisThread()->Set({}); }
+
+  ScopedTaskTraceName(const ScopedTaskTraceName &) = delete;
+  ScopedTaskTraceName &operator=(const ScopedTaskTraceName &) = delete;
+};
+
+}  // namespace async
+}  // namespace sss
+
+#endif /* ASYNC_SUPPORT_TASK_TRACE_NAME_ */
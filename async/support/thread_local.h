@@ -2,6 +2,7 @@
 #define INFERENCE_MEDICAL_COMMON_CPP_ASYNC_SUPPORT_THREAD_LOCAL_
 
 #include <atomic>
+#include <cassert>
 #include <cstddef>
 #include <mutex>
 #include <optional>
@@ -33,10 +34,9 @@ class ThreadLocal {
       : mCapacity(capacity),
         mConstructor(std::forward<Args>(args)...),
         mNumLockFreeEntries(0) {
-    assert(mCapacity >= 0);
     mData.resize(capacity);
     mPtrs = new std::atomic<Entry *>[mCapacity];
-    for (int i = 0; i < mCapacity; ++i) {
+    for (size_t i = 0; i < mCapacity; ++i) {
       mPtrs[i].store(nullptr, std::memory_order_relaxed);
     }
   }
@@ -48,14 +48,14 @@ class ThreadLocal {
     if (mCapacity == 0) return SpilledLocal(this_thread);
 
     size_t h = std::hash<std::thread::id>()(this_thread);
-    const int start_idx = h % mCapacity;
+    const size_t start_idx = h % mCapacity;
 
     // 注意：根据“std:：this_thread:：get_id（）”的定义，
     // 可以保证我们永远不能使用相同的线程id同时调用此函数。
     // 如果在初始遍历期间没有找到条目，则可以保证没有其他人可以同时插入它。
 
     // 检查是否已经拥有了this_thread这个thread
-    int idx = start_idx;
+    size_t idx = start_idx;
     while (mPtrs[idx].load(std::memory_order_acquire) != nullptr) {
       Entry &entry = *(mPtrs[idx].load());
       if (entry.thread_id == this_thread) return entry.value;
@@ -69,15 +69,15 @@ class ThreadLocal {
     if (mNumLockFreeEntries.load(std::memory_order_relaxed) >= mCapacity)
       return SpilledLocal(this_thread);
 
-    int insertionIndex =
+    size_t insertionIndex =
         mNumLockFreeEntries.fetch_add(1, std::memory_order_relaxed);
     if (insertionIndex >= mCapacity) return SpilledLocal(this_thread);
 
     // 保证在没有竞争的情况下去除mData[insertionIndex]
-    mData[insertionIndex] = {this_thread, mConstructor.Construct()};
+    mData[insertionIndex].emplace(Entry{this_thread, mConstructor.Construct()});
 
     // 找到结果指针
-    Entry *inserted = mData[insertionIndex].getPointer();
+    Entry *inserted = &*mData[insertionIndex];
 
     Entry *empty = nullptr;
 
@@ -85,7 +85,7 @@ class ThreadLocal {
     // from the `idx` that was identified as an insertion point above, it's
     // guaranteed that we will have an empty entry somewhere in a lookup table
     // (because we created an entry in the `mData`).
-    const int insertionIdx = idx;
+    const size_t insertionIdx = idx;
 
     do {
       // Always start search from the original insertion candidate.
@@ -109,7 +109,7 @@ class ThreadLocal {
   void ForEach(absl::FunctionRef<void(std::thread::id, T &)> f) {
     // Reading directly from `mData` is unsafe, because only store to the
     // entry in `mPtrs` makes all changes visible to other threads.
-    for (int i = 0; i < mCapacity; ++i) {
+    for (size_t i = 0; i < mCapacity; ++i) {
       Entry *entry = mPtrs[i].load(std::memory_order_acquire);
       if (entry == nullptr) continue;
       f(entry->thread_id, entry->value);
@@ -155,7 +155,7 @@ class ThreadLocal {
   std::atomic<Entry *> *mPtrs;
 
   // Number of entries stored in the lock free storage.
-  std::atomic<int> mNumLockFreeEntries;
+  std::atomic<size_t> mNumLockFreeEntries;
 
   // When the lock-free storage is full we spill to the unordered map
   // synchronized with a mutex. In practice this should never happen, if
@@ -0,0 +1,116 @@
+// HostAllocator implementations under the allocation patterns of the runtime:
+// small objects (async values, notifier nodes) allocated and freed at a high
+// rate from all the worker threads.
+//
+//   AllocFree: allocate and immediately free one block, the best case for
+//              every allocator.
+//   Churn:     every thread keeps a window of live blocks of random sizes, and
+//              replaces a random one on every iteration.
+//   Execution: the transient blocks of one execution, allocated one by one and
+//              freed at the end, from the allocator or from an ExecutionArena.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "async/context/execution_arena.h"
+#include "async/context/host_allocator.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+
+// Allocators are shared by all the benchmark threads, and never destroyed.
+HostAllocator *Malloc() {
+  static HostAllocator *allocator = CreateMallocAllocator().release();
+  return allocator;
+}
+
+HostAllocator *ThreadCaching() {
+  static HostAllocator *allocator = CreateThreadCachingAllocator().release();
+  return allocator;
+}
+
+template <HostAllocator *(*Allocator)()>
+void BM_AllocFree(benchmark::State &state) {
+  HostAllocator *allocator = Allocator();
+  const size_t size = state.range(0);
+  for (auto _ : state) {
+    void *ptr = allocator->AllocateBytes(size, 8);
+    benchmark::DoNotOptimize(ptr);
+    allocator->DeallocateBytes(ptr, size);
+  }
+}
+BENCHMARK_TEMPLATE(BM_AllocFree, Malloc)->Arg(64)->Arg(512);
+BENCHMARK_TEMPLATE(BM_AllocFree, ThreadCaching)->Arg(64)->Arg(512);
+
+template <HostAllocator *(*Allocator)()>
+void BM_Churn(benchmark::State &state) {
+  HostAllocator *allocator = Allocator();
+  std::mt19937 rng(42);
+  struct Block {
+    void *ptr;
+    size_t size;
+  };
+  std::vector<Block> live(256);
+  for (Block &block : live) {
+    block.size = 16 + rng() % 240;
+    block.ptr = allocator->AllocateBytes(block.size, 8);
+  }
+
+  for (auto _ : state) {
+    Block &block = live[rng() % live.size()];
+    allocator->DeallocateBytes(block.ptr, block.size);
+    block.size = 16 + rng() % 240;
+    block.ptr = allocator->AllocateBytes(block.size, 8);
+    benchmark::DoNotOptimize(block.ptr);
+  }
+
+  for (Block &block : live) allocator->DeallocateBytes(block.ptr, block.size);
+}
+BENCHMARK_TEMPLATE(BM_Churn, Malloc)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Churn, ThreadCaching)
+    ->Threads(1)
+    ->Threads(4)
+    ->UseRealTime();
+
+constexpr size_t kExecutionBlockSize = 64;
+
+template <HostAllocator *(*Allocator)()>
+void BM_Execution(benchmark::State &state) {
+  HostAllocator *allocator = Allocator();
+  std::vector<void *> blocks(state.range(0));
+  for (auto _ : state) {
+    for (void *&block : blocks) {
+      block = allocator->AllocateBytes(kExecutionBlockSize, 8);
+    }
+    benchmark::DoNotOptimize(blocks.data());
+    for (void *block : blocks) {
+      allocator->DeallocateBytes(block, kExecutionBlockSize);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * blocks.size());
+}
+BENCHMARK_TEMPLATE(BM_Execution, Malloc)->Arg(16)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Execution, ThreadCaching)->Arg(16)->Arg(256);
+
+void BM_ExecutionArena(benchmark::State &state) {
+  HostAllocator *allocator = ThreadCaching();
+  std::vector<void *> blocks(state.range(0));
+  for (auto _ : state) {
+    ExecutionArena arena(allocator);
+    for (void *&block : blocks) {
+      block = arena.AllocateBytes(kExecutionBlockSize, 8);
+    }
+    benchmark::DoNotOptimize(blocks.data());
+    for (void *block : blocks) ExecutionArena::Free(block);
+  }
+  state.SetItemsProcessed(state.iterations() * blocks.size());
+}
+BENCHMARK(BM_ExecutionArena)->Arg(16)->Arg(256);
+
+}  // namespace
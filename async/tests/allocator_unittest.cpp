@@ -1,4 +1,14 @@
 #include "async/context/host_allocator.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "async/context/execution_arena.h"
 #include "gtest/gtest.h"
 
 namespace sss {
@@ -20,6 +30,227 @@ TEST_F(AllocatorTest, V1) {
   mProfiledAllocator->Deallocate(mem);
 }
 
+TEST_F(AllocatorTest, TotalNumAllocations) {
+  int *mem = mProfiledAllocator->Allocate<int>(4);
+  mProfiledAllocator->Deallocate(mem, 4);
+  mem = mProfiledAllocator->Allocate<int>();
+  EXPECT_EQ(async::GetTotalNumAllocations(*mProfiledAllocator), 2);
+  mProfiledAllocator->Deallocate(mem);
+
+  // Allocators without counters report -1.
+  auto allocator = async::CreateMallocAllocator();
+  EXPECT_EQ(async::GetTotalNumAllocations(*allocator), -1);
+}
+
+TEST(ThreadCachingAllocator, SizesAndAlignment) {
+  auto allocator = async::CreateThreadCachingAllocator();
+  for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+    for (size_t size : {1, 7, 16, 24, 100, 129, 200, 1000, 3000, 4096, 5000,
+                        100000}) {
+      void *ptr = allocator->AllocateBytes(size, alignment);
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignment, 0u)
+          << "size " << size << " alignment " << alignment;
+      std::memset(ptr, 0xab, size);
+      allocator->DeallocateBytes(ptr, size);
+    }
+  }
+}
+
+TEST(ThreadCachingAllocator, OverAlignedSmallBlocks) {
+  auto allocator = async::CreateThreadCachingAllocator();
+  for (size_t alignment : {8192, 65536, 131072}) {
+    for (size_t size : {1, 64, 4096, 5000}) {
+      void *ptr = allocator->AllocateBytes(size, alignment);
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignment, 0u)
+          << "size " << size << " alignment " << alignment;
+      std::memset(ptr, 0xab, size);
+      allocator->DeallocateBytes(ptr, size);
+    }
+  }
+  // Small blocks keep working next to the over-aligned ones.
+  void *small = allocator->AllocateBytes(64, 16);
+  void *aligned = allocator->AllocateBytes(64, 8192);
+  allocator->DeallocateBytes(aligned, 64);
+  allocator->DeallocateBytes(small, 64);
+}
+
+TEST(ThreadCachingAllocator, ReuseBlocks) {
+  auto allocator = async::CreateThreadCachingAllocator();
+  void *ptr = allocator->AllocateBytes(64, 16);
+  allocator->DeallocateBytes(ptr, 64);
+  EXPECT_EQ(allocator->AllocateBytes(64, 16), ptr);
+  allocator->DeallocateBytes(ptr, 64);
+}
+
+TEST(ThreadCachingAllocator, CrossThreadFree) {
+  auto allocator = async::CreateThreadCachingAllocator();
+  constexpr int kNumBlocks = 10000;
+  std::vector<void *> blocks;
+  for (int i = 0; i < kNumBlocks; ++i) {
+    blocks.push_back(allocator->AllocateBytes(48, 16));
+    std::memset(blocks.back(), i & 0xff, 48);
+  }
+  std::thread consumer([&]() {
+    for (void *block : blocks) allocator->DeallocateBytes(block, 48);
+  });
+  consumer.join();
+
+  // Blocks released by the consumer come back through the central pool.
+  std::vector<void *> again;
+  for (int i = 0; i < kNumBlocks; ++i) {
+    again.push_back(allocator->AllocateBytes(48, 16));
+  }
+  for (void *block : again) allocator->DeallocateBytes(block, 48);
+}
+
+TEST(ThreadCachingAllocator, ConcurrentChurn) {
+  auto allocator = async::CreateThreadCachingAllocator();
+  constexpr int kNumThreads = 4;
+  constexpr int kNumIterations = 50000;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      std::vector<std::pair<uint8_t *, size_t>> live(64, {nullptr, 0});
+      for (int i = 0; i < kNumIterations; ++i) {
+        auto &[ptr, size] = live[rng() % live.size()];
+        if (ptr != nullptr) {
+          // The block must not have been handed out to anyone else.
+          for (size_t j = 0; j < size; ++j) {
+            ASSERT_EQ(ptr[j], static_cast<uint8_t>(size));
+          }
+          allocator->DeallocateBytes(ptr, size);
+        }
+        size = 1 + rng() % 512;
+        ptr = static_cast<uint8_t *>(allocator->AllocateBytes(size, 8));
+        std::memset(ptr, static_cast<uint8_t>(size), size);
+      }
+      for (auto &[ptr, size] : live) {
+        if (ptr != nullptr) allocator->DeallocateBytes(ptr, size);
+      }
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+}
+
+// Counts the blocks taken from the underlying allocator.
+class CountingAllocator : public async::HostAllocator {
+ public:
+  void *AllocateBytes(size_t size, size_t alignment) override {
+    mNumAllocated.fetch_add(1);
+    return mAllocator->AllocateBytes(size, alignment);
+  }
+  void DeallocateBytes(void *ptr, size_t size) override {
+    mNumAllocated.fetch_sub(1);
+    mAllocator->DeallocateBytes(ptr, size);
+  }
+  int NumAllocated() const { return mNumAllocated.load(); }
+
+ private:
+  std::unique_ptr<async::HostAllocator> mAllocator =
+      async::CreateMallocAllocator();
+  std::atomic<int> mNumAllocated{0};
+};
+
+TEST(ExecutionArena, BumpAllocation) {
+  CountingAllocator counting;
+  const int64_t chunks = async::ExecutionArena::NumLiveChunks();
+  {
+    async::ExecutionArena arena(&counting);
+    char *first = static_cast<char *>(arena.AllocateBytes(24, 8));
+    char *second = static_cast<char *>(arena.AllocateBytes(40, 8));
+    EXPECT_EQ(second, first + 24);
+    void *aligned = arena.AllocateBytes(64, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0u);
+    EXPECT_EQ(async::ExecutionArena::NumLiveChunks(), chunks + 1);
+
+    // Large blocks go to the underlying allocator.
+    void *large = arena.AllocateBytes(4096, 8);
+    EXPECT_EQ(counting.NumAllocated(), 1);
+    arena.DeallocateBytes(large, 4096);
+    EXPECT_EQ(counting.NumAllocated(), 0);
+
+    arena.DeallocateBytes(first, 24);
+    arena.DeallocateBytes(second, 40);
+    arena.DeallocateBytes(aligned, 64);
+    // Freed blocks are not reused, the chunk is kept until the arena ends.
+    EXPECT_EQ(async::ExecutionArena::NumLiveChunks(), chunks + 1);
+  }
+  EXPECT_EQ(async::ExecutionArena::NumLiveChunks(), chunks);
+}
+
+TEST(ExecutionArena, BlocksOutliveArena) {
+  CountingAllocator counting;
+  const int64_t chunks = async::ExecutionArena::NumLiveChunks();
+  void *escaped = nullptr;
+  {
+    async::ExecutionArena arena(&counting);
+    // Spread the blocks over several chunks, keep one block of the first.
+    for (int i = 0; i < 1000; ++i) {
+      void *ptr = arena.AllocateBytes(64, 16);
+      if (i == 0) {
+        escaped = ptr;
+      } else {
+        arena.DeallocateBytes(ptr, 64);
+      }
+    }
+    EXPECT_GT(async::ExecutionArena::NumLiveChunks(), chunks + 1);
+  }
+  // Only the chunk of the escaped block is left.
+  EXPECT_EQ(async::ExecutionArena::NumLiveChunks(), chunks + 1);
+  std::memset(escaped, 0xab, 64);
+  async::ExecutionArena::Free(escaped);
+  EXPECT_EQ(async::ExecutionArena::NumLiveChunks(), chunks);
+}
+
+TEST(ExecutionArena, ConcurrentAllocationAndFree) {
+  CountingAllocator counting;
+  const int64_t chunks = async::ExecutionArena::NumLiveChunks();
+  constexpr int kNumThreads = 4;
+  constexpr int kNumBlocks = 20000;
+  std::vector<std::vector<uint8_t *>> blocks(kNumThreads);
+  {
+    async::ExecutionArena arena(&counting);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int i = 0; i < kNumBlocks; ++i) {
+          auto *ptr = static_cast<uint8_t *>(arena.AllocateBytes(32, 8));
+          std::memset(ptr, t, 32);
+          blocks[t].push_back(ptr);
+        }
+      });
+    }
+    for (std::thread &thread : threads) thread.join();
+    threads.clear();
+
+    // Every thread frees the blocks of another one, half of them before the
+    // arena is destroyed.
+    for (int t = 0; t < kNumThreads; ++t) {
+      threads.emplace_back([&, t]() {
+        const int owner = (t + 1) % kNumThreads;
+        for (int i = 0; i < kNumBlocks / 2; ++i) {
+          for (int j = 0; j < 32; ++j) {
+            ASSERT_EQ(blocks[owner][i][j], owner);
+          }
+          async::ExecutionArena::Free(blocks[owner][i]);
+        }
+      });
+    }
+    for (std::thread &thread : threads) thread.join();
+  }
+  EXPECT_GT(async::ExecutionArena::NumLiveChunks(), chunks);
+  for (int t = 0; t < kNumThreads; ++t) {
+    for (int i = kNumBlocks / 2; i < kNumBlocks; ++i) {
+      async::ExecutionArena::Free(blocks[t][i]);
+    }
+  }
+  EXPECT_EQ(async::ExecutionArena::NumLiveChunks(), chunks);
+}
+
 }  // namespace sss
 
 int main(int argc, char *argv[]) {
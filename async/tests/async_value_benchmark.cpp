@@ -0,0 +1,201 @@
+// AsyncValue creation and destruction through a HostContext, with and without
+// the per-type AsyncValuePool of the context, and inside an ExecutionArena.
+//
+//   MakeAvailable: create an available value and drop it right away.
+//   Window:        every thread keeps a window of live values, and replaces a
+//                  random one on every iteration.
+//   AndThen:       add waiters to an unavailable value, then make it
+//                  available.
+//   FanOut:        make a value with 256 waiters available, with different
+//                  waiter fan-out thresholds of the context (0 runs them all
+//                  in the producer thread).
+//   RefCount:      add and drop the references of the users of a value in
+//                  the thread that created it, with and without biased
+//                  reference counting.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "async/context/chain.h"
+#include "async/context/execution_arena.h"
+#include "async/context/host_context.h"
+#include "async/support/latch.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+
+struct Small {
+  int64_t a;
+  int64_t b;
+  double c;
+};
+
+// Contexts are shared by all the benchmark threads, and never destroyed.
+HostContext *Unpooled() {
+  static HostContext *host = CreateCustomHostContext(1, 1).release();
+  return host;
+}
+
+HostContext *Pooled() {
+  static HostContext *host = []() {
+    HostContext *host = CreateCustomHostContext(1, 1).release();
+    host->EnableAsyncValuePool<int>();
+    host->EnableAsyncValuePool<Chain>();
+    host->EnableAsyncValuePool<Small>();
+    return host;
+  }();
+  return host;
+}
+
+HostContext *Biased() {
+  static HostContext *host = []() {
+    HostContext *host = CreateCustomHostContext(1, 1).release();
+    host->EnableBiasedRefCount<int>();
+    return host;
+  }();
+  return host;
+}
+
+template <HostContext *(*Host)(), typename T>
+void BM_MakeAvailable(benchmark::State &state) {
+  HostContext *host = Host();
+  for (auto _ : state) {
+    AsyncValueRef<T> value = host->MakeAvailableAsyncValueRef<T>();
+    benchmark::DoNotOptimize(value.GetAsyncValue());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_MakeAvailable, Unpooled, int)->Threads(1)->Threads(4);
+BENCHMARK_TEMPLATE(BM_MakeAvailable, Pooled, int)->Threads(1)->Threads(4);
+BENCHMARK_TEMPLATE(BM_MakeAvailable, Unpooled, Chain);
+BENCHMARK_TEMPLATE(BM_MakeAvailable, Pooled, Chain);
+BENCHMARK_TEMPLATE(BM_MakeAvailable, Unpooled, Small);
+BENCHMARK_TEMPLATE(BM_MakeAvailable, Pooled, Small);
+
+void BM_MakeAvailableInArena(benchmark::State &state) {
+  HostContext *host = Unpooled();
+  ExecutionArena arena(host->allocator());
+  ExecutionArena::Scope scope(&arena);
+  for (auto _ : state) {
+    AsyncValueRef<int> value = host->MakeAvailableAsyncValueRef<int>();
+    benchmark::DoNotOptimize(value.GetAsyncValue());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeAvailableInArena);
+
+template <HostContext *(*Host)()>
+void BM_Window(benchmark::State &state) {
+  HostContext *host = Host();
+  std::mt19937 rng(42);
+  std::vector<AsyncValueRef<int>> live;
+  for (int i = 0; i < 256; ++i) {
+    live.push_back(host->MakeAvailableAsyncValueRef<int>(i));
+  }
+  for (auto _ : state) {
+    live[rng() % live.size()] = host->MakeAvailableAsyncValueRef<int>(0);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Window, Unpooled)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Window, Pooled)->Threads(1)->Threads(4)->UseRealTime();
+
+void BM_AndThen(benchmark::State &state) {
+  HostContext *host = Pooled();
+  const int num_waiters = state.range(0);
+  int64_t sum = 0;
+  for (auto _ : state) {
+    AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+    for (int i = 0; i < num_waiters; ++i) {
+      value.AndThen([&sum, i]() { sum += i; });
+    }
+    value.emplace(1);
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * num_waiters);
+}
+BENCHMARK(BM_AndThen)->Arg(1)->Arg(4);
+
+// Map() of an unavailable value, against the same continuation spelled out
+// with AndThen().
+void BM_MapByHand(benchmark::State &state) {
+  HostContext *host = Pooled();
+  for (auto _ : state) {
+    AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+    AsyncValueRef<int64_t> result =
+        host->MakeUnconstructedAsyncValueRef<int64_t>();
+    value.AndThen([value = value.CopyRef(), result = result.CopyRef()]() {
+      if (value.IsError()) {
+        result.SetError(value.GetError());
+      } else {
+        result.emplace(int64_t{value.get()} + 1);
+      }
+    });
+    value.emplace(1);
+    benchmark::DoNotOptimize(result.get());
+  }
+}
+BENCHMARK(BM_MapByHand);
+
+void BM_Map(benchmark::State &state) {
+  HostContext *host = Pooled();
+  for (auto _ : state) {
+    AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+    AsyncValueRef<int64_t> result =
+        value.Map([](int v) { return int64_t{v} + 1; });
+    value.emplace(1);
+    benchmark::DoNotOptimize(result.get());
+  }
+}
+BENCHMARK(BM_Map);
+
+void BM_FanOut(benchmark::State &state) {
+  static HostContext *host = CreateCustomHostContext(4, 1).release();
+  host->SetWaiterFanOutThreshold(state.range(0));
+  constexpr int kNumWaiters = 256;
+  for (auto _ : state) {
+    latch done(kNumWaiters);
+    AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+    for (int i = 0; i < kNumWaiters; ++i) {
+      value.AndThen([&done]() {
+        // A small kernel, about a microsecond of work.
+        float sum = 0;
+        for (int j = 0; j < 500; ++j) sum += j * 0.5f;
+        benchmark::DoNotOptimize(sum);
+        done.count_down();
+      });
+    }
+    value.emplace(1);
+    done.wait();
+  }
+  state.SetItemsProcessed(state.iterations() * kNumWaiters);
+}
+BENCHMARK(BM_FanOut)->Arg(0)->Arg(16)->Arg(64)->UseRealTime();
+
+// The references of the users are added at once, like the graph executor does,
+// and each user copies the reference it gets before dropping it.
+template <HostContext *(*Host)()>
+void BM_RefCount(benchmark::State &state) {
+  HostContext *host = Host();
+  const int num_users = state.range(0);
+  for (auto _ : state) {
+    AsyncValueRef<int> value = host->MakeAvailableAsyncValueRef<int>(1);
+    AsyncValue *users = value.GetAsyncValue()->AddRef(num_users);
+    for (int i = 0; i < num_users; ++i) {
+      AsyncValueRef<int> copy = value.CopyRef();
+      benchmark::DoNotOptimize(copy.get());
+      users->DropRef();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_users);
+}
+BENCHMARK_TEMPLATE(BM_RefCount, Unpooled)->Arg(1)->Arg(8)->Arg(64);
+BENCHMARK_TEMPLATE(BM_RefCount, Biased)->Arg(1)->Arg(8)->Arg(64);
+
+}  // namespace
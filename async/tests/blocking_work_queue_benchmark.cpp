@@ -0,0 +1,79 @@
+// Short tasks passed to the dynamic threads of the blocking work queue
+// (RunBlockingTask), from one and from several submitting threads. Every
+// handoff wakes up an idle dynamic thread, tasks rejected at the thread limit
+// run in the submitting thread.
+//
+//   RunBlockingTask: submission throughput, `inline` is the fraction of the
+//                    rejected tasks.
+//   RoundTrip:       time from the submission until the task is running.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <thread>
+
+#include "async/concurrent/blocking_work_queue.h"
+#include "async/concurrent/environment.h"
+#include "async/support/task_function.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+
+using BlockingQueue =
+    internal::BlockingWorkQueue<internal::StdThreadingEnvironment>;
+
+constexpr size_t kMaxDynamicThreads = 16;
+
+// Shared by all the benchmark threads, and never destroyed.
+BlockingQueue *Queue() {
+  static internal::QuiescingState *quiescing = new internal::QuiescingState();
+  static BlockingQueue *queue =
+      new BlockingQueue(quiescing, 1, kMaxDynamicThreads);
+  return queue;
+}
+
+void BM_RunBlockingTask(benchmark::State &state) {
+  BlockingQueue *queue = Queue();
+  std::atomic<int64_t> pending{0};
+  int64_t num_inline = 0;
+
+  for (auto _ : state) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+    std::optional<TaskFunction> rejected = queue->RunBlockingTask(
+        TaskFunction([&pending]() { pending.fetch_sub(1); }));
+    if (rejected.has_value()) {
+      (*rejected)();
+      ++num_inline;
+    }
+  }
+
+  while (pending.load() != 0) std::this_thread::yield();
+  state.SetItemsProcessed(state.iterations());
+  // Fraction of the tasks that found all the dynamic threads busy.
+  state.counters["inline"] = benchmark::Counter(
+      static_cast<double>(num_inline) / state.iterations(),
+      benchmark::Counter::kAvgThreads);
+}
+BENCHMARK(BM_RunBlockingTask)->Threads(1)->Threads(4)->UseRealTime();
+
+// The submitter waits for every task to start before submitting the next one,
+// there is always an idle thread to take it.
+void BM_RunBlockingTaskRoundTrip(benchmark::State &state) {
+  BlockingQueue *queue = Queue();
+  std::atomic<bool> done{false};
+
+  for (auto _ : state) {
+    done.store(false, std::memory_order_relaxed);
+    std::optional<TaskFunction> rejected = queue->RunBlockingTask(
+        TaskFunction([&done]() { done.store(true); }));
+    if (rejected.has_value()) (*rejected)();
+    while (!done.load()) std::this_thread::yield();
+  }
+}
+BENCHMARK(BM_RunBlockingTaskRoundTrip)->Threads(1)->Threads(4)->UseRealTime();
+
+}  // namespace
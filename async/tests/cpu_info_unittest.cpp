@@ -0,0 +1,207 @@
+#include "async/concurrent/cpu_info.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+// A fake cgroup or sysfs tree in a temporary directory.
+class FakeSysFs {
+ public:
+  FakeSysFs() {
+    char dir[] = "/tmp/cpu_info_unittest_XXXXXX";
+    mRoot = mkdtemp(dir);
+  }
+
+  void Write(const std::string &path, const std::string &content) {
+    for (size_t pos = 1; (pos = path.find('/', pos)) != std::string::npos;
+         ++pos) {
+      mkdir((mRoot + path.substr(0, pos)).c_str(), 0755);
+    }
+    std::ofstream(mRoot + path) << content;
+  }
+
+  const std::string &root() const { return mRoot; }
+
+ private:
+  std::string mRoot;
+};
+}  // namespace
+
+TEST(CpuInfo, ParseCgroupQuota) {
+  EXPECT_FALSE(internal::ParseCgroupV2CpuMax("max 100000\n").has_value());
+  EXPECT_DOUBLE_EQ(*internal::ParseCgroupV2CpuMax("250000 100000\n"), 2.5);
+  EXPECT_FALSE(internal::ParseCgroupV2CpuMax("").has_value());
+  EXPECT_FALSE(internal::ParseCgroupV2CpuMax("12x 100000").has_value());
+
+  EXPECT_FALSE(internal::CgroupV1CpuLimit(-1, 100000).has_value());
+  EXPECT_DOUBLE_EQ(*internal::CgroupV1CpuLimit(50000, 100000), 0.5);
+}
+
+TEST(CpuInfo, ReadCgroupV2Limit) {
+  FakeSysFs fs;
+  fs.Write("/cpu.max", "max 100000\n");
+  fs.Write("/kubepods/pod/cpu.max", "400000 100000\n");
+  fs.Write("/kubepods/pod/ctr/cpu.max", "max 100000\n");
+
+  // The effective limit is the smallest one among the ancestors.
+  std::optional<double> limit =
+      internal::ReadCgroupCpuLimit("0::/kubepods/pod/ctr\n", fs.root());
+  ASSERT_TRUE(limit.has_value());
+  EXPECT_DOUBLE_EQ(*limit, 4.0);
+
+  EXPECT_FALSE(internal::ReadCgroupCpuLimit("0::/\n", fs.root()).has_value());
+}
+
+TEST(CpuInfo, ReadCgroupV1Limit) {
+  FakeSysFs fs;
+  fs.Write("/cpu,cpuacct/docker/abc/cpu.cfs_quota_us", "150000\n");
+  fs.Write("/cpu,cpuacct/docker/abc/cpu.cfs_period_us", "100000\n");
+  fs.Write("/memory/docker/abc/memory.limit_in_bytes", "1024\n");
+
+  std::optional<double> limit = internal::ReadCgroupCpuLimit(
+      "12:memory:/docker/abc\n4:cpu,cpuacct:/docker/abc\n", fs.root());
+  ASSERT_TRUE(limit.has_value());
+  EXPECT_DOUBLE_EQ(*limit, 1.5);
+
+  EXPECT_FALSE(internal::ReadCgroupCpuLimit("12:memory:/docker/abc\n",
+                                            fs.root())
+                   .has_value());
+}
+
+TEST(CpuInfo, AvailableCpuCount) {
+  const int schedulable = GetSchedulableCpuCount();
+  const int available = GetAvailableCpuCount();
+  EXPECT_GE(available, 1);
+  EXPECT_LE(available, schedulable);
+}
+
+TEST(CpuInfo, ParseCpuList) {
+  EXPECT_EQ(internal::ParseCpuList("0-3,8,10-11\n"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(internal::ParseCpuList("5"), std::vector<int>{5});
+  EXPECT_TRUE(internal::ParseCpuList("").empty());
+}
+
+namespace {
+// Two sockets (NUMA nodes) with two cores each, two hardware threads per core.
+// Hardware threads of a core share L1 and L2, cores of a socket share L3.
+void WriteDualSocketTopology(FakeSysFs *fs) {
+  for (int cpu = 0; cpu < 8; ++cpu) {
+    const std::string dir = "/cpu" + std::to_string(cpu);
+    const int package = cpu / 4;
+    const std::string siblings =
+        std::to_string(cpu & ~1) + "-" + std::to_string(cpu | 1);
+    const std::string socket =
+        std::to_string(package * 4) + "-" + std::to_string(package * 4 + 3);
+    fs->Write(dir + "/topology/physical_package_id",
+              std::to_string(package) + "\n");
+    fs->Write(dir + "/topology/thread_siblings_list", siblings + "\n");
+    fs->Write(dir + "/cache/index0/level", "1\n");
+    fs->Write(dir + "/cache/index0/type", "Data\n");
+    fs->Write(dir + "/cache/index0/shared_cpu_list", siblings + "\n");
+    fs->Write(dir + "/cache/index1/level", "1\n");
+    fs->Write(dir + "/cache/index1/type", "Instruction\n");
+    fs->Write(dir + "/cache/index1/shared_cpu_list", siblings + "\n");
+    fs->Write(dir + "/cache/index2/level", "2\n");
+    fs->Write(dir + "/cache/index2/type", "Unified\n");
+    fs->Write(dir + "/cache/index2/shared_cpu_list", siblings + "\n");
+    fs->Write(dir + "/cache/index3/level", "3\n");
+    fs->Write(dir + "/cache/index3/type", "Unified\n");
+    fs->Write(dir + "/cache/index3/shared_cpu_list", socket + "\n");
+    fs->Write(dir + "/node" + std::to_string(package) + "/cpulist",
+              socket + "\n");
+  }
+}
+}  // namespace
+
+TEST(CpuInfo, ReadCpuTopology) {
+  FakeSysFs fs;
+  WriteDualSocketTopology(&fs);
+
+  std::vector<CpuLocation> topology =
+      internal::ReadCpuTopology(fs.root(), {0, 1, 2, 3, 4, 5, 6, 7});
+  ASSERT_EQ(topology.size(), 8u);
+  const CpuLocation &cpu5 = topology[5];
+  EXPECT_EQ(cpu5.cpu, 5);
+  EXPECT_EQ(cpu5.core, 4);
+  EXPECT_EQ(cpu5.l2, 4);
+  EXPECT_EQ(cpu5.l3, 4);
+  EXPECT_EQ(cpu5.package, 1);
+  EXPECT_EQ(cpu5.node, 1);
+
+  // No topology information.
+  EXPECT_TRUE(internal::ReadCpuTopology(fs.root(), {8}).empty());
+}
+
+TEST(CpuInfo, PlaceWorkersDualSocket) {
+  FakeSysFs fs;
+  WriteDualSocketTopology(&fs);
+  std::vector<CpuLocation> topology =
+      internal::ReadCpuTopology(fs.root(), {0, 1, 2, 3, 4, 5, 6, 7});
+
+  // Physical cores first, then their hardware threads.
+  internal::WorkerPlacement placement = internal::PlaceWorkers(topology, 8);
+  EXPECT_EQ(placement.cpus, (std::vector<int>{0, 2, 4, 6, 1, 3, 5, 7}));
+
+  // Worker 0 runs on CPU 0: CPU 1 shares its core, CPUs 2 and 3 share the L3,
+  // the second socket is remote.
+  const std::vector<unsigned> &order = placement.stealOrder[0];
+  const auto &tierEnd = placement.tierEnd[0];
+  EXPECT_EQ(order[0], 0u);
+  EXPECT_EQ(std::vector<unsigned>(order.begin(), order.begin() + 2),
+            (std::vector<unsigned>{0, 4}));
+  EXPECT_EQ(std::vector<unsigned>(order.begin() + 2, order.begin() + 4),
+            (std::vector<unsigned>{1, 5}));
+  EXPECT_EQ(tierEnd[internal::kSameL2], 2u);
+  EXPECT_EQ(tierEnd[internal::kSameL3], 4u);
+  EXPECT_EQ(tierEnd[internal::kSameNode], 4u);
+  EXPECT_EQ(tierEnd[internal::kRemote], 8u);
+
+  // Fewer workers than CPUs stay on the first socket, more workers wrap
+  // around.
+  internal::WorkerPlacement two = internal::PlaceWorkers(topology, 2);
+  EXPECT_EQ(two.cpus, (std::vector<int>{0, 2}));
+  EXPECT_EQ(two.tierEnd[1][internal::kRemote],
+            two.tierEnd[1][internal::kSameL3]);
+  internal::WorkerPlacement ten = internal::PlaceWorkers(topology, 10);
+  EXPECT_EQ(ten.cpus[8], 0);
+  EXPECT_EQ(ten.tierEnd[8][internal::kSameL2], 3u);
+}
+
+TEST(CpuInfo, PlaceWorkersSingleSocket) {
+  // A single socket without any cache information: everything is in the same
+  // node, nothing is remote.
+  std::vector<CpuLocation> topology(4);
+  for (int cpu = 0; cpu < 4; ++cpu) {
+    topology[cpu].cpu = cpu;
+    topology[cpu].core = cpu;
+    topology[cpu].package = 0;
+  }
+  internal::WorkerPlacement placement = internal::PlaceWorkers(topology, 4);
+  ASSERT_FALSE(placement.empty());
+  for (unsigned i = 0; i < 4; ++i) {
+    EXPECT_EQ(placement.stealOrder[i][0], i);
+    EXPECT_EQ(placement.tierEnd[i][internal::kSameL2], 1u);
+    EXPECT_EQ(placement.tierEnd[i][internal::kSameNode], 4u);
+    EXPECT_EQ(placement.tierEnd[i][internal::kRemote], 4u);
+  }
+
+  // Nothing to gain from pinning to a single CPU.
+  topology.resize(1);
+  EXPECT_TRUE(internal::PlaceWorkers(topology, 4).empty());
+  EXPECT_TRUE(internal::PlaceWorkers({}, 4).empty());
+}
+
+int main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
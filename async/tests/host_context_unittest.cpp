@@ -0,0 +1,620 @@
+#include "async/context/host_context.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async/concurrent/concurrent_work_queue.h"
+#include "async/concurrent/work_queue_stats.h"
+#include "async/context/chain.h"
+#include "async/context/execution_arena.h"
+#include "async/context/host_allocator.h"
+#include "async/support/cancellation_token.h"
+#include "async/support/latch.h"
+#include "gtest/gtest.h"
+
+using namespace sss;
+using namespace async;
+
+TEST(HostContext, EnqueueWorkWithCancellationToken) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(1, 1);
+
+  // Keep the only worker thread busy, until all the tasks are submitted.
+  latch started(1);
+  latch release(1);
+  host->EnqueueWork([&]() {
+    started.count_down();
+    release.wait();
+  });
+  started.wait();
+
+  std::atomic<int> executed{0};
+  RCReference<CancellationToken> token = CancellationToken::Create();
+  RCReference<CancellationToken> alive = CancellationToken::Create();
+  for (int i = 0; i < 10; ++i) {
+    host->EnqueueWork(token.CopyRef(), [&]() { executed.fetch_add(1); });
+  }
+  host->EnqueueWork(alive.CopyRef(), [&]() { executed.fetch_add(100); });
+  host->EnqueueWork(std::chrono::steady_clock::now(),
+                    [&]() { executed.fetch_add(1000); });
+  token->Cancel();
+  release.count_down();
+  host->Quiesce();
+
+  EXPECT_TRUE(token->IsCancelled());
+  EXPECT_FALSE(alive->IsCancelled());
+  EXPECT_EQ(executed.load(), 100);
+  EXPECT_EQ(host->GetWorkQueueStats().nonBlocking.numCancelledTasks, 11u);
+}
+
+TEST(HostContext, EnqueueWorkBatch) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(4, 1);
+
+  constexpr int kNumTasks = 100;
+  std::atomic<int> executed{0};
+  std::vector<unique_function<void()>> work;
+  for (int i = 0; i < kNumTasks; ++i) {
+    work.emplace_back([&]() { executed.fetch_add(1); });
+  }
+  host->EnqueueWorkBatch(absl::MakeSpan(work));
+  host->Quiesce();
+  EXPECT_EQ(executed.load(), kNumTasks);
+
+  WorkQueueStats stats = host->GetWorkQueueStats();
+  EXPECT_EQ(stats.enabled, kWorkQueueStatsEnabled);
+  EXPECT_EQ(stats.nonBlocking.workers.size(), 4u);
+}
+
+TEST(HostContext, WorkersStartEagerly) {
+  // Elastic pools are opt-in, see CreateMultiThreadedWorkQueue.
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(4, 1);
+  EXPECT_EQ(host->GetWorkQueueStats().nonBlocking.numStartedWorkers, 4u);
+}
+
+TEST(HostContext, EnqueueWorkWithAffinity) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(4, 1);
+
+  constexpr int kNumTasks = 100;
+  std::atomic<int> executed{0};
+  for (int i = 0; i < kNumTasks; ++i) {
+    host->EnqueueWork(WorkerAffinity::Key(i % 7),
+                      [&]() { executed.fetch_add(1); });
+    host->EnqueueWork(WorkerAffinity::Worker(i),
+                      [&]() { executed.fetch_add(1); });
+  }
+  host->Quiesce();
+  EXPECT_EQ(executed.load(), 2 * kNumTasks);
+}
+
+TEST(HostContext, SetNumWorkerThreads) {
+  WorkQueueOptions options;
+  options.maxNumThreads = 4;
+  auto host = std::make_unique<HostContext>(
+      [](const DecodedDiagnostic &) {}, CreateMallocAllocator(),
+      CreateMultiThreadedWorkQueue(2, 1, options));
+  EXPECT_EQ(host->GetNumWorkerThreads(), 2);
+  EXPECT_EQ(host->SetNumWorkerThreads(8), 4);
+  EXPECT_EQ(host->SetNumWorkerThreads(0), 1);
+  EXPECT_EQ(host->GetNumWorkerThreads(), 1);
+
+  std::atomic<int> executed{0};
+  for (int i = 0; i < 100; ++i) {
+    host->EnqueueWork([&]() { executed.fetch_add(1); });
+  }
+  host->SetNumWorkerThreads(3);
+  host->Quiesce();
+  EXPECT_EQ(executed.load(), 100);
+}
+
+TEST(HostContext, EnqueueWorkAfter) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(2, 1);
+  using Clock = std::chrono::steady_clock;
+
+  // Let the workers park, so that the timers are fired by the parked worker.
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  const Clock::time_point start = Clock::now();
+  latch done(2);
+  std::atomic<int> order{0};
+  std::atomic<int> first{-1};
+  std::atomic<int> second{-1};
+  std::atomic<int64_t> elapsed_ms{0};
+
+  // Each new timer has an earlier deadline, the parked worker must re-arm.
+  TimerHandle never = host->EnqueueWorkAfter(std::chrono::hours(1), [&]() {
+    order.fetch_add(1000);
+  });
+  host->EnqueueWorkAfter(std::chrono::milliseconds(30), [&]() {
+    second = order.fetch_add(1);
+    elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     Clock::now() - start)
+                     .count();
+    done.count_down();
+  });
+  TimerHandle cancelled = host->EnqueueWorkAfter(
+      std::chrono::milliseconds(10), [&]() { order.fetch_add(100); });
+  host->EnqueueWorkAt(start + std::chrono::milliseconds(5), [&]() {
+    first = order.fetch_add(1);
+    done.count_down();
+  });
+  EXPECT_TRUE(cancelled.Cancel());
+
+  done.wait();
+  host->Quiesce();
+  EXPECT_EQ(first.load(), 0);
+  EXPECT_EQ(second.load(), 1);
+  EXPECT_GE(elapsed_ms.load(), 30);
+  EXPECT_EQ(order.load(), 2);
+  EXPECT_FALSE(cancelled.IsPending());
+  EXPECT_TRUE(never.IsPending());
+}
+
+// Runs every task in a new thread, and relies on the default AddTimer().
+class ThreadPerTaskWorkQueue : public ConcurrentWorkQueue {
+ public:
+  ~ThreadPerTaskWorkQueue() override { Quiesce(); }
+
+  std::string name() const override { return "thread_per_task"; }
+  void AddTask(TaskFunction work) override { Spawn(std::move(work)); }
+  std::optional<TaskFunction> AddBlockingTask(TaskFunction work,
+                                              bool allowQueuing) override {
+    (void)allowQueuing;
+    Spawn(std::move(work));
+    return std::nullopt;
+  }
+  void Await(absl::Span<const RCReference<AsyncValue>> values) override {
+    for (const auto &value : values) {
+      while (!value->IsAvailable()) std::this_thread::yield();
+    }
+  }
+  void Quiesce() override {
+    for (;;) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(mMu);
+        threads.swap(mThreads);
+      }
+      if (threads.empty()) return;
+      for (std::thread &thread : threads) thread.join();
+    }
+  }
+  int GetParallelismLevel() const override { return 1; }
+  bool IsInWorkerThread() const override { return false; }
+
+ private:
+  void Spawn(TaskFunction work) {
+    std::lock_guard<std::mutex> lock(mMu);
+    mThreads.emplace_back([work = std::move(work)]() mutable { work(); });
+  }
+
+  std::mutex mMu;
+  std::vector<std::thread> mThreads;
+};
+
+TEST(HostContext, DefaultAddTimer) {
+  using Clock = std::chrono::steady_clock;
+  auto host = std::make_unique<HostContext>(
+      [](const DecodedDiagnostic &) {}, CreateMallocAllocator(),
+      std::make_unique<ThreadPerTaskWorkQueue>());
+  const Clock::time_point start = Clock::now();
+  latch done(1);
+  std::atomic<bool> cancelled_fired{false};
+  std::atomic<int64_t> elapsed_ms{0};
+  TimerHandle cancelled = host->EnqueueWorkAfter(
+      std::chrono::milliseconds(20), [&]() { cancelled_fired = true; });
+  host->EnqueueWorkAfter(std::chrono::milliseconds(10), [&]() {
+    elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     Clock::now() - start)
+                     .count();
+    done.count_down();
+  });
+  EXPECT_TRUE(cancelled.Cancel());
+  done.wait();
+  host->Quiesce();
+  EXPECT_GE(elapsed_ms.load(), 10);
+  EXPECT_FALSE(cancelled_fired.load());
+}
+
+TEST(HostContext, EnqueueWorkAfterFromBusyWorkers) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(1, 1);
+
+  // The only worker never parks, it must poll the timers between tasks.
+  std::atomic<bool> fired{false};
+  host->EnqueueWorkAfter(std::chrono::milliseconds(5),
+                         [&]() { fired = true; });
+  std::function<void()> spin = [&]() {
+    if (!fired) host->EnqueueWork([&]() { spin(); });
+  };
+  host->EnqueueWork([&]() { spin(); });
+  host->Quiesce();
+  EXPECT_TRUE(fired.load());
+}
+
+TEST(HostContext, AsyncValuesInExecutionArena) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(1, 1);
+  auto same_chunk = [](const void *a, const void *b) {
+    const uintptr_t mask = ~uintptr_t{ExecutionArena::kChunkSize - 1};
+    return (reinterpret_cast<uintptr_t>(a) & mask) ==
+           (reinterpret_cast<uintptr_t>(b) & mask);
+  };
+
+  AsyncValueRef<int> escaped;
+  {
+    ExecutionArena arena(host->allocator());
+    ExecutionArena::Scope scope(&arena);
+    void *block = arena.AllocateBytes(8, 8);
+    escaped = host->MakeAvailableAsyncValueRef<int>(42);
+    EXPECT_TRUE(same_chunk(escaped.GetAsyncValue(), block));
+
+    RCReference<IndirectAsyncValue> indirect = host->MakeIndirectAsyncValue();
+    EXPECT_TRUE(same_chunk(indirect.get(), block));
+    RCReference<ErrorAsyncValue> error = host->MakeErrorAsyncValueRef("error");
+    EXPECT_TRUE(same_chunk(error.get(), block));
+    indirect->ForwardTo(error.CopyRef());
+    arena.DeallocateBytes(block, 8);
+  }
+  EXPECT_EQ(ExecutionArena::Current(), nullptr);
+
+  // The value outlives the arena.
+  EXPECT_EQ(escaped.get(), 42);
+  escaped.reset();
+}
+
+TEST(HostContext, AsyncValuePool) {
+  struct Large {
+    char data[4096];
+  };
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(1, 1);
+  EXPECT_TRUE(host->EnableAsyncValuePool<int>());
+  EXPECT_TRUE(host->EnableAsyncValuePool<Chain>());
+  EXPECT_FALSE(host->EnableAsyncValuePool<Large>());
+
+  // A destroyed value is reused by the next one of the same type.
+  AsyncValueRef<int> value = host->MakeAvailableAsyncValueRef<int>(1);
+  const AsyncValue *address = value.GetAsyncValue();
+  value.reset();
+  value = host->MakeUnconstructedAsyncValueRef<int>();
+  EXPECT_EQ(value.GetAsyncValue(), address);
+  value.emplace(2);
+  EXPECT_EQ(value.get(), 2);
+
+  // Values created and destroyed on different threads, some of them still
+  // cached when the context is destroyed.
+  std::vector<AsyncValueRef<Chain>> chains;
+  for (int i = 0; i < 1000; ++i) {
+    chains.push_back(host->MakeAvailableAsyncValueRef<Chain>());
+  }
+  latch done(1);
+  host->EnqueueWork([&]() {
+    chains.clear();
+    for (int i = 0; i < 100; ++i) {
+      chains.push_back(host->MakeAvailableAsyncValueRef<Chain>());
+    }
+    done.count_down();
+  });
+  done.wait();
+  EXPECT_EQ(chains.size(), 100u);
+  chains.clear();
+  value.reset();
+}
+
+TEST(HostContext, BiasedRefCount) {
+  struct alignas(16) Aligned {
+    char data[16];
+  };
+  using Marker = std::shared_ptr<int>;
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(1, 1);
+  EXPECT_TRUE(host->EnableBiasedRefCount<Marker>());
+  EXPECT_TRUE(host->EnableBiasedRefCount<int>());
+  EXPECT_FALSE(host->EnableBiasedRefCount<Aligned>());
+
+  // References of the owner thread only.
+  Marker marker = std::make_shared<int>(0);
+  AsyncValueRef<Marker> value =
+      host->MakeAvailableAsyncValueRef<Marker>(marker);
+  EXPECT_TRUE(value.IsUnique());
+  {
+    std::vector<AsyncValueRef<Marker>> copies;
+    for (int i = 0; i < 8; ++i) copies.push_back(value.CopyRef());
+    EXPECT_EQ(value.GetAsyncValue()->NumCount(), 9u);
+  }
+  EXPECT_TRUE(value.IsUnique());
+  value.reset();
+  EXPECT_EQ(marker.use_count(), 1);
+
+  // The last reference is dropped by another thread, the value is freed by
+  // the owner when it creates its next biased value.
+  value = host->MakeAvailableAsyncValueRef<Marker>(marker);
+  std::thread([copy = value.CopyRef()]() mutable { copy.reset(); }).join();
+  std::thread([moved = std::move(value)]() mutable { moved.reset(); }).join();
+  EXPECT_EQ(marker.use_count(), 2);
+  host->MakeAvailableAsyncValueRef<int>(0);
+  EXPECT_EQ(marker.use_count(), 1);
+
+  // Or when it drops a reference to one of its values, without creating any.
+  AsyncValueRef<int> own = host->MakeAvailableAsyncValueRef<int>(0);
+  AsyncValueRef<int> own_copy = own.CopyRef();
+  value = host->MakeAvailableAsyncValueRef<Marker>(marker);
+  std::thread([moved = std::move(value)]() mutable { moved.reset(); }).join();
+  EXPECT_EQ(marker.use_count(), 2);
+  own_copy.reset();
+  EXPECT_EQ(marker.use_count(), 1);
+
+  // References of other threads are added to the owner count when it drops
+  // its last one.
+  value = host->MakeAvailableAsyncValueRef<Marker>(marker);
+  AsyncValueRef<Marker> other;
+  std::thread([&]() { other = value.CopyRef(); }).join();
+  value.reset();
+  EXPECT_TRUE(other.IsUnique());
+  other.reset();
+  EXPECT_EQ(marker.use_count(), 1);
+
+  // The owner thread exits while other threads hold its references.
+  std::thread([&]() {
+    value = host->MakeAvailableAsyncValueRef<Marker>(marker);
+    other = value.CopyRef();
+  }).join();
+  value.reset();
+  EXPECT_EQ(marker.use_count(), 2);
+  other.reset();
+  EXPECT_EQ(marker.use_count(), 1);
+}
+
+TEST(HostContext, BiasedRefCountAcrossThreads) {
+  using Marker = std::shared_ptr<int>;
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(4, 1);
+  ASSERT_TRUE(host->EnableBiasedRefCount<Marker>());
+  Marker marker = std::make_shared<int>(0);
+
+  // The workers create values and share them with each other and with this
+  // thread, which all add and drop references concurrently.
+  constexpr int kNumValues = 1000;
+  std::vector<AsyncValueRef<Marker>> values(kNumValues);
+  latch created(kNumValues);
+  for (int i = 0; i < kNumValues; ++i) {
+    host->EnqueueWork([&, i]() {
+      values[i] = host->MakeAvailableAsyncValueRef<Marker>(marker);
+      for (int j = 0; j < 4; ++j) {
+        host->EnqueueWork([copy = values[i].CopyRef()]() {
+          std::vector<AsyncValueRef<Marker>> copies;
+          for (int k = 0; k < 4; ++k) copies.push_back(copy.CopyRef());
+        });
+      }
+      created.count_down();
+    });
+  }
+  created.wait();
+  for (AsyncValueRef<Marker> &value : values) {
+    std::vector<AsyncValueRef<Marker>> copies;
+    for (int k = 0; k < 4; ++k) copies.push_back(value.CopyRef());
+    value.reset();
+  }
+  host->Quiesce();
+  host.reset();
+  EXPECT_EQ(marker.use_count(), 1);
+}
+
+TEST(HostContext, AndThenWaiters) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(1, 1);
+
+  // Waiters of a value run in the reverse order of their enqueueing.
+  std::vector<int> order;
+  AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+  for (int i = 0; i < 3; ++i) {
+    value.AndThen([&order, i]() { order.push_back(i); });
+  }
+  EXPECT_TRUE(order.empty());
+  value.emplace(1);
+  EXPECT_EQ(order, std::vector<int>({2, 1, 0}));
+
+  // A waiter added to an available value runs right away.
+  value.AndThen([&order]() { order.push_back(3); });
+  EXPECT_EQ(order.size(), 4u);
+
+  // Waiters enqueued on this thread and run by a worker, and the other way
+  // around, so their nodes move between the threads.
+  std::atomic<int> count{0};
+  for (int round = 0; round < 100; ++round) {
+    AsyncValueRef<int> first = host->MakeUnconstructedAsyncValueRef<int>();
+    AsyncValueRef<int> second = host->MakeUnconstructedAsyncValueRef<int>();
+    first.AndThen([&count]() { count.fetch_add(1); });
+    latch done(1);
+    host->EnqueueWork([&]() {
+      first.emplace(round);
+      second.AndThen([&count]() { count.fetch_add(1); });
+      done.count_down();
+    });
+    done.wait();
+    second.emplace(round);
+  }
+  EXPECT_EQ(count.load(), 200);
+}
+
+TEST(HostContext, WaiterFanOut) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(4, 1);
+  EXPECT_EQ(host->GetWaiterFanOutThreshold(), 0u);
+
+  // Returns how many of `num_waiters` waiters ran in this thread.
+  auto run_waiters = [&host](int num_waiters) {
+    const std::thread::id self = std::this_thread::get_id();
+    std::atomic<int> inline_waiters{0};
+    latch done(num_waiters);
+    AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+    for (int i = 0; i < num_waiters; ++i) {
+      value.AndThen([&]() {
+        if (std::this_thread::get_id() == self) inline_waiters.fetch_add(1);
+        done.count_down();
+      });
+    }
+    value.emplace(1);
+    done.wait();
+    return inline_waiters.load();
+  };
+
+  EXPECT_EQ(run_waiters(20), 20);
+  host->SetWaiterFanOutThreshold(4);
+  EXPECT_EQ(run_waiters(4), 4);
+  EXPECT_EQ(run_waiters(20), 4);
+  EXPECT_EQ(run_waiters(21), 4);
+}
+
+TEST(HostContext, WhenAny) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(2, 1);
+
+  // The lowest available index wins right away.
+  AsyncValueRef<int> pending = host->MakeUnconstructedAsyncValueRef<int>();
+  AsyncValueRef<int> ready = host->MakeAvailableAsyncValueRef<int>(1);
+  AsyncValueRef<int> error = host->MakeUnconstructedAsyncValueRef<int>();
+  error.SetError("failed");
+  AsyncValueRef<size_t> first = host->WhenAny(
+      {pending.GetAsyncValue(), error.GetAsyncValue(), ready.GetAsyncValue()});
+  ASSERT_TRUE(first.IsAvailable());
+  EXPECT_EQ(first.get(), 1u);
+
+  // Otherwise the first value to become available wins, and the token is
+  // cancelled.
+  std::vector<RCReference<AsyncValue>> values;
+  for (int i = 0; i < 3; ++i) {
+    values.push_back(
+        host->MakeUnconstructedAsyncValueRef<int>().ReleaseRCRef());
+  }
+  RCReference<CancellationToken> token = CancellationToken::Create();
+  first = host->WhenAny(values, token.CopyRef());
+  EXPECT_FALSE(first.IsAvailable());
+  values[2]->emplace<int>(2);
+  ASSERT_TRUE(first.IsAvailable());
+  EXPECT_EQ(first.get(), 2u);
+  EXPECT_TRUE(token->IsCancelled());
+  values[0]->emplace<int>(0);
+  values[1]->SetError(DecodedDiagnostic("failed"));
+  EXPECT_EQ(first.get(), 2u);
+  pending.emplace(0);
+}
+
+TEST(HostContext, WhenAnyUsesHostAllocator) {
+  auto host = std::make_unique<HostContext>(
+      [](const DecodedDiagnostic &) {},
+      CreateProfiledAllocator(CreateMallocAllocator()),
+      CreateMultiThreadedWorkQueue(1, 1));
+  std::vector<RCReference<AsyncValue>> values;
+  for (int i = 0; i < 2; ++i) {
+    values.push_back(
+        host->MakeUnconstructedAsyncValueRef<int>().ReleaseRCRef());
+  }
+  const int64_t start = GetTotalNumAllocations(*host->allocator());
+  AsyncValueRef<size_t> first = host->WhenAny(values);
+  // The result and the shared state.
+  EXPECT_EQ(GetTotalNumAllocations(*host->allocator()) - start, 2);
+  values[1]->emplace<int>(1);
+  values[0]->emplace<int>(0);
+  EXPECT_EQ(first.get(), 1u);
+}
+
+TEST(HostContext, WhenAnyHedgedWork) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(2, 1);
+  RCReference<CancellationToken> token = CancellationToken::Create();
+
+  // The slow variant runs until it loses, the fast one finishes right away.
+  AsyncValueRef<int> slow = host->EnqueueWork([t = token.CopyRef()]() {
+    while (!t->IsCancelled()) std::this_thread::yield();
+    return -1;
+  });
+  AsyncValueRef<int> fast = host->EnqueueWork([]() { return 1; });
+  AsyncValueRef<size_t> first = host->WhenAny(
+      {slow.GetAsyncValue(), fast.GetAsyncValue()}, token.CopyRef());
+
+  host->Await({slow.CopyRCRef(), first.CopyRCRef()});
+  EXPECT_EQ(first.get(), 1u);
+  EXPECT_EQ(slow.get(), -1);
+}
+
+TEST(HostContext, MapAndThen) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(2, 1);
+
+  // Available values are mapped right away.
+  AsyncValueRef<int> one = host->MakeAvailableAsyncValueRef<int>(1);
+  AsyncValueRef<int> two = one.Map([](int v) { return v + 1; });
+  ASSERT_TRUE(two.IsAvailable());
+  EXPECT_EQ(two.get(), 2);
+
+  // Continuations of unavailable values run when they become available.
+  AsyncValueRef<int> source = host->MakeUnconstructedAsyncValueRef<int>();
+  AsyncValueRef<std::string> text =
+      source.Map([](int v) { return std::to_string(v); });
+  AsyncValueRef<int> doubled = source.Then([&host](int v) {
+    return host->EnqueueWork([v]() { return 2 * v; });
+  });
+  EXPECT_FALSE(text.IsAvailable());
+  source.emplace(21);
+  ASSERT_TRUE(text.IsAvailable());
+  EXPECT_EQ(text.get(), "21");
+  host->Await({doubled.CopyRCRef()});
+  EXPECT_EQ(doubled.get(), 42);
+
+  // Errors skip the continuations.
+  AsyncValueRef<int> failed = host->MakeUnconstructedAsyncValueRef<int>();
+  bool called = false;
+  AsyncValueRef<int> mapped = failed.Map([&called](int v) {
+    called = true;
+    return v;
+  });
+  AsyncValueRef<int> chained = failed.Then([&called, &host](int v) {
+    called = true;
+    return host->MakeAvailableAsyncValueRef<int>(v);
+  });
+  failed.SetError("failed");
+  ASSERT_TRUE(mapped.IsError());
+  EXPECT_EQ(mapped.GetError().message, "failed");
+  ASSERT_TRUE(chained.IsError());
+  EXPECT_EQ(chained.GetError().message, "failed");
+  EXPECT_FALSE(called);
+}
+
+TEST(HostContext, MapExecutionPolicy) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(2, 1);
+  const std::thread::id self = std::this_thread::get_id();
+  auto thread_of = [](int) { return std::this_thread::get_id(); };
+
+  AsyncValueRef<int> source = host->MakeUnconstructedAsyncValueRef<int>();
+  auto inline_thread = source.Map(thread_of, ExecutionPolicy::kInline);
+  auto enqueued_thread = source.Map(thread_of, ExecutionPolicy::kEnqueue);
+  auto blocking_thread =
+      source.Map(thread_of, ExecutionPolicy::kEnqueueBlocking);
+  // This thread is not a worker, the continuation is enqueued.
+  auto cheap_thread = source.Map(thread_of, ExecutionPolicy::kInlineIfCheap);
+  // Each pending continuation keeps the source alive.
+  EXPECT_EQ(source.GetAsyncValue()->NumCount(), 5u);
+  source.emplace(0);
+
+  host->Await({inline_thread.CopyRCRef(), enqueued_thread.CopyRCRef(),
+               blocking_thread.CopyRCRef(), cheap_thread.CopyRCRef()});
+  EXPECT_EQ(inline_thread.get(), self);
+  EXPECT_NE(enqueued_thread.get(), self);
+  EXPECT_NE(blocking_thread.get(), self);
+  EXPECT_NE(cheap_thread.get(), self);
+
+  // On a worker, kInlineIfCheap runs in the thread that sets the value.
+  latch done(1);
+  std::thread::id worker, cheap;
+  host->EnqueueWork([&]() {
+    worker = std::this_thread::get_id();
+    AsyncValueRef<int> value = host->MakeUnconstructedAsyncValueRef<int>();
+    auto thread = value.Map(thread_of, ExecutionPolicy::kInlineIfCheap);
+    value.emplace(0);
+    cheap = thread.get();
+    done.count_down();
+  });
+  done.wait();
+  EXPECT_EQ(cheap, worker);
+}
+
+int main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,752 @@
+#include "async/concurrent/non_blocking_work_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async/concurrent/blocking_work_queue.h"
+#include "async/concurrent/environment.h"
+#include "async/concurrent/event_count.h"
+#include "async/concurrent/idle_thread_stack.h"
+#include "async/concurrent/spin_policy.h"
+#include "async/concurrent/submission_ring.h"
+#include "async/concurrent/task_overflow_queue.h"
+#include "async/concurrent/work_queue_options.h"
+#include "async/concurrent/work_queue_stats.h"
+#include "async/concurrent/worker_affinity.h"
+#include "async/support/latch.h"
+#include "async/support/task_function.h"
+#include "async/support/task_trace_name.h"
+#include "gtest/gtest.h"
+
+using namespace sss;
+using namespace async;
+
+using WorkQueue =
+    internal::NonBlockingWorkQueue<internal::StdThreadingEnvironment>;
+
+TEST(TaskOverflowQueue, PushPop) {
+  internal::TaskOverflowQueue queue;
+  EXPECT_TRUE(queue.Empty());
+  int value = 0;
+  for (int i = 0; i < 3; ++i) {
+    queue.Push(TaskFunction([&value, i]() { value = value * 10 + i + 1; }));
+  }
+  EXPECT_FALSE(queue.Empty());
+  EXPECT_EQ(queue.Size(), 3u);
+  while (std::optional<TaskFunction> task = queue.Pop()) (*task)();
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_EQ(value, 123);
+  EXPECT_EQ(queue.NumPushed(), 3u);
+}
+
+TEST(SubmissionRing, PushPop) {
+  internal::SubmissionRing ring;
+  EXPECT_TRUE(ring.Empty());
+  EXPECT_FALSE(ring.Pop().has_value());
+
+  // Fill the ring, the next push is rejected.
+  int value = 0;
+  for (unsigned i = 0; i < internal::SubmissionRing::kCapacity; ++i) {
+    EXPECT_FALSE(ring.Push(TaskFunction([&value, i]() { value = i; }))
+                     .has_value());
+  }
+  EXPECT_TRUE(ring.Push(TaskFunction([]() {})).has_value());
+
+  // Tasks come out in the submission order, and the ring can be reused.
+  for (int lap = 0; lap < 2; ++lap) {
+    for (unsigned i = 0; i < internal::SubmissionRing::kCapacity; ++i) {
+      EXPECT_FALSE(ring.Empty());
+      std::optional<TaskFunction> task = ring.Pop();
+      ASSERT_TRUE(task.has_value());
+      (*task)();
+      EXPECT_EQ(value, static_cast<int>(i));
+      if (lap == 0) {
+        EXPECT_FALSE(ring.Push(TaskFunction([&value, i]() { value = i; }))
+                         .has_value());
+      }
+    }
+  }
+  EXPECT_TRUE(ring.Empty());
+}
+
+TEST(SubmissionRing, ConcurrentConsumers) {
+  internal::SubmissionRing ring;
+  constexpr int kNumTasks = 20000;
+  constexpr int kNumConsumers = 4;
+  std::atomic<int> executed{0};
+  std::atomic<bool> producerDone{false};
+
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < kNumConsumers; ++i) {
+    consumers.emplace_back([&]() {
+      for (;;) {
+        const bool done = producerDone.load();
+        if (std::optional<TaskFunction> task = ring.Pop()) {
+          (*task)();
+        } else if (done) {
+          return;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < kNumTasks; ++i) {
+    TaskFunction task([&]() { executed.fetch_add(1); });
+    while (std::optional<TaskFunction> rejected = ring.Push(std::move(task))) {
+      task = std::move(*rejected);
+      std::this_thread::yield();
+    }
+  }
+  producerDone.store(true);
+  for (std::thread &consumer : consumers) consumer.join();
+  EXPECT_EQ(executed.load(), kNumTasks);
+  EXPECT_TRUE(ring.Empty());
+}
+
+TEST(NonBlockingWorkQueue, SpillToOverflowQueue) {
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 2);
+
+  // Submit more tasks than fits into the worker queue from a worker thread, and
+  // check that none of them is executed inline in the submitting task.
+  constexpr int kNumTasks = 4 * internal::TaskDeque::kCapacity;
+  std::atomic<int> executed{0};
+  std::atomic<bool> executedInline{false};
+  latch done(kNumTasks);
+
+  static thread_local bool insideProducer = false;
+  queue.AddTask(TaskFunction([&]() {
+    insideProducer = true;
+    for (int i = 0; i < kNumTasks; ++i) {
+      queue.AddTask(TaskFunction([&]() {
+        if (insideProducer) executedInline = true;
+        executed.fetch_add(1);
+        done.count_down();
+      }));
+    }
+    insideProducer = false;
+  }));
+
+  done.wait();
+  queue.Quiesce();
+  EXPECT_EQ(executed.load(), kNumTasks);
+  EXPECT_FALSE(executedInline.load());
+  EXPECT_GT(queue.NumOverflowTasks(), 0u);
+}
+
+TEST(NonBlockingWorkQueue, AddTasks) {
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 4);
+
+  constexpr int kNumTasks = 100;
+  std::atomic<int> executed{0};
+  latch done(kNumTasks);
+
+  std::vector<TaskFunction> tasks;
+  for (int i = 0; i < kNumTasks; ++i) {
+    tasks.emplace_back([&]() {
+      executed.fetch_add(1);
+      done.count_down();
+    });
+  }
+  queue.AddTasks(absl::MakeSpan(tasks));
+  done.wait();
+  EXPECT_EQ(executed.load(), kNumTasks);
+
+  // Submit a batch from a worker thread, larger than the worker queue.
+  constexpr int kNumWorkerTasks = 2 * internal::TaskDeque::kCapacity;
+  latch workerDone(kNumWorkerTasks);
+  queue.AddTask(TaskFunction([&]() {
+    std::vector<TaskFunction> workerTasks;
+    for (int i = 0; i < kNumWorkerTasks; ++i) {
+      workerTasks.emplace_back([&]() {
+        executed.fetch_add(1);
+        workerDone.count_down();
+      });
+    }
+    queue.AddTasks(absl::MakeSpan(workerTasks));
+  }));
+  workerDone.wait();
+  queue.Quiesce();
+  EXPECT_EQ(executed.load(), kNumTasks + kNumWorkerTasks);
+}
+
+TEST(NonBlockingWorkQueue, Stats) {
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 2);
+
+  constexpr int kNumTasks = 1000;
+  latch done(kNumTasks);
+  for (int i = 0; i < kNumTasks; ++i) {
+    queue.AddTask(TaskFunction([&]() { done.count_down(); }));
+  }
+  done.wait();
+  queue.Quiesce();
+
+  WorkQueueStats stats;
+  queue.GetStats(&stats);
+  EXPECT_EQ(stats.enabled, kWorkQueueStatsEnabled);
+  ASSERT_EQ(stats.nonBlocking.workers.size(), 2u);
+
+  uint64_t numTasks = 0;
+  for (const WorkQueueStats::Worker &worker : stats.nonBlocking.workers) {
+    EXPECT_EQ(worker.queueDepth, 0u);
+    EXPECT_LE(worker.numSteals, worker.numStealAttempts);
+    numTasks += worker.numTasks;
+  }
+  // Tasks executed by the caller thread in Quiesce() are not counted.
+  if (kWorkQueueStatsEnabled) {
+    EXPECT_GT(numTasks, 0u);
+    EXPECT_LE(numTasks, static_cast<uint64_t>(kNumTasks));
+  } else {
+    EXPECT_EQ(numTasks, 0u);
+  }
+}
+
+TEST(AdaptiveSpinner, SpinTime) {
+  using namespace std::chrono_literals;
+  internal::AdaptiveSpinner spinner(100us);
+
+  // Tasks arrive shortly after the worker runs out of work: spin long enough
+  // to catch them.
+  for (int i = 0; i < 100; ++i) {
+    spinner.OnWakeup(20us);
+    spinner.OnIdle(5us);
+  }
+  EXPECT_GE(spinner.SpinTime(), 5us);
+  EXPECT_LE(spinner.SpinTime(), 100us);
+
+  // Tasks arrive much later than it takes to wake up a parked thread.
+  for (int i = 0; i < 100; ++i) spinner.OnIdle(1ms);
+  EXPECT_EQ(spinner.SpinTime().count(), 0);
+}
+
+TEST(EventCount, WakeupLatency) {
+  using namespace std::chrono_literals;
+  internal::EventCount event_count(1);
+  internal::EventCount::Waiter *waiter = event_count.waiter(0);
+
+  // A wait that times out is not a wake up.
+  event_count.Prewait();
+  EXPECT_FALSE(event_count.CommitWaitUntil(
+      waiter, std::chrono::steady_clock::now() + 10ms));
+  EXPECT_LT(waiter->TakeWakeupLatency().count(), 0);
+  // Neither is an interrupted one.
+  event_count.Interrupt(waiter);
+  EXPECT_FALSE(event_count.ResumeWaitUntil(
+      waiter, std::chrono::steady_clock::time_point::max()));
+  EXPECT_LT(waiter->TakeWakeupLatency().count(), 0);
+  // The signal is already there when the waiter resumes, it does not park.
+  event_count.Notify(/*notify_all=*/false);
+  EXPECT_TRUE(event_count.ResumeWaitUntil(
+      waiter, std::chrono::steady_clock::time_point::max()));
+  EXPECT_LT(waiter->TakeWakeupLatency().count(), 0);
+
+  // A parked waiter woken up by Notify reports its latency once. The waiter
+  // may consume the signal before it parks, try a few times.
+  bool sampled = false;
+  for (int i = 0; i < 100 && !sampled; ++i) {
+    std::atomic<bool> prewaited{false};
+    std::thread notifier([&]() {
+      while (!prewaited.load()) std::this_thread::yield();
+      std::this_thread::sleep_for(1ms);
+      event_count.Notify(/*notify_all=*/false);
+    });
+    event_count.Prewait();
+    prewaited.store(true);
+    event_count.CommitWait(waiter);
+    notifier.join();
+    sampled = waiter->TakeWakeupLatency().count() >= 0;
+    EXPECT_LT(waiter->TakeWakeupLatency().count(), 0);
+  }
+  EXPECT_TRUE(sampled);
+
+  // A cancelled wait leaves no sample either.
+  event_count.Prewait();
+  event_count.CancelWait();
+  EXPECT_LT(waiter->TakeWakeupLatency().count(), 0);
+}
+
+TEST(EventCount, Abandon) {
+  using namespace std::chrono_literals;
+  internal::EventCount event_count(2);
+  internal::EventCount::Waiter *bottom = event_count.waiter(0);
+  internal::EventCount::Waiter *top = event_count.waiter(1);
+  auto commit_and_time_out = [&](internal::EventCount::Waiter *waiter) {
+    event_count.Prewait();
+    EXPECT_FALSE(event_count.CommitWaitUntil(
+        waiter, std::chrono::steady_clock::now() + 1ms));
+  };
+  auto signaled = [&](internal::EventCount::Waiter *waiter) {
+    return event_count.ResumeWaitUntil(waiter,
+                                       std::chrono::steady_clock::now());
+  };
+
+  // The notification skips an abandoned waiter.
+  commit_and_time_out(bottom);
+  commit_and_time_out(top);
+  EXPECT_FALSE(event_count.Abandon(top));
+  event_count.Notify(/*notify_all=*/false);
+  EXPECT_TRUE(signaled(bottom));
+
+  // An abandoned waiter below a live one stays in the stack until a
+  // notification reaches it, the waiters above it are not woken up.
+  commit_and_time_out(bottom);
+  commit_and_time_out(top);
+  EXPECT_FALSE(event_count.Abandon(bottom));
+  EXPECT_FALSE(signaled(top));
+  event_count.Notify(/*notify_all=*/false);
+  EXPECT_TRUE(signaled(top));
+  // Pops the abandoned waiter, nobody else is waiting.
+  event_count.Notify(/*notify_all=*/false);
+
+  // The next wait of an abandoned waiter takes its place in the stack over.
+  commit_and_time_out(bottom);
+  EXPECT_FALSE(event_count.Abandon(bottom));
+  commit_and_time_out(bottom);
+  event_count.Notify(/*notify_all=*/false);
+  EXPECT_TRUE(signaled(bottom));
+
+  // A waiter signaled before it abandons the wait owns the notification.
+  commit_and_time_out(bottom);
+  event_count.Notify(/*notify_all=*/false);
+  EXPECT_TRUE(event_count.Abandon(bottom));
+
+  // Abandoned waiters may stay in the stack when the event count is destroyed.
+  commit_and_time_out(top);
+  EXPECT_FALSE(event_count.Abandon(top));
+}
+
+TEST(NonBlockingWorkQueue, SpinPolicies) {
+  for (SpinPolicy policy : {SpinPolicy::kFixed, SpinPolicy::kAdaptive,
+                            SpinPolicy::kPowerSaving}) {
+    internal::QuiescingState state;
+    WorkQueueOptions options;
+    options.spin.policy = policy;
+    WorkQueue queue(&state, 2, options);
+
+    constexpr int kNumTasks = 1000;
+    std::atomic<int> executed{0};
+    for (int i = 0; i < kNumTasks; ++i) {
+      latch done(1);
+      queue.AddTask(TaskFunction([&]() {
+        executed.fetch_add(1);
+        done.count_down();
+      }));
+      done.wait();
+    }
+    queue.Quiesce();
+    EXPECT_EQ(executed.load(), kNumTasks);
+
+    if (policy == SpinPolicy::kPowerSaving) {
+      WorkQueueStats stats;
+      queue.GetStats(&stats);
+      for (const WorkQueueStats::Worker &worker : stats.nonBlocking.workers) {
+        EXPECT_EQ(worker.numSpinIterations, 0u);
+      }
+    }
+  }
+}
+
+TEST(WorkerAffinity, WorkerIndex) {
+  EXPECT_EQ(WorkerAffinity::Worker(2).WorkerIndex(4), 2u);
+  EXPECT_EQ(WorkerAffinity::Worker(6).WorkerIndex(4), 2u);
+
+  // Keys map to stable workers, and sequential keys are spread over all of
+  // them.
+  std::vector<int> hits(8, 0);
+  for (uint64_t key = 0; key < 800; ++key) {
+    unsigned index = WorkerAffinity::Key(key).WorkerIndex(8);
+    ASSERT_LT(index, 8u);
+    EXPECT_EQ(WorkerAffinity::Key(key).WorkerIndex(8), index);
+    ++hits[index];
+  }
+  for (int h : hits) EXPECT_GT(h, 50);
+}
+
+TEST(NonBlockingWorkQueue, AddTaskWithAffinity) {
+  internal::QuiescingState state;
+  constexpr int kNumThreads = 4;
+  WorkQueue queue(&state, kNumThreads);
+
+  // Keep all the workers busy, so that nobody steals the tasks.
+  latch started(kNumThreads);
+  latch release(1);
+  for (int i = 0; i < kNumThreads; ++i) {
+    queue.AddTask(TaskFunction([&]() {
+      started.count_down();
+      release.wait();
+    }));
+  }
+  started.wait();
+
+  constexpr int kNumTasks = 10;
+  std::atomic<int> executed{0};
+  for (int i = 0; i < kNumTasks; ++i) {
+    queue.AddTask(TaskFunction([&]() { executed.fetch_add(1); }),
+                  WorkerAffinity::Worker(2));
+  }
+  const unsigned keyWorker = WorkerAffinity::Key(42).WorkerIndex(kNumThreads);
+  queue.AddTask(TaskFunction([&]() { executed.fetch_add(1); }),
+                WorkerAffinity::Key(42));
+
+  WorkQueueStats stats;
+  queue.GetStats(&stats);
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    size_t expected = (i == 2 ? kNumTasks : 0) + (i == keyWorker ? 1 : 0);
+    EXPECT_EQ(stats.nonBlocking.workers[i].queueDepth, expected) << i;
+  }
+
+  release.count_down();
+  queue.Quiesce();
+  EXPECT_EQ(executed.load(), kNumTasks + 1);
+}
+
+TEST(NonBlockingWorkQueue, SetNumActiveWorkers) {
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 4);
+  EXPECT_EQ(queue.NumActiveWorkers(), 4u);
+  EXPECT_EQ(queue.SetNumActiveWorkers(0), 1u);
+  EXPECT_EQ(queue.SetNumActiveWorkers(10), 4u);
+  EXPECT_EQ(queue.SetNumActiveWorkers(2), 2u);
+
+  // Let the surplus workers retire.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  // Only two workers pick up blocking tasks.
+  std::atomic<int> started{0};
+  latch release(1);
+  for (int i = 0; i < 3; ++i) {
+    queue.AddTask(TaskFunction([&]() {
+      started.fetch_add(1);
+      release.wait();
+    }));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(started.load(), 2);
+
+  // A retired worker comes back and steals the third task.
+  EXPECT_EQ(queue.SetNumActiveWorkers(3), 3u);
+  for (int i = 0; i < 1000 && started.load() < 3; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(started.load(), 3);
+
+  release.count_down();
+  queue.Quiesce();
+  EXPECT_TRUE(queue.AllBlocked());
+}
+
+TEST(NonBlockingWorkQueue, PinnedWorkers) {
+  // Whatever the machine topology is (possibly unknown), a queue with pinned
+  // workers runs all the tasks.
+  internal::QuiescingState state;
+  WorkQueueOptions options;
+  options.pinWorkers = true;
+  WorkQueue queue(&state, 4, options);
+
+  std::atomic<int> executed{0};
+  for (int i = 0; i < 1000; ++i) {
+    queue.AddTask(TaskFunction([&]() {
+      for (int j = 0; j < 4; ++j) {
+        queue.AddTask(TaskFunction([&]() { executed.fetch_add(1); }));
+      }
+    }));
+  }
+  queue.Quiesce();
+  EXPECT_EQ(executed.load(), 4000);
+}
+
+TEST(NonBlockingWorkQueue, ExternalProducers) {
+  // Free-standing threads submit into their own submission rings, more tasks
+  // than a ring holds, and more producers than the queue has rings.
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 2);
+
+  constexpr int kNumProducers = 80;
+  constexpr int kNumTasks = 1000;
+  std::atomic<int> executed{0};
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kNumProducers; ++i) {
+    producers.emplace_back([&]() {
+      for (int j = 0; j < kNumTasks; ++j) {
+        queue.AddTask(TaskFunction([&]() { executed.fetch_add(1); }));
+      }
+    });
+  }
+  for (std::thread &producer : producers) producer.join();
+  queue.Quiesce();
+  EXPECT_EQ(executed.load(), kNumProducers * kNumTasks);
+}
+
+std::mutex blockedReportsMu;
+std::vector<BlockedWorkerReport> blockedReports;
+
+void RecordBlockedWorker(const BlockedWorkerReport &report) {
+  std::lock_guard<std::mutex> lock(blockedReportsMu);
+  blockedReports.push_back(report);
+}
+
+TEST(NonBlockingWorkQueue, CompensateBlockedWorkers) {
+  WorkQueueOptions options;
+  options.blockingCalls.threshold = std::chrono::milliseconds(20);
+  options.blockingCalls.maxCompensatingWorkers = 2;
+  options.blockingCalls.report = RecordBlockedWorker;
+
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 2, options);
+  EXPECT_EQ(queue.NumActiveWorkers(), 2u);
+  EXPECT_EQ(queue.SetNumActiveWorkers(8), 2u);
+
+  // Both workers get stuck in a blocking call, and tasks submitted after that
+  // still run on the compensating workers.
+  latch blocked(2);
+  latch release(1);
+  for (int i = 0; i < 2; ++i) {
+    queue.AddTask(TaskFunction([&]() {
+      ScopedTaskTraceName traceName("slow_read");
+      blocked.count_down();
+      release.wait();
+    }));
+  }
+  blocked.wait();
+
+  constexpr int kNumTasks = 100;
+  latch done(kNumTasks);
+  for (int i = 0; i < kNumTasks; ++i) {
+    queue.AddTask(TaskFunction([&]() { done.count_down(); }));
+  }
+  done.wait();
+  EXPECT_EQ(queue.NumActiveWorkers(), 4u);
+
+  release.count_down();
+  queue.Quiesce();
+  EXPECT_EQ(queue.NumBlockedTasks(), 2u);
+
+  // Compensating workers retire once the blocked tasks are done.
+  while (queue.NumActiveWorkers() != 2u) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::lock_guard<std::mutex> lock(blockedReportsMu);
+  ASSERT_EQ(blockedReports.size(), 2u);
+  for (const BlockedWorkerReport &report : blockedReports) {
+    EXPECT_EQ(report.taskName, "slow_read");
+    EXPECT_TRUE(report.compensated);
+    EXPECT_GE(report.duration, options.blockingCalls.threshold);
+  }
+}
+
+TEST(NonBlockingWorkQueue, LazyStart) {
+  WorkQueueOptions options;
+  options.elastic.lazyStart = true;
+
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 4, options);
+  EXPECT_EQ(queue.NumStartedWorkers(), 0u);
+
+  constexpr int kNumTasks = 1000;
+  latch done(kNumTasks);
+  for (int i = 0; i < kNumTasks; ++i) {
+    queue.AddTask(TaskFunction([&]() { done.count_down(); }));
+  }
+  done.wait();
+  EXPECT_GE(queue.NumStartedWorkers(), 1u);
+  EXPECT_LE(queue.NumStartedWorkers(), 4u);
+
+  // Timers do not need a running worker to be scheduled.
+  queue.Quiesce();
+  latch fired(1);
+  queue.AddTimer(
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(5),
+      TaskFunction([&]() { fired.count_down(); }));
+  fired.wait();
+}
+
+TEST(NonBlockingWorkQueue, ReleaseIdleWorkers) {
+  WorkQueueOptions options;
+  options.elastic.lazyStart = true;
+  options.elastic.idleTimeout = std::chrono::milliseconds(20);
+
+  internal::QuiescingState state;
+  WorkQueue queue(&state, 4, options);
+
+  for (int round = 0; round < 3; ++round) {
+    // Keep all the workers busy at the same time, so that all of them start.
+    latch running(4);
+    latch release(1);
+    for (int i = 0; i < 4; ++i) {
+      queue.AddTask(TaskFunction([&]() {
+        running.count_down();
+        release.wait();
+      }));
+    }
+    running.wait();
+    EXPECT_EQ(queue.NumStartedWorkers(), 4u);
+    release.count_down();
+    // The latches are reused by the next round, wait until the tasks are done
+    // with them.
+    queue.Quiesce();
+
+    while (queue.NumStartedWorkers() != 0u) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    WorkQueueStats stats;
+    queue.GetStats(&stats);
+    EXPECT_EQ(stats.nonBlocking.numStartedWorkers, 0u);
+  }
+}
+
+TEST(IdleThreadStack, Handoff) {
+  internal::IdleThreadStack stack;
+  internal::IdleThreadStack::Slot *slot = stack.NewSlot();
+  ASSERT_NE(slot, nullptr);
+
+  auto identity = [](TaskFunction task) { return task; };
+  std::optional<TaskFunction> rejected =
+      stack.Handoff(TaskFunction([]() {}), identity);
+  EXPECT_TRUE(rejected.has_value());
+
+  // The deadline has already passed, the slot is left on the stack but can't
+  // be claimed anymore.
+  EXPECT_FALSE(stack.Wait(slot, std::chrono::steady_clock::now()).has_value());
+  rejected = stack.Handoff(TaskFunction([]() {}), identity);
+  EXPECT_TRUE(rejected.has_value());
+
+  int value = 0;
+  latch waiting(1);
+  std::thread owner([&]() {
+    waiting.count_down();
+    std::optional<TaskFunction> task = stack.Wait(
+        slot, std::chrono::steady_clock::now() + std::chrono::seconds(60));
+    ASSERT_TRUE(task.has_value());
+    (*task)();
+  });
+  waiting.wait();
+  for (;;) {
+    rejected = stack.Handoff(TaskFunction([&]() { value = 42; }), identity);
+    if (!rejected.has_value()) break;
+    std::this_thread::yield();
+  }
+  owner.join();
+  EXPECT_EQ(value, 42);
+  EXPECT_EQ(stack.NumIdle(), 0u);
+}
+
+TEST(IdleThreadStack, Stop) {
+  internal::IdleThreadStack stack;
+  std::vector<internal::IdleThreadStack::Slot *> slots;
+  for (int i = 0; i < 4; ++i) slots.push_back(stack.NewSlot());
+
+  std::vector<std::thread> threads;
+  for (internal::IdleThreadStack::Slot *slot : slots) {
+    threads.emplace_back([&stack, slot]() {
+      const auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(60);
+      EXPECT_FALSE(stack.Wait(slot, deadline).has_value());
+    });
+  }
+  while (stack.NumIdle() != slots.size()) std::this_thread::yield();
+  stack.Stop();
+  for (std::thread &thread : threads) thread.join();
+
+  // Exited slots are reused.
+  for (internal::IdleThreadStack::Slot *slot : slots) stack.FreeSlot(slot);
+  EXPECT_EQ(stack.NewSlot(), slots.back());
+}
+
+TEST(BlockingWorkQueue, RunBlockingTasks) {
+  using BlockingQueue =
+      internal::BlockingWorkQueue<internal::StdThreadingEnvironment>;
+  internal::QuiescingState state;
+  BlockingQueue queue(&state, 1, /*maxNumDynamicThreads=*/4);
+
+  constexpr int kNumProducers = 4;
+  constexpr int kNumTasks = 2000;
+  std::atomic<int> executed{0};
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kNumProducers; ++p) {
+    producers.emplace_back([&]() {
+      for (int i = 0; i < kNumTasks; ++i) {
+        std::optional<TaskFunction> rejected = queue.RunBlockingTask(
+            TaskFunction([&]() { executed.fetch_add(1); }));
+        // All the dynamic threads are busy.
+        if (rejected.has_value()) (*rejected)();
+      }
+    });
+  }
+  for (std::thread &producer : producers) producer.join();
+  queue.Quiesce();
+  EXPECT_EQ(executed.load(), kNumProducers * kNumTasks);
+
+  WorkQueueStats stats;
+  queue.GetStats(&stats);
+  EXPECT_EQ(stats.numDynamicThreads, 0u);
+  EXPECT_EQ(stats.numIdleDynamicThreads, 0u);
+  EXPECT_LE(stats.numDynamicThreadsStarted, stats.numDynamicTasks);
+
+  // Idle threads time out, and the queue starts new ones later.
+  BlockingQueue shortIdle(&state, 1, /*maxNumDynamicThreads=*/2,
+                          std::chrono::milliseconds(1));
+  for (int round = 0; round < 3; ++round) {
+    latch done(1);
+    std::optional<TaskFunction> rejected =
+        shortIdle.RunBlockingTask(TaskFunction([&]() { done.count_down(); }));
+    ASSERT_FALSE(rejected.has_value());
+    done.wait();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+TEST(TaskTraceName, ReadFromAnotherThread) {
+  // The slot is destroyed with the owner thread, it must stay alive until the
+  // reader is done.
+  TaskTraceName *name = nullptr;
+  latch set(1);
+  latch read(1);
+  latch cleared(1);
+  latch exit(1);
+  std::thread owner([&]() {
+    name = TaskTraceName::ThisThread();
+    {
+      ScopedTaskTraceName traceName(std::string(100, 'x'));
+      set.count_down();
+      read.wait();
+    }
+    cleared.count_down();
+    exit.wait();
+  });
+  set.wait();
+  EXPECT_EQ(name->Get(), std::string(TaskTraceName::kMaxLength, 'x'));
+  read.count_down();
+  cleared.wait();
+  EXPECT_EQ(name->Get(), "");
+  exit.count_down();
+  owner.join();
+}
+
+TEST(TaskTraceName, RedirectedSlotOutlivesThread) {
+  TaskTraceName slot;
+  std::thread owner([&]() {
+    TaskTraceName::SetThisThread(&slot);
+    EXPECT_EQ(TaskTraceName::ThisThread(), &slot);
+    TaskTraceName::ThisThread()->Set("elastic");
+    TaskTraceName::SetThisThread(nullptr);
+    EXPECT_NE(TaskTraceName::ThisThread(), &slot);
+  });
+  owner.join();
+  EXPECT_EQ(slot.Get(), "elastic");
+}
+
+int main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
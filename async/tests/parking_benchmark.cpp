@@ -0,0 +1,184 @@
+// Wake up latency and throughput of parked threads, for the EventCount used by
+// the work queues and for the latch. Compare builds with and without
+// `ASYNC_USE_FUTEX` (see async/support/futex.h).
+//
+//   PingPong: two threads wake each other up in turns, the time per iteration
+//             is a round trip of two wake ups.
+//   FanOut:   one thread wakes up N parked threads, the time per iteration is
+//             until the last of them is running again.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "async/concurrent/event_count.h"
+#include "async/support/latch.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+
+// A generation counter with threads parked on the EventCount until it changes,
+// the same wait protocol the work queues use for their task queues.
+class Generation {
+ public:
+  explicit Generation(unsigned num_waiters) : mEventCount(num_waiters) {}
+
+  uint64_t Get() const { return mGeneration.load(std::memory_order_acquire); }
+
+  void Advance(bool notify_all) {
+    mGeneration.fetch_add(1, std::memory_order_release);
+    mEventCount.Notify(notify_all);
+  }
+
+  // Parks the caller as the `index` waiter until the generation is not `gen`.
+  void WaitChange(unsigned index, uint64_t gen) {
+    internal::EventCount::Waiter *waiter = mEventCount.waiter(index);
+    while (Get() == gen) {
+      mEventCount.Prewait();
+      if (Get() != gen) {
+        mEventCount.CancelWait();
+        return;
+      }
+      mEventCount.CommitWait(waiter);
+    }
+  }
+
+ private:
+  std::atomic<uint64_t> mGeneration{0};
+  internal::EventCount mEventCount;
+};
+
+void BM_EventCountPingPong(benchmark::State &state) {
+  Generation ping(1);
+  Generation pong(1);
+  std::atomic<bool> stop{false};
+
+  std::thread partner([&]() {
+    uint64_t gen = 0;
+    for (;;) {
+      ping.WaitChange(0, gen);
+      gen = ping.Get();
+      if (stop.load()) return;
+      pong.Advance(/*notify_all=*/false);
+    }
+  });
+
+  for (auto _ : state) {
+    const uint64_t gen = pong.Get();
+    ping.Advance(/*notify_all=*/false);
+    pong.WaitChange(0, gen);
+  }
+
+  stop.store(true);
+  ping.Advance(/*notify_all=*/false);
+  partner.join();
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_EventCountPingPong)->UseRealTime();
+
+void BM_EventCountFanOut(benchmark::State &state) {
+  const unsigned num_threads = static_cast<unsigned>(state.range(0));
+  Generation go(num_threads);
+  Generation done(1);
+  std::atomic<unsigned> running{0};
+  std::atomic<bool> stop{false};
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i]() {
+      uint64_t gen = 0;
+      for (;;) {
+        go.WaitChange(i, gen);
+        gen = go.Get();
+        if (stop.load()) return;
+        if (running.fetch_add(1) + 1 == num_threads) {
+          done.Advance(/*notify_all=*/false);
+        }
+      }
+    });
+  }
+
+  for (auto _ : state) {
+    const uint64_t gen = done.Get();
+    running.store(0);
+    go.Advance(/*notify_all=*/true);
+    done.WaitChange(0, gen);
+  }
+
+  stop.store(true);
+  go.Advance(/*notify_all=*/true);
+  for (std::thread &thread : threads) thread.join();
+  state.SetItemsProcessed(state.iterations() * num_threads);
+}
+BENCHMARK(BM_EventCountFanOut)->Arg(2)->Arg(8)->UseRealTime();
+
+// A latch can't be reset, every iteration uses a new pair of latches prepared
+// before the timing starts.
+std::vector<std::unique_ptr<latch>> MakeLatches(size_t n, ptrdiff_t count) {
+  std::vector<std::unique_ptr<latch>> latches;
+  latches.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    latches.push_back(std::make_unique<latch>(count));
+  }
+  return latches;
+}
+
+void BM_LatchPingPong(benchmark::State &state) {
+  const size_t n = state.max_iterations;
+  std::vector<std::unique_ptr<latch>> ping = MakeLatches(n, 1);
+  std::vector<std::unique_ptr<latch>> pong = MakeLatches(n, 1);
+
+  std::thread partner([&]() {
+    for (size_t i = 0; i < n; ++i) {
+      ping[i]->wait();
+      pong[i]->count_down();
+    }
+  });
+
+  size_t i = 0;
+  for (auto _ : state) {
+    ping[i]->count_down();
+    pong[i]->wait();
+    ++i;
+  }
+
+  partner.join();
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_LatchPingPong)->UseRealTime();
+
+void BM_LatchFanOut(benchmark::State &state) {
+  const unsigned num_threads = static_cast<unsigned>(state.range(0));
+  const size_t n = state.max_iterations;
+  std::vector<std::unique_ptr<latch>> go = MakeLatches(n, 1);
+  std::vector<std::unique_ptr<latch>> done = MakeLatches(n, num_threads);
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&]() {
+      for (size_t i = 0; i < n; ++i) {
+        go[i]->wait();
+        done[i]->count_down();
+      }
+    });
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    go[i]->count_down();
+    done[i]->wait();
+    ++i;
+  }
+
+  for (std::thread &thread : threads) thread.join();
+  state.SetItemsProcessed(state.iterations() * num_threads);
+}
+BENCHMARK(BM_LatchFanOut)->Arg(2)->Arg(8)->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,121 @@
+// Waiting on several unavailable values, with HostContext::RunWhenReady and
+// with a GeneralFunction called on unavailable arguments. Every iteration
+// creates the values, waits on them and makes them available.
+//
+// Allocations per iteration:
+//   host_allocs: through the ProfiledAllocator of the context, the async
+//                values themselves.
+//   heap_allocs: operator new calls, the bookkeeping of the waits.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "async/concurrent/concurrent_work_queue.h"
+#include "async/context/host_allocator.h"
+#include "async/context/host_context.h"
+#include "async/context/native_function.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+std::atomic<int64_t> num_heap_allocations{0};
+}  // namespace
+
+void *operator new(size_t size) {
+  num_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size)) return ptr;
+  abort();
+}
+
+// GCC assumes that the pointer comes from the default operator new.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+#pragma GCC diagnostic pop
+
+namespace {
+
+// Never destroyed, a ProfiledAllocator prints its profile when destroyed.
+HostContext *ProfiledHost() {
+  static HostContext *host =
+      new HostContext([](const DecodedDiagnostic &) {},
+                      CreateProfiledAllocator(CreateMallocAllocator()),
+                      CreateSingleThreadedWorkQueue());
+  return host;
+}
+
+class AllocationCounters {
+ public:
+  explicit AllocationCounters(HostContext *host)
+      : mHost(host),
+        mHostStart(GetTotalNumAllocations(*host->allocator())),
+        mHeapStart(num_heap_allocations.load()) {}
+
+  void Report(benchmark::State &state) const {
+    state.counters["host_allocs"] = benchmark::Counter(
+        GetTotalNumAllocations(*mHost->allocator()) - mHostStart,
+        benchmark::Counter::kAvgIterations);
+    state.counters["heap_allocs"] =
+        benchmark::Counter(num_heap_allocations.load() - mHeapStart,
+                           benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  HostContext *mHost;
+  int64_t mHostStart;
+  int64_t mHeapStart;
+};
+
+void BM_RunWhenReady(benchmark::State &state) {
+  HostContext *host = ProfiledHost();
+  const int num_inputs = state.range(0);
+  std::vector<RCReference<AsyncValue>> inputs(num_inputs);
+  int64_t num_calls = 0;
+  AllocationCounters counters(host);
+  for (auto _ : state) {
+    for (auto &input : inputs) {
+      input = host->MakeUnconstructedAsyncValueRef<int>().ReleaseRCRef();
+    }
+    host->RunWhenReady(inputs, [&num_calls]() { ++num_calls; });
+    for (auto &input : inputs) input->emplace<int>(1);
+  }
+  counters.Report(state);
+  benchmark::DoNotOptimize(num_calls);
+}
+BENCHMARK(BM_RunWhenReady)->Arg(2)->Arg(4)->Arg(8)->Arg(16);
+
+void BM_FunctionOnUnavailableArgs(benchmark::State &state) {
+  HostContext *host = ProfiledHost();
+  RCReference<const Function> add = TakeRef(NewFunction(
+      "add", [](AsyncValue *const *args, int num_args,
+                RCReference<AsyncValue> *results, int, HostContext *host) {
+        int sum = 0;
+        for (int i = 0; i < num_args; ++i) sum += args[i]->get<int>();
+        results[0] = host->MakeAvailableAsyncValueRef<int>(sum).ReleaseRCRef();
+      }));
+  const int num_args = state.range(0);
+  std::vector<RCReference<AsyncValue>> args(num_args);
+  std::vector<AsyncValue *> arg_ptrs(num_args);
+  RCReference<AsyncValue> result;
+  AllocationCounters counters(host);
+  for (auto _ : state) {
+    for (int i = 0; i < num_args; ++i) {
+      args[i] = host->MakeUnconstructedAsyncValueRef<int>().ReleaseRCRef();
+      arg_ptrs[i] = args[i].get();
+    }
+    add->Execute(arg_ptrs, absl::MakeSpan(&result, 1), host);
+    for (auto &arg : args) arg->emplace<int>(1);
+    benchmark::DoNotOptimize(result->get<int>());
+  }
+  counters.Report(state);
+}
+BENCHMARK(BM_FunctionOnUnavailableArgs)->Arg(2)->Arg(4)->Arg(8)->Arg(16);
+
+}  // namespace
@@ -0,0 +1,140 @@
+#include "async/context/task_group.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "async/concurrent/concurrent_work_queue.h"
+#include "async/context/host_allocator.h"
+#include "async/context/host_context.h"
+#include "async/support/latch.h"
+#include "gtest/gtest.h"
+
+using namespace sss;
+using namespace async;
+
+namespace {
+int64_t ParallelSum(HostContext *host, absl::Span<const int> values) {
+  if (values.size() <= 16) {
+    return std::accumulate(values.begin(), values.end(), int64_t{0});
+  }
+  int64_t left = 0;
+  TaskGroup group(host);
+  group.Run([&]() {
+    left = ParallelSum(host, values.subspan(0, values.size() / 2));
+  });
+  const int64_t right = ParallelSum(host, values.subspan(values.size() / 2));
+  group.Wait();
+  return left + right;
+}
+
+std::unique_ptr<HostContext> CreateSingleThreadedHostContext() {
+  return std::make_unique<HostContext>([](const DecodedDiagnostic &) {},
+                                       CreateMallocAllocator(),
+                                       CreateSingleThreadedWorkQueue());
+}
+}  // namespace
+
+TEST(TaskGroup, WaitFromFreeStandingThread) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(4, 1);
+
+  std::atomic<int> executed{0};
+  TaskGroup group(host.get());
+  for (int i = 0; i < 100; ++i) {
+    group.Run([&]() { executed.fetch_add(1); });
+  }
+  group.Wait();
+  EXPECT_EQ(executed.load(), 100);
+
+  // The group can be reused after Wait().
+  group.Run([&]() { executed.fetch_add(1); });
+  group.Wait();
+  EXPECT_EQ(executed.load(), 101);
+}
+
+TEST(TaskGroup, RecursiveForkJoin) {
+  std::vector<int> values(100000);
+  std::iota(values.begin(), values.end(), 0);
+  const int64_t expected =
+      std::accumulate(values.begin(), values.end(), int64_t{0});
+
+  for (int num_threads : {1, 4}) {
+    std::unique_ptr<HostContext> host =
+        CreateCustomHostContext(num_threads, 1);
+
+    // Nested groups wait in the worker threads, a single worker runs the whole
+    // recursion by itself without blocking.
+    latch done(1);
+    int64_t sum = 0;
+    host->EnqueueWork([&]() {
+      sum = ParallelSum(host.get(), values);
+      done.count_down();
+    });
+    done.wait();
+    EXPECT_EQ(sum, expected) << num_threads;
+
+    // Free-standing thread at the top of the recursion.
+    EXPECT_EQ(ParallelSum(host.get(), values), expected) << num_threads;
+  }
+}
+
+TEST(TaskGroup, WaitHelpsWhileWorkersAreBusy) {
+  std::unique_ptr<HostContext> host = CreateCustomHostContext(2, 1);
+
+  // Block one of the workers, the other one waits for the group and has to
+  // run all the group work itself.
+  latch blocked(1);
+  latch release(1);
+  host->EnqueueWork([&]() {
+    blocked.count_down();
+    release.wait();
+  });
+  blocked.wait();
+
+  latch done(1);
+  std::atomic<int> executed{0};
+  host->EnqueueWork([&]() {
+    TaskGroup group(host.get());
+    for (int i = 0; i < 100; ++i) {
+      // Work added to the group adds more work to the group.
+      group.Run([&]() {
+        executed.fetch_add(1);
+        group.Run([&]() { executed.fetch_add(1); });
+      });
+    }
+    group.Wait();
+    done.count_down();
+  });
+  done.wait();
+  EXPECT_EQ(executed.load(), 200);
+
+  release.count_down();
+  host->Quiesce();
+}
+
+TEST(TaskGroup, SingleThreadedWorkQueue) {
+  std::unique_ptr<HostContext> host = CreateSingleThreadedHostContext();
+
+  std::vector<int> values(1000);
+  std::iota(values.begin(), values.end(), 0);
+  EXPECT_EQ(ParallelSum(host.get(), values), 999 * 1000 / 2);
+
+  // The destructor waits for the pending work.
+  std::atomic<int> executed{0};
+  {
+    TaskGroup group(host.get());
+    for (int i = 0; i < 10; ++i) {
+      group.Run([&]() { executed.fetch_add(1); });
+    }
+  }
+  EXPECT_EQ(executed.load(), 10);
+}
+
+int main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,153 @@
+#include "async/concurrent/timer_wheel.h"
+
+#include <chrono>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using namespace sss;
+using namespace async;
+using namespace std::chrono_literals;
+
+using Clock = internal::TimerWheel::Clock;
+
+namespace {
+TaskFunction Record(std::vector<int> *fired, int id) {
+  return TaskFunction([fired, id]() { fired->push_back(id); });
+}
+}  // namespace
+
+TEST(TimerWheel, FiresInDeadlineOrder) {
+  const Clock::time_point start = Clock::now();
+  internal::TimerWheel wheel(1ms, start);
+  std::vector<int> fired;
+
+  wheel.Schedule(start + 5ms, Record(&fired, 5));
+  wheel.Schedule(start + 1ms, Record(&fired, 1));
+  wheel.Schedule(start + 300ms, Record(&fired, 300));
+  wheel.Schedule(start + 70s, Record(&fired, 70000));
+  EXPECT_EQ(wheel.Size(), 4u);
+  EXPECT_EQ(wheel.NextDeadline(), start + 1ms);
+
+  std::vector<TaskFunction> expired;
+  EXPECT_EQ(wheel.Advance(start, &expired), 0u);
+  EXPECT_FALSE(wheel.HasExpired(start));
+  EXPECT_TRUE(wheel.HasExpired(start + 1ms));
+
+  for (std::chrono::milliseconds now : {1ms, 4ms, 5ms, 299ms, 300ms, 69999ms,
+                                        70000ms}) {
+    wheel.Advance(start + now, &expired);
+    for (TaskFunction &task : expired) task();
+    expired.clear();
+  }
+  EXPECT_EQ(fired, (std::vector<int>{1, 5, 300, 70000}));
+  EXPECT_TRUE(wheel.Empty());
+  EXPECT_EQ(wheel.NextDeadline(), Clock::time_point::max());
+}
+
+TEST(TimerWheel, NeverFiresEarly) {
+  const Clock::time_point start = Clock::now();
+  internal::TimerWheel wheel(1ms, start);
+  std::vector<int> fired;
+
+  // Deadlines are rounded up to the wheel resolution.
+  wheel.Schedule(start + 2500us, Record(&fired, 0));
+  std::vector<TaskFunction> expired;
+  EXPECT_EQ(wheel.Advance(start + 2999us, &expired), 0u);
+  EXPECT_EQ(wheel.Advance(start + 3ms, &expired), 1u);
+
+  // Cascaded timers from the higher levels keep their exact deadline.
+  for (int i = 0; i < 64 * 64 + 10; i += 97) {
+    wheel.Schedule(start + 3ms + std::chrono::milliseconds(i),
+                   Record(&fired, i));
+  }
+  for (int i = 0; i < 64 * 64 + 10; ++i) {
+    expired.clear();
+    wheel.Advance(start + 3ms + std::chrono::milliseconds(i), &expired);
+    ASSERT_EQ(expired.size(), i % 97 == 0 ? 1u : 0u) << i;
+  }
+  EXPECT_TRUE(wheel.Empty());
+}
+
+TEST(TimerWheel, Cancel) {
+  const Clock::time_point start = Clock::now();
+  internal::TimerWheel wheel(1ms, start);
+  std::vector<int> fired;
+
+  TimerHandle first(wheel.Schedule(start + 10ms, Record(&fired, 1)));
+  TimerHandle second(wheel.Schedule(start + 10ms, Record(&fired, 2)));
+  TimerHandle third(wheel.Schedule(start + 1h, Record(&fired, 3)));
+  EXPECT_TRUE(first.IsPending());
+
+  EXPECT_TRUE(first.Cancel());
+  EXPECT_FALSE(first.Cancel());
+  EXPECT_FALSE(first.IsPending());
+  EXPECT_TRUE(third.Cancel());
+  EXPECT_EQ(wheel.Size(), 1u);
+  EXPECT_EQ(wheel.NextDeadline(), start + 10ms);
+
+  std::vector<TaskFunction> expired;
+  EXPECT_EQ(wheel.Advance(start + 2h, &expired), 1u);
+  expired[0]();
+  EXPECT_EQ(fired, std::vector<int>{2});
+  EXPECT_FALSE(second.IsPending());
+  EXPECT_FALSE(second.Cancel());
+  EXPECT_FALSE(TimerHandle().Cancel());
+}
+
+TEST(TimerWheel, EarliestAndLongJumps) {
+  const Clock::time_point start = Clock::now();
+  internal::TimerWheel wheel(1ms, start);
+  std::vector<int> fired;
+
+  bool earliest = false;
+  wheel.Schedule(start + 1h, Record(&fired, 1), &earliest);
+  EXPECT_TRUE(earliest);
+  wheel.Schedule(start + 2h, Record(&fired, 2), &earliest);
+  EXPECT_FALSE(earliest);
+  wheel.Schedule(start + 1s, Record(&fired, 0), &earliest);
+  EXPECT_TRUE(earliest);
+
+  // Timers scheduled in the past fire on the next advance.
+  wheel.Schedule(start - 1s, Record(&fired, -1), &earliest);
+  EXPECT_TRUE(earliest);
+
+  // A single advance over a long idle period fires everything in order, the
+  // wheel skips empty slots instead of visiting every tick.
+  std::vector<TaskFunction> expired;
+  EXPECT_EQ(wheel.Advance(start + 24h, &expired), 4u);
+  for (TaskFunction &task : expired) task();
+  EXPECT_EQ(fired, (std::vector<int>{-1, 0, 1, 2}));
+
+  // Deadlines far beyond the wheel range are clamped.
+  wheel.Schedule(Clock::time_point::max(), Record(&fired, 3));
+  EXPECT_LT(wheel.NextDeadline(), Clock::time_point::max());
+}
+
+TEST(TimerWheel, ManyTimers) {
+  const Clock::time_point start = Clock::now();
+  internal::TimerWheel wheel(1ms, start);
+
+  constexpr int kNumTimers = 1000000;
+  int fired = 0;
+  std::vector<TimerHandle> handles;
+  handles.reserve(kNumTimers);
+  for (int i = 0; i < kNumTimers; ++i) {
+    handles.emplace_back(wheel.Schedule(
+        start + std::chrono::milliseconds(i % 100000),
+        TaskFunction([&fired]() { ++fired; })));
+  }
+  for (int i = 0; i < kNumTimers; i += 2) handles[i].Cancel();
+  EXPECT_EQ(wheel.Size(), static_cast<size_t>(kNumTimers / 2));
+
+  std::vector<TaskFunction> expired;
+  wheel.Advance(start + 100s, &expired);
+  for (TaskFunction &task : expired) task();
+  EXPECT_EQ(fired, kNumTimers / 2);
+  EXPECT_TRUE(wheel.Empty());
+}
+
+int main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}